@@ -0,0 +1,472 @@
+// Searches for the shortest Hack assembly code for short sequences of VM stack commands, and writes the results as C
+// source for the translator's template table (w10MyAnswers/templates.c). To regenerate the table, run:
+//     gcc -O2 -o superopt superopt.c
+//     ./superopt > "../w10MyAnswers/templates.c"
+//
+// The translator doesn't always keep SP in RAM up to date (see sp_lag in w10MyAnswers/main.c): the real stack pointer
+// is RAM[SP] + lag, for some lag between -MAX_SP_LAG and MAX_SP_LAG which the translator knows. So for each pattern
+// and each starting lag we look for the shortest code which does the pattern's job and leaves the real stack pointer
+// at RAM[SP] + (some new lag in the same range). Between programs of equal length we prefer the one whose new lag is
+// closest to what it would be if SP weren't written at all, since the translator can often absorb a lag for free (e.g.
+// a pop after a push cancels it out) whereas writing SP always costs something.
+//
+// Every program starts with @SP, since nothing else can find the stack, and all other instructions are C-instructions
+// with no jump. We run candidates on a few random machine states at once and search breadth first, throwing away any
+// program that leaves every test state exactly as a shorter (or earlier) program does. A program that matches the
+// pattern on those states is then checked against many more random states, including awkward values like 0, -1 and
+// -32768, before we accept it. Programs that read or write memory anywhere except SP and the stack near the top are
+// rejected outright.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Must match MAX_SP_LAG in w10MyAnswers/main.c.
+#define MAX_SP_LAG 2
+// The longest program we search for, including the initial @SP. Each extra instruction multiplies the search by over a
+// hundred, so patterns whose shortest code is longer than this are left to the translator's hand-written code.
+#define MAX_LENGTH 6
+// The number of random states each candidate is run on during the search, and during the final check.
+#define SEARCH_TESTS 2
+#define CHECK_TESTS 20000
+// We model memory from WINDOW/2 below the initial SP to WINDOW/2 above it, plus SP itself.
+#define WINDOW 16
+#define MAX_NODES 8000000
+#define HASH_BUCKETS 16777216
+
+// The comp part of every C-instruction, in the same order as in w10MyAnswers/output.c.
+const char *CompStrings[] = {"0", "1", "-1", "D", "A", "!D", "!A", "-D", "-A", "D+1", "A+1", "D-1", "A-1", "D+A",
+                             "D-A", "A-D", "D&A", "D|A", "M", "!M", "-M", "M+1", "M-1", "D+M", "D-M", "M-D", "D&M",
+                             "D|M"};
+#define NUM_COMPS 28
+// Every non-empty destination, in the order of their bits.
+const char *DestStrings[] = {"M", "D", "MD", "A", "AM", "AD", "AMD"};
+const int DestBits[] = {1, 2, 3, 4, 5, 6, 7};
+#define NUM_DESTS 7
+// Instruction 0 is @SP, and instruction 1 + NUM_COMPS*d + c is dest d and comp c.
+#define NUM_INSTRUCTIONS (1 + NUM_COMPS*NUM_DESTS)
+
+// One VM command in a pattern, written as it should appear in the generated table.
+struct Command {
+    const char *command;
+    const char *segment;
+    int index;
+}; typedef struct Command Command;
+
+// A pattern is a short sequence of VM commands which together pop pops values and push pushes values. eval takes the
+// popped values with the top of the stack first, and returns the pushed values with the new top of the stack first.
+struct Pattern {
+    const char *description;
+    Command commands[3];
+    int no_commands;
+    int pops;
+    int pushes;
+    void (*eval)(const int16_t *in, int16_t *out);
+}; typedef struct Pattern Pattern;
+
+void eval_add(const int16_t *in, int16_t *out) { out[0] = in[1] + in[0]; }
+void eval_sub(const int16_t *in, int16_t *out) { out[0] = in[1] - in[0]; }
+void eval_and(const int16_t *in, int16_t *out) { out[0] = in[1] & in[0]; }
+void eval_or(const int16_t *in, int16_t *out) { out[0] = in[1] | in[0]; }
+void eval_neg(const int16_t *in, int16_t *out) { out[0] = -in[0]; }
+void eval_not(const int16_t *in, int16_t *out) { out[0] = ~in[0]; }
+void eval_reverse_sub(const int16_t *in, int16_t *out) { out[0] = in[0] - in[1]; }
+void eval_and_not(const int16_t *in, int16_t *out) { out[0] = in[1] & ~in[0]; }
+void eval_or_not(const int16_t *in, int16_t *out) { out[0] = in[1] | ~in[0]; }
+void eval_nand(const int16_t *in, int16_t *out) { out[0] = ~(in[1] & in[0]); }
+void eval_nor(const int16_t *in, int16_t *out) { out[0] = ~(in[1] | in[0]); }
+void eval_neg_add(const int16_t *in, int16_t *out) { out[0] = -(in[1] + in[0]); }
+void eval_double(const int16_t *in, int16_t *out) { out[0] = in[0] + in[0]; }
+void eval_dup(const int16_t *in, int16_t *out) { out[0] = in[0]; out[1] = in[0]; }
+
+const Pattern Patterns[] = {
+    {"add", {{"ADD", "CONSTANT", 0}}, 1, 2, 1, eval_add},
+    {"sub", {{"SUB", "CONSTANT", 0}}, 1, 2, 1, eval_sub},
+    {"and", {{"AND", "CONSTANT", 0}}, 1, 2, 1, eval_and},
+    {"or", {{"OR", "CONSTANT", 0}}, 1, 2, 1, eval_or},
+    {"neg", {{"NEG", "CONSTANT", 0}}, 1, 1, 1, eval_neg},
+    {"not", {{"NOT", "CONSTANT", 0}}, 1, 1, 1, eval_not},
+    {"neg, add", {{"NEG", "CONSTANT", 0}, {"ADD", "CONSTANT", 0}}, 2, 2, 1, eval_sub},
+    {"sub, neg", {{"SUB", "CONSTANT", 0}, {"NEG", "CONSTANT", 0}}, 2, 2, 1, eval_reverse_sub},
+    {"not, and", {{"NOT", "CONSTANT", 0}, {"AND", "CONSTANT", 0}}, 2, 2, 1, eval_and_not},
+    {"not, or", {{"NOT", "CONSTANT", 0}, {"OR", "CONSTANT", 0}}, 2, 2, 1, eval_or_not},
+    {"and, not", {{"AND", "CONSTANT", 0}, {"NOT", "CONSTANT", 0}}, 2, 2, 1, eval_nand},
+    {"or, not", {{"OR", "CONSTANT", 0}, {"NOT", "CONSTANT", 0}}, 2, 2, 1, eval_nor},
+    {"add, neg", {{"ADD", "CONSTANT", 0}, {"NEG", "CONSTANT", 0}}, 2, 2, 1, eval_neg_add},
+    {"push stack 0", {{"PUSH", "STACK", 0}}, 1, 1, 2, eval_dup},
+    {"push stack 0, add", {{"PUSH", "STACK", 0}, {"ADD", "CONSTANT", 0}}, 2, 1, 1, eval_double},
+};
+#define NUM_PATTERNS ((int)(sizeof(Patterns)/sizeof(Patterns[0])))
+#define NUM_LAGS (2*MAX_SP_LAG + 1)
+
+// The parts of the Hack machine a program can see: the A and D registers, SP (i.e. RAM[0]), and the window of memory
+// from base to base+WINDOW-1.
+struct Machine {
+    int16_t a;
+    int16_t d;
+    int16_t sp;
+    int16_t window[WINDOW];
+}; typedef struct Machine Machine;
+
+// A test is a machine state to run candidates on, together with its base address (which is its initial SP minus
+// WINDOW/2).
+struct Test {
+    Machine start;
+    int base;
+}; typedef struct Test Test;
+
+// Each node of the search is a program: the node for its program minus the last instruction, and that instruction.
+// state holds the machine state at the end of the program for each search test.
+struct Node {
+    int parent;
+    int instruction;
+    Machine state[SEARCH_TESTS];
+}; typedef struct Node Node;
+
+// The best program found so far for one pattern and starting lag.
+struct Result {
+    bool found;
+    int length;
+    int lag_out;
+    int program[MAX_LENGTH];
+}; typedef struct Result Result;
+
+Test search_tests[SEARCH_TESTS];
+Node *nodes;
+int no_nodes = 0;
+int *hash_table;
+Result results[NUM_PATTERNS][NUM_LAGS];
+
+uint32_t random_word();
+void make_test(Test *test, int special);
+bool step(Machine *machine, int base, int instruction);
+bool matches(const Machine *end, const Test *test, const Pattern *pattern, int lag_in, int *lag_out);
+void check_goals(int node, int length);
+bool verify(const int *program, int length, const Pattern *pattern, int lag_in, int lag_out);
+void get_program(int node, int *program, int length);
+bool add_node(int parent, int instruction, const Machine *state);
+unsigned int hash_state(const Machine *state);
+void print_instruction(int instruction, FILE *output);
+void print_table(FILE *output);
+
+int main() {
+    nodes = (Node *)malloc(MAX_NODES * sizeof(Node));
+    hash_table = (int *)malloc(HASH_BUCKETS * sizeof(int));
+    if (nodes == NULL || hash_table == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i=0; i<HASH_BUCKETS; i++) {
+        hash_table[i] = -1;
+    }
+    for (int i=0; i<SEARCH_TESTS; i++) {
+        make_test(&search_tests[i], -1);
+    }
+
+    // The root is the program consisting of just @SP.
+    Machine root[SEARCH_TESTS];
+    for (int i=0; i<SEARCH_TESTS; i++) {
+        root[i] = search_tests[i].start;
+        step(&root[i], search_tests[i].base, 0);
+    }
+    add_node(-1, 0, root);
+    check_goals(0, 1);
+
+    // level_start..level_end-1 are the nodes for programs of the current length. The longest programs aren't stored,
+    // just checked, and since every pattern has to write to memory they only need to end with an instruction that does.
+    int level_start = 0;
+    int level_end = 1;
+    for (int length=2; length<=MAX_LENGTH; length++) {
+        bool last = (length == MAX_LENGTH);
+        for (int parent=level_start; parent<level_end; parent++) {
+            for (int instruction=1; instruction<NUM_INSTRUCTIONS; instruction++) {
+                if (last && !(DestBits[(instruction-1) / NUM_COMPS] & 1)) {
+                    continue;
+                }
+                Machine state[SEARCH_TESTS];
+                bool valid = true;
+                for (int i=0; i<SEARCH_TESTS && valid; i++) {
+                    state[i] = nodes[parent].state[i];
+                    valid = step(&state[i], search_tests[i].base, instruction);
+                }
+                if (!valid) {
+                    continue;
+                }
+                if (last) {
+                    // Check this program without storing it, using a scratch node past the end of the table.
+                    nodes[no_nodes].parent = parent;
+                    nodes[no_nodes].instruction = instruction;
+                    memcpy(nodes[no_nodes].state, state, sizeof(state));
+                    check_goals(no_nodes, length);
+                } else if (add_node(parent, instruction, state)) {
+                    check_goals(no_nodes-1, length);
+                }
+            }
+        }
+        fprintf(stderr, "Searched programs of length %d (%d distinct states so far).\n", length, no_nodes);
+        level_start = level_end;
+        level_end = no_nodes;
+    }
+
+    print_table(stdout);
+    free(nodes);
+    free(hash_table);
+    return 0;
+}
+
+// Returns a pseudo-random 32-bit number. (We use our own generator so that the output is the same everywhere.)
+uint32_t random_word() {
+    static uint32_t state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Fills test with a random machine state. If special isn't -1, the stack near the top is filled with awkward values
+// chosen according to special instead.
+void make_test(Test *test, int special) {
+    const int16_t awkward[] = {0, 1, -1, 32767, -32768, 2, -2};
+    int sp = 300 + random_word() % 15000;
+    test->base = sp - WINDOW/2;
+    test->start.a = random_word();
+    test->start.d = random_word();
+    test->start.sp = sp;
+    for (int i=0; i<WINDOW; i++) {
+        test->start.window[i] = random_word();
+        if (special != -1) {
+            test->start.window[i] = awkward[(special + i*i + random_word() % 2) % 7];
+        }
+    }
+}
+
+// Runs one instruction on machine. Returns false if it touches memory we don't model.
+bool step(Machine *machine, int base, int instruction) {
+    if (instruction == 0) {
+        machine->a = 0;
+        return true;
+    }
+    int comp = (instruction-1) % NUM_COMPS;
+    int dest = DestBits[(instruction-1) / NUM_COMPS];
+    int16_t *m = NULL;
+    bool uses_m = (comp >= 18) || (dest & 1);
+    if (uses_m) {
+        if (machine->a == 0) {
+            m = &(machine->sp);
+        } else if (machine->a >= base && machine->a < base + WINDOW) {
+            m = &(machine->window[machine->a - base]);
+        } else {
+            return false;
+        }
+    }
+
+    int16_t a = machine->a;
+    int16_t d = machine->d;
+    int16_t value;
+    switch (comp) {
+        case 0: value = 0; break;
+        case 1: value = 1; break;
+        case 2: value = -1; break;
+        case 3: value = d; break;
+        case 4: value = a; break;
+        case 5: value = ~d; break;
+        case 6: value = ~a; break;
+        case 7: value = -d; break;
+        case 8: value = -a; break;
+        case 9: value = d + 1; break;
+        case 10: value = a + 1; break;
+        case 11: value = d - 1; break;
+        case 12: value = a - 1; break;
+        case 13: value = d + a; break;
+        case 14: value = d - a; break;
+        case 15: value = a - d; break;
+        case 16: value = d & a; break;
+        case 17: value = d | a; break;
+        case 18: value = *m; break;
+        case 19: value = ~*m; break;
+        case 20: value = -*m; break;
+        case 21: value = *m + 1; break;
+        case 22: value = *m - 1; break;
+        case 23: value = d + *m; break;
+        case 24: value = d - *m; break;
+        case 25: value = *m - d; break;
+        case 26: value = d & *m; break;
+        default: value = d | *m; break;
+    }
+    // As in the Hack CPU, M is written to the address A held before this instruction.
+    if (dest & 1) {
+        *m = value;
+    }
+    if (dest & 2) {
+        machine->d = value;
+    }
+    if (dest & 4) {
+        machine->a = value;
+    }
+    return true;
+}
+
+// Returns true if running a program on test's start state to reach end did the same as pattern starting from lag
+// lag_in, in which case *lag_out is set to the lag it finished with.
+bool matches(const Machine *end, const Test *test, const Pattern *pattern, int lag_in, int *lag_out) {
+    int sp = test->start.sp;
+    int real_sp = sp + lag_in;
+    int new_real_sp = real_sp - pattern->pops + pattern->pushes;
+    *lag_out = new_real_sp - end->sp;
+    if (*lag_out < -MAX_SP_LAG || *lag_out > MAX_SP_LAG) {
+        return false;
+    }
+
+    int16_t in[3];
+    int16_t out[3];
+    for (int i=0; i<pattern->pops; i++) {
+        in[i] = test->start.window[real_sp - 1 - i - test->base];
+    }
+    pattern->eval(in, out);
+    // Everything below the new top of the stack must be as the pattern says, and anything above it doesn't matter.
+    for (int address=test->base; address<new_real_sp; address++) {
+        int16_t expected = test->start.window[address - test->base];
+        if (address >= real_sp - pattern->pops) {
+            expected = out[new_real_sp - 1 - address];
+        }
+        if (end->window[address - test->base] != expected) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Checks whether the program ending at the given node (with length instructions) is a better way of doing any
+// pattern than the best found so far, and records it if so.
+void check_goals(int node, int length) {
+    for (int p=0; p<NUM_PATTERNS; p++) {
+        for (int lag=-MAX_SP_LAG; lag<=MAX_SP_LAG; lag++) {
+            Result *result = &(results[p][lag + MAX_SP_LAG]);
+            if (result->found && result->length < length) {
+                continue;
+            }
+            int lag_out;
+            bool ok = true;
+            for (int i=0; i<SEARCH_TESTS && ok; i++) {
+                int test_lag_out;
+                ok = matches(&(nodes[node].state[i]), &search_tests[i], &Patterns[p], lag, &test_lag_out);
+                if (i > 0 && test_lag_out != lag_out) {
+                    ok = false;
+                }
+                lag_out = test_lag_out;
+            }
+            int natural_lag = lag - Patterns[p].pops + Patterns[p].pushes;
+            if (!ok || (result->found && abs(result->lag_out - natural_lag) <= abs(lag_out - natural_lag))) {
+                continue;
+            }
+            int program[MAX_LENGTH];
+            get_program(node, program, length);
+            if (verify(program, length, &Patterns[p], lag, lag_out)) {
+                result->found = true;
+                result->length = length;
+                result->lag_out = lag_out;
+                memcpy(result->program, program, sizeof(program));
+            }
+        }
+    }
+}
+
+// Returns true if program does the same as pattern from lag lag_in to lag lag_out on many random tests.
+bool verify(const int *program, int length, const Pattern *pattern, int lag_in, int lag_out) {
+    for (int t=0; t<CHECK_TESTS; t++) {
+        Test test;
+        make_test(&test, (t % 2 == 0) ? (int)(t % 7) : -1);
+        Machine machine = test.start;
+        for (int i=0; i<length; i++) {
+            if (!step(&machine, test.base, program[i])) {
+                return false;
+            }
+        }
+        int test_lag_out;
+        if (!matches(&machine, &test, pattern, lag_in, &test_lag_out) || test_lag_out != lag_out) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Puts the program ending at node, which has length instructions, into program.
+void get_program(int node, int *program, int length) {
+    for (int i=length-1; i>=0; i--) {
+        program[i] = nodes[node].instruction;
+        node = nodes[node].parent;
+    }
+}
+
+// Adds a node for a program with the given parent and last instruction ending in state, unless another program has
+// already reached the same state (or we're out of space). Returns true if the node was added.
+bool add_node(int parent, int instruction, const Machine *state) {
+    if (no_nodes >= MAX_NODES - 1) {
+        return false;
+    }
+    unsigned int bucket = hash_state(state);
+    while (hash_table[bucket] != -1) {
+        if (memcmp(nodes[hash_table[bucket]].state, state, SEARCH_TESTS * sizeof(Machine)) == 0) {
+            return false;
+        }
+        bucket = (bucket + 1) % HASH_BUCKETS;
+    }
+    hash_table[bucket] = no_nodes;
+    nodes[no_nodes].parent = parent;
+    nodes[no_nodes].instruction = instruction;
+    memcpy(nodes[no_nodes].state, state, SEARCH_TESTS * sizeof(Machine));
+    no_nodes++;
+    return true;
+}
+
+// Returns which bucket of the hash table the given states belong in. (This is the FNV-1a hash function.)
+unsigned int hash_state(const Machine *state) {
+    const unsigned char *bytes = (const unsigned char *)state;
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<SEARCH_TESTS * sizeof(Machine); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash % HASH_BUCKETS;
+}
+
+// Writes the given instruction as a line of assembly inside a C string literal.
+void print_instruction(int instruction, FILE *output) {
+    if (instruction == 0) {
+        fputs("@SP\\n", output);
+    } else {
+        fprintf(output, "%s=%s\\n", DestStrings[(instruction-1) / NUM_COMPS], CompStrings[(instruction-1) % NUM_COMPS]);
+    }
+}
+
+void print_table(FILE *output) {
+    fputs("// Generated by superopt/superopt.c, which explains how. Don't edit this file by hand; change and rerun that\n"
+          "// instead.\n"
+          "#include \"templates.h\"\n"
+          "\n"
+          "const Template Templates[] = {\n", output);
+    int count = 0;
+    for (int p=0; p<NUM_PATTERNS; p++) {
+        for (int lag=-MAX_SP_LAG; lag<=MAX_SP_LAG; lag++) {
+            Result *result = &(results[p][lag + MAX_SP_LAG]);
+            if (!result->found) {
+                continue;
+            }
+            fprintf(output, "    // %s, from lag %d\n    {{", Patterns[p].description, lag);
+            for (int i=0; i<Patterns[p].no_commands; i++) {
+                const Command *command = &(Patterns[p].commands[i]);
+                fprintf(output, "%s{%s, %s, %d}", (i > 0) ? ", " : "", command->command, command->segment,
+                        command->index);
+            }
+            fprintf(output, "}, %d, %d, %d, \"", Patterns[p].no_commands, lag, result->lag_out);
+            for (int i=0; i<result->length; i++) {
+                print_instruction(result->program[i], output);
+            }
+            fputs("\"},\n", output);
+            count++;
+        }
+    }
+    fprintf(output, "};\n"
+                    "\n"
+                    "const int NumTemplates = %d;\n", count);
+}
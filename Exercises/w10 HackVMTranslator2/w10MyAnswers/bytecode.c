@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "output.h"
+
+// Keeps track of our position while decoding a .vmb file which has been read into memory.
+struct ByteReader {
+    const unsigned char *bytes;
+    long length;
+    long pos;
+}; typedef struct ByteReader ByteReader;
+
+void write_varint(unsigned int value, FILE *output);
+int intern_string(char ***strings, int *no_strings, int *strings_space, Symbol *indices[], const char *string);
+unsigned char read_byte(ByteReader *reader);
+unsigned int read_varint(ByteReader *reader);
+
+void write_bytecode(const InstructionList *list, FILE *output) {
+    // First build the string table, giving each distinct label or function name an index. indices is a symbol table
+    // (see output.h) whose addresses are those indices, so that looking up a name doesn't mean searching the table.
+    int no_strings = 0;
+    int strings_space = 16;
+    char **strings = (char **)malloc(strings_space * sizeof(char *));
+    Symbol **indices = (Symbol **)calloc(SYMBOL_BUCKETS, sizeof(Symbol *));
+    int *string_index = (int *)malloc((list->list_length + 1) * sizeof(int));
+    for (int i=0; i<list->list_length; i++) {
+        if (list->list_array[i].name != NULL) {
+            string_index[i] = intern_string(&strings, &no_strings, &strings_space, indices, list->list_array[i].name);
+        }
+    }
+    free_symbols(indices);
+    free(indices);
+
+    fputs("VMB1", output);
+    write_varint(no_strings, output);
+    for (int i=0; i<no_strings; i++) {
+        write_varint(strlen(strings[i]), output);
+        fwrite(strings[i], 1, strlen(strings[i]), output);
+    }
+
+    write_varint(list->list_length, output);
+    for (int i=0; i<list->list_length; i++) {
+        const Instruction *current = &(list->list_array[i]);
+        if (current->immediate || current->command == DROP || current->segment == STACK ||
+                (current->command == PUSH && current->segment == CONSTANT && current->index < 0)) {
+            printf("Error: Optimised instruction passed to write_bytecode.");
+            exit(EXIT_FAILURE);
+        }
+        fputc(current->command, output);
+        switch (current->command) {
+            case PUSH:
+            case POP:
+                fputc(current->segment, output);
+                write_varint(current->index, output);
+                break;
+            case LABEL:
+            case GOTO:
+            case IFGOTO:
+                write_varint(string_index[i], output);
+                break;
+            case FUNCTION:
+            case CALL:
+                write_varint(string_index[i], output);
+                write_varint(current->index, output);
+                break;
+            default:
+                break;
+        }
+    }
+
+    for (int i=0; i<no_strings; i++) {
+        free(strings[i]);
+    }
+    free(strings);
+    free(string_index);
+}
+
+InstructionList *read_bytecode(FILE *input) {
+    // Read the whole file into memory in one go, then decode it from there.
+    fseek(input, 0, SEEK_END);
+    long length = ftell(input);
+    fseek(input, 0, SEEK_SET);
+    unsigned char *bytes = (unsigned char *)malloc(length + 1);
+    if (fread(bytes, 1, length, input) != (size_t)length) {
+        printf("Error reading .vmb file.");
+        exit(EXIT_FAILURE);
+    }
+    ByteReader reader = {bytes, length, 0};
+
+    if (length < 4 || strncmp((const char *)bytes, "VMB1", 4) != 0) {
+        printf("Error: Not a .vmb file.");
+        exit(EXIT_FAILURE);
+    }
+    reader.pos = 4;
+
+    unsigned int no_strings = read_varint(&reader);
+    char **strings = (char **)malloc((no_strings + 1) * sizeof(char *));
+    for (unsigned int i=0; i<no_strings; i++) {
+        unsigned int string_length = read_varint(&reader);
+        if (string_length > MAX_LINE_LENGTH || reader.pos + string_length > length) {
+            printf("Error: Malformed string table in .vmb file.");
+            exit(EXIT_FAILURE);
+        }
+        strings[i] = (char *)malloc(string_length + 1);
+        memcpy(strings[i], bytes + reader.pos, string_length);
+        strings[i][string_length] = '\0';
+        reader.pos += string_length;
+    }
+
+    InstructionList *list = malloc_instruction_list();
+    unsigned int no_instructions = read_varint(&reader);
+    for (unsigned int i=0; i<no_instructions; i++) {
+        Keyword command = read_byte(&reader);
+        Keyword segment;
+        unsigned int index;
+        unsigned int name;
+        switch (command) {
+            case PUSH:
+            case POP:
+                segment = read_byte(&reader);
+                index = read_varint(&reader);
+                if (segment < LOCAL || segment > TEMP) {
+                    printf("Malformed instruction!");
+                    exit(EXIT_FAILURE);
+                }
+                add_instruction(list, command, segment, index, NULL);
+                break;
+            case LABEL:
+            case GOTO:
+            case IFGOTO:
+            case FUNCTION:
+            case CALL:
+                name = read_varint(&reader);
+                index = (command == FUNCTION || command == CALL) ? read_varint(&reader) : 0;
+                if (name >= no_strings) {
+                    printf("Malformed instruction!");
+                    exit(EXIT_FAILURE);
+                }
+                add_instruction(list, command, CONSTANT, index, strings[name]);
+                break;
+            case ADD: case SUB: case NEG: case AND: case OR: case NOT: case EQ: case GT: case LT: case RETURN:
+                add_instruction(list, command, CONSTANT, 0, NULL);
+                break;
+            default: printf("Malformed instruction!"); exit(EXIT_FAILURE);
+        }
+    }
+
+    for (unsigned int i=0; i<no_strings; i++) {
+        free(strings[i]);
+    }
+    free(strings);
+    free(bytes);
+    return list;
+}
+
+// Writes value to output as a varint.
+void write_varint(unsigned int value, FILE *output) {
+    while (value >= 0x80) {
+        fputc((value & 0x7F) | 0x80, output);
+        value >>= 7;
+    }
+    fputc(value, output);
+}
+
+// Returns the index of string in *strings, adding a copy of it to the end (and growing the array if need be) if it
+// isn't there already. indices holds the index of every string in *strings.
+int intern_string(char ***strings, int *no_strings, int *strings_space, Symbol *indices[], const char *string) {
+    Symbol *found = get_symbol(indices, string);
+    if (found != NULL) {
+        return found->address;
+    }
+    if (*no_strings == *strings_space) {
+        *strings_space *= 2;
+        *strings = (char **)realloc(*strings, *strings_space * sizeof(char *));
+    }
+    (*strings)[*no_strings] = (char *)malloc(strlen(string) + 1);
+    strcpy((*strings)[*no_strings], string);
+    add_symbol(indices, string, *no_strings);
+    (*no_strings)++;
+    return *no_strings - 1;
+}
+
+// Returns the next byte of the file, stopping with an error if there isn't one.
+unsigned char read_byte(ByteReader *reader) {
+    if (reader->pos >= reader->length) {
+        printf("Error: Unexpected end of .vmb file.");
+        exit(EXIT_FAILURE);
+    }
+    unsigned char byte = reader->bytes[reader->pos];
+    reader->pos++;
+    return byte;
+}
+
+// Returns the varint starting at the current position of the file.
+unsigned int read_varint(ByteReader *reader) {
+    unsigned int value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = read_byte(reader);
+        if (shift > 28) {
+            printf("Error: Malformed varint in .vmb file.");
+            exit(EXIT_FAILURE);
+        }
+        value |= (unsigned int)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
@@ -0,0 +1,26 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdio.h>
+#include "instruction.h"
+
+// A .vmb file holds the same program as a .vm file in a compact binary form which can be loaded without any lexing.
+// Numbers are stored as varints: seven bits at a time starting from the lowest, with the top bit of each byte set if
+// more bytes follow. The file consists of:
+//     * The four bytes "VMB1".
+//     * The string table: the number of strings as a varint, then each string as its length (a varint) followed by its
+//       characters, with no terminator. Every label and function name in the file is stored here exactly once.
+//     * The number of instructions as a varint, followed by the instructions themselves. Each instruction is a single
+//       opcode byte (the command's Keyword value from token.h, so push is 0 and return is 24) followed by its
+//       operands: push and pop have a segment byte (again a Keyword value) and a varint index; label, goto and if-goto
+//       have the varint string table index of the label; function and call have the string table index of the
+//       function name followed by a varint count of locals or arguments. All other commands have no operands.
+// The w11 Jack compiler writes the same format, so the two must be kept in step.
+
+// Writes list to output (which should be opened in binary mode) as a .vmb file. list must only contain real VM
+// instructions, i.e. nothing immediate and nothing using the optimiser's stack segment or drop command.
+void write_bytecode(const InstructionList *list, FILE *output);
+// Reads a .vmb file from input (which should be opened in binary mode) and returns a list of its instructions.
+InstructionList *read_bytecode(FILE *input);
+
+#endif
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "token.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+void hash_bytes(unsigned long long *hash, const void *data, size_t length);
+void hash_int(unsigned long long *hash, int value);
+void get_cache_path(const char *folder, unsigned long long hash, const char *extension, char *dest);
+
+unsigned long long hash_file(const char *filename, const InstructionList *list) {
+    unsigned long long hash = FNV_OFFSET;
+    hash_int(&hash, CACHE_FORMAT_VERSION);
+    hash_bytes(&hash, filename, strlen(filename)+1);
+    for (int i=0; i<list->list_length; i++) {
+        const Instruction *current = &(list->list_array[i]);
+        hash_int(&hash, current->command);
+        hash_int(&hash, current->segment);
+        hash_int(&hash, current->index);
+        hash_int(&hash, current->immediate ? current->constant : 0);
+        hash_int(&hash, current->immediate + 2*current->shared + 4*current->lean);
+        // Tell a NULL name apart from an empty one.
+        if (current->name == NULL) {
+            hash_int(&hash, -1);
+        } else {
+            hash_bytes(&hash, current->name, strlen(current->name)+1);
+        }
+    }
+    return hash;
+}
+
+char *read_cache(const char *folder, unsigned long long hash, const char *extension) {
+    char path[MAX_LINE_LENGTH + 40];
+    get_cache_path(folder, hash, extension, path);
+    FILE *input = fopen(path, "rb");
+    if (input == NULL) {
+        return NULL;
+    }
+    fseek(input, 0, SEEK_END);
+    long length = ftell(input);
+    fseek(input, 0, SEEK_SET);
+    char *code = (char *)malloc(length+1);
+    if (fread(code, 1, length, input) != (size_t)length) {
+        // Treat an unreadable entry as missing; it'll be written again.
+        free(code);
+        fclose(input);
+        return NULL;
+    }
+    code[length] = '\0';
+    fclose(input);
+    return code;
+}
+
+FILE *start_cache_entry(const char *folder, unsigned long long hash, const char *extension) {
+    char path[MAX_LINE_LENGTH + 40];
+    get_cache_path(folder, hash, extension, path);
+    strcat(path, ".tmp");
+    FILE *entry = fopen(path, "wb");
+    if (entry == NULL) {
+        printf("Error writing to cache folder %s.", folder);
+        exit(EXIT_FAILURE);
+    }
+    return entry;
+}
+
+void finish_cache_entry(FILE *entry, const char *folder, unsigned long long hash, const char *extension) {
+    char temp_path[MAX_LINE_LENGTH + 40];
+    char path[MAX_LINE_LENGTH + 40];
+    get_cache_path(folder, hash, extension, path);
+    strcpy(temp_path, path);
+    strcat(temp_path, ".tmp");
+    fclose(entry);
+    remove(path); // Windows won't rename over an existing file.
+    rename(temp_path, path);
+}
+
+// Mixes length bytes of data into hash.
+void hash_bytes(unsigned long long *hash, const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i=0; i<length; i++) {
+        *hash ^= bytes[i];
+        *hash *= FNV_PRIME;
+    }
+}
+
+// Mixes value into hash, always as four bytes, lowest first.
+void hash_int(unsigned long long *hash, int value) {
+    unsigned char bytes[4];
+    for (int i=0; i<4; i++) {
+        bytes[i] = ((unsigned int)value >> (8*i)) & 0xFF;
+    }
+    hash_bytes(hash, bytes, 4);
+}
+
+// Puts the path of the cache entry with the given hash in folder, ending in extension, into dest.
+void get_cache_path(const char *folder, unsigned long long hash, const char *extension, char *dest) {
+    sprintf(dest, "%.*s/%016llx%s", MAX_LINE_LENGTH, folder, hash, extension);
+}
@@ -0,0 +1,31 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include "instruction.h"
+
+// In folder mode the translator can keep the assembly code it generates for each file in a cache folder, so that
+// rebuilding a big program after changing one file only has to translate that file again. Each entry is a pair of
+// files: [hash].asm holding the code for one file, and [hash].txt holding what the optimiser reported while translating
+// it, where the hash (see hash_file) covers everything the code depends on. So an entry never needs invalidating: a
+// change to a file (or to what the whole-program optimisations decided about it) just gives it a new hash, and old
+// entries can be deleted at any time.
+
+// The version of the code the translator generates, which goes into every hash so that entries made by an older
+// translator never match. Bump it whenever a change means the same instructions would be translated differently.
+#define CACHE_FORMAT_VERSION 2
+
+// Returns a 64-bit FNV-1a hash of CACHE_FORMAT_VERSION, the file name and every field of every instruction in list.
+unsigned long long hash_file(const char *filename, const InstructionList *list);
+// Returns a newly-allocated string holding the contents of the cache file with the given hash and extension (".asm" or
+// ".txt") in folder, or NULL if there isn't one.
+char *read_cache(const char *folder, unsigned long long hash, const char *extension);
+// Opens a new cache file in folder with the given hash and extension for writing and returns it. The file is written
+// under a temporary name and only appears once finish_cache_entry renames it, so a translator which is interrupted (or
+// running at the same time) never sees half a file.
+FILE *start_cache_entry(const char *folder, unsigned long long hash, const char *extension);
+// Closes entry, which start_cache_entry opened with the given folder, hash and extension, and makes it available to
+// read_cache.
+void finish_cache_entry(FILE *entry, const char *folder, unsigned long long hash, const char *extension);
+
+#endif
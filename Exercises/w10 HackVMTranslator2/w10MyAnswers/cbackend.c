@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cbackend.h"
+
+// The first address used for static variables, as in the assembler.
+#define FIRST_STATIC 16
+
+void write_c_function(VMFile *file, const FunctionInfo *function, const int *statics, FILE *output);
+bool is_halt_loop(const InstructionList *list, int start, int jump);
+void write_c_instruction(const Instruction *instruction, const int *statics, FILE *output);
+void write_c_address(Keyword segment, int index, const int *statics, FILE *output);
+void write_c_name(const char *prefix, const char *name, FILE *output);
+
+// The start of every generated program: the memory, the hooks and the macros the generated code is written in.
+const char *CPrologue =
+    "#include <stdint.h>\n"
+    "#include <stdlib.h>\n"
+    "\n"
+    "int16_t ram[32768];\n"
+    "\n"
+    "#ifndef HACK_NO_DEFAULT_HOOKS\n"
+    "int16_t hack_read(int address) { return ram[address]; }\n"
+    "void hack_write(int address, int16_t value) { ram[address] = value; }\n"
+    "void hack_halt(void) { exit(EXIT_SUCCESS); }\n"
+    "#else\n"
+    "int16_t hack_read(int address);\n"
+    "void hack_write(int address, int16_t value);\n"
+    "void hack_halt(void);\n"
+    "#endif\n"
+    "\n"
+    "// Wraps x into a 16-bit word without relying on how the compiler converts out-of-range values.\n"
+    "static inline int16_t word(int x) { return (int16_t)(((x & 0xFFFF) ^ 0x8000) - 0x8000); }\n"
+    "// Reads and writes memory through this and that, which can reach the screen and keyboard.\n"
+    "static inline int16_t peek(int address) {\n"
+    "    address &= 0x7FFF;\n"
+    "    return (address >= 16384) ? hack_read(address) : ram[address];\n"
+    "}\n"
+    "static inline void poke(int address, int16_t value) {\n"
+    "    address &= 0x7FFF;\n"
+    "    if (address >= 16384) {\n"
+    "        hack_write(address, value);\n"
+    "    } else {\n"
+    "        ram[address] = value;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "#define SP ram[0]\n"
+    "#define LCL ram[1]\n"
+    "#define ARG ram[2]\n"
+    "#define THIS ram[3]\n"
+    "#define THAT ram[4]\n"
+    "#define PUSH(value) do { int16_t pushed = (value); ram[SP] = pushed; SP++; } while (0)\n"
+    "#define POP() (SP--, ram[SP])\n"
+    "#define TOP ram[SP-1]\n"
+    "#define BINARY(expression) do { int16_t y = POP(); int16_t x = TOP; TOP = (expression); } while (0)\n"
+    "#define CALL(function, args) do { PUSH(0); PUSH(LCL); PUSH(ARG); PUSH(THIS); PUSH(THAT); \\\n"
+    "                                  ARG = SP - (args) - 5; LCL = SP; function(); } while (0)\n"
+    "#define RETURN() do { int16_t frame = LCL; ram[ARG] = POP(); SP = ARG + 1; THAT = ram[frame-1]; \\\n"
+    "                      THIS = ram[frame-2]; ARG = ram[frame-3]; LCL = ram[frame-4]; return; } while (0)\n"
+    "\n";
+
+void write_c_program(VMFile *files, int no_files, FILE *output) {
+    FunctionTable *functions = find_functions(files, no_files);
+    if (get_function(functions, "Sys.init") == -1) {
+        printf("Error: No Sys.init function to start the C program from.");
+        exit(EXIT_FAILURE);
+    }
+
+    // Give every static variable an address, in the order they first appear.
+    int next_static = FIRST_STATIC;
+    int **statics = (int **)malloc((no_files + 1) * sizeof(int *));
+    for (int i=0; i<no_files; i++) {
+        InstructionList *list = files[i].instructions;
+        int max_index = -1;
+        for (int j=0; j<list->list_length; j++) {
+            Instruction *current = &(list->list_array[j]);
+            if ((current->command == PUSH || current->command == POP) && current->segment == STATIC &&
+                    current->index > max_index) {
+                max_index = current->index;
+            }
+        }
+        statics[i] = (int *)malloc((max_index + 2) * sizeof(int));
+        for (int j=0; j<=max_index; j++) {
+            statics[i][j] = -1;
+        }
+        for (int j=0; j<list->list_length; j++) {
+            Instruction *current = &(list->list_array[j]);
+            if ((current->command == PUSH || current->command == POP) && current->segment == STATIC &&
+                    statics[i][current->index] == -1) {
+                statics[i][current->index] = next_static;
+                next_static++;
+            }
+        }
+    }
+
+    // Every call has to go somewhere, and C needs to know about every function before it's called.
+    fputs("// Generated by the Hack VM translator.\n", output);
+    fputs(CPrologue, output);
+    for (int i=0; i<functions->table_length; i++) {
+        InstructionList *list = files[functions->table_array[i].file].instructions;
+        for (int j=functions->table_array[i].start; j<functions->table_array[i].end; j++) {
+            if (list->list_array[j].command == CALL && get_function(functions, list->list_array[j].name) == -1) {
+                printf("Error: Call to undefined function %s.", list->list_array[j].name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        fputs("static void ", output);
+        write_c_name("vm_", functions->table_array[i].name, output);
+        fputs("(void);\n", output);
+    }
+    fputs("\n", output);
+
+    for (int i=0; i<functions->table_length; i++) {
+        FunctionInfo *function = &(functions->table_array[i]);
+        write_c_function(&(files[function->file]), function, statics[function->file], output);
+    }
+
+    // As in the bootstrap code, start with an empty stack and call Sys.init.
+    fputs("int main(void) {\n"
+          "    SP = 256;\n"
+          "    CALL(vm_Sys_2Einit, 0);\n"
+          "    return EXIT_SUCCESS;\n"
+          "}\n", output);
+
+    for (int i=0; i<no_files; i++) {
+        free(statics[i]);
+    }
+    free(statics);
+    free_function_table(functions);
+}
+
+// Writes the C function for the given VM function in file to output.
+void write_c_function(VMFile *file, const FunctionInfo *function, const int *statics, FILE *output) {
+    InstructionList *list = file->instructions;
+    fprintf(output, "// function %s %d\n"
+                    "static void ", function->name, function->locals);
+    write_c_name("vm_", function->name, output);
+    fputs("(void) {\n", output);
+    if (function->locals > 0) {
+        fprintf(output, "    for (int i=0; i<%d; i++) {\n"
+                        "        PUSH(0);\n"
+                        "    }\n", function->locals);
+    }
+    for (int i=function->start+1; i<function->end; i++) {
+        Instruction *current = &(list->list_array[i]);
+        // Programs halt by looping forever (e.g. "label L, goto L", or what Jack compiles "while (true) {}" to), so
+        // give the host a chance to stop.
+        if (current->command == GOTO && is_halt_loop(list, function->start+1, i)) {
+            fputs("    hack_halt();\n", output);
+        }
+        write_c_instruction(current, statics, output);
+    }
+    fputs("}\n"
+          "\n", output);
+}
+
+// Returns true if the goto at list->list_array[jump] is the end of a loop which, once it gets that far, can only go
+// round forever. That's the case if it jumps back to a label no earlier than start, and everything in between only
+// pushes constants, works on them and if-gotos on the results: then each time round the loop does exactly the same.
+bool is_halt_loop(const InstructionList *list, int start, int jump) {
+    const char *name = list->list_array[jump].name;
+    int label = jump - 1;
+    while (label >= start && list->list_array[label].command != LABEL) {
+        label--;
+    }
+    if (label < start || strcmp(list->list_array[label].name, name) != 0) {
+        return false;
+    }
+
+    // Only values pushed since the label may be used, or the next time round could see different ones.
+    int depth = 0;
+    for (int i=label+1; i<jump; i++) {
+        const Instruction *current = &(list->list_array[i]);
+        switch (current->command) {
+            case PUSH:
+                if (current->segment != CONSTANT) {
+                    return false;
+                }
+                depth++;
+                break;
+            case NEG:
+            case NOT:
+                if (depth < 1) {
+                    return false;
+                }
+                break;
+            case ADD: case SUB: case AND: case OR: case EQ: case LT: case GT:
+                if (depth < 2) {
+                    return false;
+                }
+                depth--;
+                break;
+            case IFGOTO:
+                if (depth < 1) {
+                    return false;
+                }
+                depth--;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Writes a C statement doing the same as instruction to output.
+void write_c_instruction(const Instruction *instruction, const int *statics, FILE *output) {
+    switch (instruction->command) {
+        case PUSH:
+            if (instruction->segment == CONSTANT) {
+                fprintf(output, "    PUSH(%d);\n", instruction->index);
+            } else {
+                fputs("    PUSH(", output);
+                write_c_address(instruction->segment, instruction->index, statics, output);
+                fputs(");\n", output);
+            }
+            break;
+        case POP:
+            if (instruction->segment == KW_THIS || instruction->segment == THAT) {
+                fprintf(output, "    poke(%s + %d, POP());\n", (instruction->segment == KW_THIS) ? "THIS" : "THAT",
+                        instruction->index);
+            } else {
+                fputs("    ", output);
+                write_c_address(instruction->segment, instruction->index, statics, output);
+                fputs(" = POP();\n", output);
+            }
+            break;
+        case ADD: fputs("    BINARY(word(x + y));\n", output); break;
+        case SUB: fputs("    BINARY(word(x - y));\n", output); break;
+        case AND: fputs("    BINARY(x & y);\n", output); break;
+        case OR:  fputs("    BINARY(x | y);\n", output); break;
+        case EQ:  fputs("    BINARY((x == y) ? -1 : 0);\n", output); break;
+        case LT:  fputs("    BINARY((x < y) ? -1 : 0);\n", output); break;
+        case GT:  fputs("    BINARY((x > y) ? -1 : 0);\n", output); break;
+        case NEG: fputs("    TOP = word(-TOP);\n", output); break;
+        case NOT: fputs("    TOP = ~TOP;\n", output); break;
+        case LABEL:
+            write_c_name("L_", instruction->name, output);
+            fputs(":;\n", output);
+            break;
+        case GOTO:
+            fputs("    goto ", output);
+            write_c_name("L_", instruction->name, output);
+            fputs(";\n", output);
+            break;
+        case IFGOTO:
+            fputs("    if (POP() != 0) goto ", output);
+            write_c_name("L_", instruction->name, output);
+            fputs(";\n", output);
+            break;
+        case CALL:
+            fputs("    CALL(", output);
+            write_c_name("vm_", instruction->name, output);
+            fprintf(output, ", %d);\n", instruction->index);
+            break;
+        case RETURN:
+            fputs("    RETURN();\n", output);
+            break;
+        default:
+            printf("Malformed instruction!");
+            exit(EXIT_FAILURE);
+    }
+}
+
+// Writes a C expression for the memory word [segment] [index] to output. This is an lvalue except for this and that.
+void write_c_address(Keyword segment, int index, const int *statics, FILE *output) {
+    switch (segment) {
+        case LOCAL:    fprintf(output, "ram[LCL + %d]", index); break;
+        case ARGUMENT: fprintf(output, "ram[ARG + %d]", index); break;
+        case KW_THIS:  fprintf(output, "peek(THIS + %d)", index); break;
+        case THAT:     fprintf(output, "peek(THAT + %d)", index); break;
+        case POINTER:  fprintf(output, "ram[%d]", 3 + index); break;
+        case TEMP:     fprintf(output, "ram[%d]", 5 + index); break;
+        case STATIC:   fprintf(output, "ram[%d]", statics[index]); break;
+        default:
+            printf("Malformed instruction!");
+            exit(EXIT_FAILURE);
+    }
+}
+
+// Writes prefix followed by name to output as a C identifier. Letters and digits are kept, and every other character
+// becomes _ followed by its code in hex (so _ itself becomes _5F), which keeps different names different.
+void write_c_name(const char *prefix, const char *name, FILE *output) {
+    fputs(prefix, output);
+    for (int i=0; name[i] != '\0'; i++) {
+        if (isalnum((unsigned char)name[i])) {
+            fputc(name[i], output);
+        } else {
+            fprintf(output, "_%02X", (unsigned char)name[i]);
+        }
+    }
+}
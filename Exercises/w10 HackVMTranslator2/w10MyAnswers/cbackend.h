@@ -0,0 +1,17 @@
+#ifndef CBACKEND_H
+#define CBACKEND_H
+
+#include <stdio.h>
+#include "program.h"
+
+// Writes the program in files to output as a portable C program which runs it natively. Each VM function becomes a C
+// function, VM labels become gotos, and everything else works on a 32K-word array ram exactly as the Hack computer
+// would, using the usual stack frames and putting static variables from address 16 up. So programs which poke around
+// in memory via pointer, this and that behave just as they would on the real machine. Reads and writes to the screen
+// and keyboard (addresses 16384 and up) through this and that go through the hooks hack_read and hack_write, and a loop
+// which can never end (like "label L, goto L" or Jack's "while (true) {}") calls hack_halt. The generated file has
+// default versions of the hooks which just use ram and exit; compile with -DHACK_NO_DEFAULT_HOOKS to supply your own.
+// Every function called has to be in files.
+void write_c_program(VMFile *files, int no_files, FILE *output);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "instruction.h"
+
+void write_constant(int value, FILE *output);
+
+InstructionList *malloc_instruction_list() {
+    const int initial_space = 16;
+
+    InstructionList *list = (InstructionList *)malloc(sizeof(InstructionList));
+    list->list_length = 0;
+    list->list_space = initial_space;
+    list->list_array = (Instruction *)malloc(initial_space * sizeof(Instruction));
+    return list;
+}
+
+void free_instruction_list(InstructionList *list) {
+    for (int i=0; i<list->list_length; i++) {
+        free(list->list_array[i].name);
+    }
+    free(list->list_array);
+    free(list);
+}
+
+void add_instruction(InstructionList *list, Keyword command, Keyword segment, int index, const char *name) {
+    // If our list_array array is full, allocate more memory.
+    if (list->list_length == list->list_space) {
+        Instruction *new_array = (Instruction *)malloc(2 * list->list_space * sizeof(Instruction));
+        for (int i=0; i<list->list_length; i++) {
+            new_array[i] = list->list_array[i];
+        }
+        free(list->list_array);
+        list->list_array = new_array;
+        list->list_space *= 2;
+    }
+
+    Instruction *new = &(list->list_array[list->list_length]);
+    new->command = command;
+    new->segment = segment;
+    new->index = index;
+    new->immediate = false;
+    new->constant = 0;
+    new->shared = false;
+    new->lean = false;
+    if (name == NULL) {
+        new->name = NULL;
+    } else {
+        new->name = malloc(strlen(name)+1);
+        strcpy(new->name, name);
+    }
+    list->list_length++;
+}
+
+void copy_instruction(InstructionList *list, const Instruction *instruction) {
+    add_instruction(list, instruction->command, instruction->segment, instruction->index, instruction->name);
+    list->list_array[list->list_length-1].immediate = instruction->immediate;
+    list->list_array[list->list_length-1].constant = instruction->constant;
+    list->list_array[list->list_length-1].shared = instruction->shared;
+    list->list_array[list->list_length-1].lean = instruction->lean;
+}
+
+void remove_last_instruction(InstructionList *list) {
+    list->list_length--;
+    free(list->list_array[list->list_length].name);
+}
+
+void write_instruction(const Instruction *instruction, FILE *output) {
+    char line[MAX_LINE_LENGTH+100];
+
+    if (instruction->immediate) {
+        write_constant(instruction->constant, output);
+    }
+
+    switch (instruction->command) {
+        case PUSH:
+            if (instruction->segment == CONSTANT) {
+                write_constant(instruction->index, output);
+                return;
+            }
+            // Fall through - any other push is written the same way as a pop.
+        case POP:
+            sprintf(line, "%s %s %d\n", KeywordToString[instruction->command], KeywordToString[instruction->segment],
+                    instruction->index);
+            break;
+        case IFGOTO:
+            if (instruction->segment != CONSTANT) {
+                // A fused comparison and branch, see instruction.h.
+                fputs(KeywordToString[instruction->segment], output);
+                fputs((instruction->index == 1) ? "\nnot\n" : "\n", output);
+            }
+            // Fall through - the if-goto itself is written like a label or goto.
+        case LABEL:
+        case GOTO:
+            sprintf(line, "%s %s\n", KeywordToString[instruction->command], instruction->name);
+            break;
+        case FUNCTION:
+        case CALL:
+            sprintf(line, "%s %s %d\n", KeywordToString[instruction->command], instruction->name,
+                    instruction->index);
+            if (instruction->segment == RETURN) {
+                strcat(line, "return\n"); // A tail call, see instruction.h.
+            }
+            break;
+        case DROP:
+            sprintf(line, "%s %d\n", KeywordToString[instruction->command], instruction->index);
+            break;
+        default:
+            sprintf(line, "%s\n", KeywordToString[instruction->command]);
+    }
+    fputs(line, output);
+}
+
+// Writes VM code which pushes the given value onto the stack. VM code only has non-negative constants, so the
+// optimiser's negative constants need a neg after them (and -32768 has no positive counterpart at all).
+void write_constant(int value, FILE *output) {
+    char line[MAX_LINE_LENGTH];
+    if (value >= 0) {
+        sprintf(line, "push constant %d\n", value);
+    } else if (value > -32768) {
+        sprintf(line, "push constant %d\n"
+                      "neg\n", -value);
+    } else {
+        sprintf(line, "push constant 32767\n"
+                      "neg\n"
+                      "push constant 1\n"
+                      "sub\n");
+    }
+    fputs(line, output);
+}
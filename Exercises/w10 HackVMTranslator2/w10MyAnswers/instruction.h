@@ -0,0 +1,80 @@
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "token.h"
+
+// Each Instruction is one fully-parsed line of VM code. command is the first keyword on the line. For push and pop,
+// segment and index hold the memory segment and offset (so "push constant 7" has segment CONSTANT and index 7). For
+// function and call, name holds the function name and index holds the number of locals or arguments respectively. For
+// label, goto and if-goto, name holds the label. Fields which the command doesn't use are ignored.
+//
+// For push and pop of static variables, name is normally NULL and the variable belongs to the file the instruction is
+// in. The inliner sets name to the name of the function's original file when it copies a function's code into
+// another file.
+//
+// The optimiser also uses two things which don't exist in VM code. The stack segment refers to the stack itself
+// relative to the stack pointer at the start of the instruction: "push stack 0" duplicates the value on top of the
+// stack, and "pop stack 1" pops the top value and overwrites the value underneath it. The drop command discards the top
+// index values on the stack. The temp segment can also have an index past 7, since temp i is always RAM address 5+i;
+// the optimiser uses this to reach the fixed addresses of static frames.
+//
+// The optimiser can also mark a pop or a binary arithmetic/logic command as immediate. An immediate instruction takes
+// its (second) operand from the constant field rather than from the stack, e.g. "add" with immediate set and constant
+// 3 means "add 3 to the value on top of the stack". Immediate instructions don't exist in VM code; they're what the
+// optimiser turns e.g. "push constant 3, add" into so that we can output cheaper assembly code.
+//
+// Finally, the optimiser can fuse a comparison into the if-goto after it. In that case the if-goto's segment is EQ, GT
+// or LT rather than CONSTANT, and it jumps if that comparison of the top two values on the stack is true (or false, if
+// index is 1), popping both. Such an if-goto can also be immediate, in which case it compares the top value with
+// constant instead, e.g. "lt, not, if-goto L" becomes an if-goto with segment LT and index 1.
+//
+// Similarly, a call with segment RETURN is a tail call: "call f n, return" fused into a single instruction which reuses
+// the current function's frame for f rather than building a new one.
+//
+// If shared is set on a call, return or comparison, it is translated as a jump to a routine shared by the whole program
+// rather than the usual inline sequence, which makes it much smaller but a little slower. The optimiser only does this
+// when it has a profile saying the code is rarely run, or when the program wouldn't otherwise fit in ROM. (A return
+// which is also lean, see below, ignores shared.)
+//
+// If lean is set on a call, the function called never changes THIS or THAT (and nor does anything it calls), so the
+// call leaves the THIS and THAT slots of the new frame unfilled and the function's returns, which also have lean set,
+// don't restore them. Lean returns also leave the return value in D, so the code after a lean call can use it without
+// reading it back off the stack. The frame keeps its usual size and arguments are still passed on the stack, so
+// everything else about it stays the same.
+struct Instruction {
+    Keyword command;
+    Keyword segment;
+    int index;
+    char *name;
+    bool immediate;
+    int constant;
+    bool shared;
+    bool lean;
+}; typedef struct Instruction Instruction;
+
+// An InstructionList is a growable array of Instructions stored in list_array, with the number of instructions stored
+// in list_length. The list_space variable is only used internally and tracks the memory allocated to list_array.
+struct InstructionList {
+    Instruction *list_array;
+    int list_length;
+    int list_space;
+}; typedef struct InstructionList InstructionList;
+
+// Creates and returns a new empty instruction list.
+InstructionList *malloc_instruction_list();
+// Frees every instruction in list, then list itself.
+void free_instruction_list(InstructionList *list);
+// Adds a new non-immediate, non-shared, non-lean instruction to the end of list. Note that name will be copied, and may
+// be NULL.
+void add_instruction(InstructionList *list, Keyword command, Keyword segment, int index, const char *name);
+// Adds a copy of an existing instruction (including its name) to the end of list.
+void copy_instruction(InstructionList *list, const Instruction *instruction);
+// Removes the last instruction from list and frees its name.
+void remove_last_instruction(InstructionList *list);
+// Writes an instruction to output as a line of VM code. Immediate instructions are written as a push constant followed
+// by the instruction itself, so the output is always valid VM code.
+void write_instruction(const Instruction *instruction, FILE *output);
+
+#endif
@@ -2,7 +2,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include "token.h"
+#include "instruction.h"
+#include "program.h"
+#include "optimiser.h"
+#include "output.h"
+#include "bytecode.h"
+#include "profile.h"
+#include "templates.h"
+#include "cbackend.h"
+#include "cache.h"
 
 // C commands for folder handling are different between Windows and Linux.
 // *In theory* the Linux version will also work for Macs, but I can't promise anything
@@ -16,24 +26,93 @@
 #define MAX_PATH 2500
 #endif
 
-void compile_folder(char *input_path, FILE *output);
-void compile_file(char *input_path, FILE *output, bool standalone);
+// Offsets into local, argument, this and that up to this size are reached by incrementing A rather than adding via D.
+#define MAX_CHAIN_OFFSET 3
+
+// The number of words in the Hack computer's ROM, and so the default ROM budget.
+#define ROM_SIZE 32768
+
+// The generated code doesn't keep SP in RAM up to date after every push and pop. Within straight-line code we instead
+// track sp_lag, the number of values pushed (or minus the number popped) since SP was last written, so that the real
+// stack pointer is RAM[SP] + sp_lag, and address the stack relative to RAM[SP] accordingly. SP is only written back by
+// sync_stack_pointer: at labels, jumps, calls and returns, at the end of each file, and whenever sp_lag gets further
+// than MAX_SP_LAG from zero (past which addressing the stack costs more than keeping SP up to date would).
+#define MAX_SP_LAG 2
+static int sp_lag = 0;
+
+// A lean return (see instruction.h) leaves the value it returns in D as well as on top of the stack. value_in_d is true
+// while translating the instruction straight after a lean call, so that a pop or if-goto there can use D rather than
+// loading the value again. Control can only reach that instruction from the call, since a label would come between.
+static bool value_in_d = false;
+
+// Labels made up by the translator are numbered from 0 within each function (or within a file, for code outside any
+// function), so the code for a file never depends on what was translated before it. label_scope names the current
+// function or file, and label_count is the number of labels made up in it so far. The file and function names in the
+// scope are cut off at MAX_SCOPE_NAME characters so that labels fit in MAX_LINE_LENGTH.
+#define MAX_SCOPE_NAME 100
+static char label_scope[2*MAX_SCOPE_NAME+2] = "";
+static int label_count = 0;
+
+// Optional settings given on the command line after the input and output names. profile_name is the name of a profile
+// file (see profile.h) to guide optimisation in folder mode, or NULL if there isn't one. If lean_frames is true, calls
+// to functions which never change THIS or THAT don't save them, and get the value returned in D (see instruction.h).
+// This changes the calling convention, so it only applies in folder mode where we can see every function. rom_budget is
+// the most words of ROM the translated program may use in folder mode (see fit_rom_budget). If bootstrap is true, a
+// single file or stream gets the bootstrap code calling Sys.init at the start, as a folder always does. cache_folder is
+// the folder to cache each file's assembly code in (see cache.h) in folder mode, or NULL not to. If static_frames is
+// true, functions which can't be running twice at once keep their locals (and busy arguments) at fixed addresses in
+// folder mode (see allocate_static_frames in optimiser.h).
+struct Options {
+    char *profile_name;
+    bool lean_frames;
+    bool static_frames;
+    int rom_budget;
+    bool bootstrap;
+    char *cache_folder;
+}; typedef struct Options Options;
+
+void read_options(int argc, char *argv[], Options *options);
+void compile_folder(char *input_path, Output *output, const Options *options);
+VMFile *read_folder(char *input_path, int *no_files);
+void compile_to_c(char *input_path, FILE *output);
+int fit_rom_budget(VMFile *files, int no_files, const Options *options, const Profile *profile, char ***demoted);
+int measure_program(VMFile *files, int no_files, const Options *options, const Profile *profile, char **demoted,
+                    int no_demoted, VMFile **trial);
+void translate_program(VMFile *files, int no_files, const Options *options, const Profile *profile, char **demoted,
+                       int no_demoted, Output *output, FILE *report);
+VMFile *copy_files(const VMFile *files, int no_files);
+void free_files(VMFile *files, int no_files);
+void compile_file(char *input_path, Output *output, const Options *options);
+void compile_stream(FILE *input, Output *output, const Options *options);
+InstructionList *read_vm_file(char *input_path);
+bool read_next_instruction(FILE *input, InstructionList *list);
+void convert_file(char *input_path, char *output_path);
+void report_inlining(InlineReport *reports, int no_reports);
 
 // System functions
 bool is_folder(const char *path);
+bool has_extension(const char *path, const char *extension);
 int list_vm_files(const char *path, char ***list);
 
 // Lexing functions
-void lex_file(FILE *input, FILE *output);
-void lex_line(const char *line, FILE *output);
+int lex_line(const char *line, Token *dest[]);
 int lex_token(Token *dest, const char *line);
 
 // Parsing functions
-void parse_file(char *filename, FILE *input, FILE *output, bool standalone);
-int get_next_instruction(Token *dest[], FILE *input);
-void parse_instruction(Token *instruction[], char *filename, FILE *output);
-void parse_push(char *filename, Token *segment, Token *address, char *dest);
-void parse_pop(char *filename, Token *segment, Token *address, char *dest);
+void parse_file(char *filename, InstructionList *instructions, Output *output, bool standalone, FILE *report);
+bool parse_file_cached(char *filename, InstructionList *instructions, Output *output, const char *cache_folder,
+                       FILE *report);
+void read_instruction(Token *tokens[], int length, InstructionList *list);
+void parse_instruction(Instruction *instruction, char *filename, Output *output);
+void translate_instruction(Instruction *instruction, char *filename, char *dest);
+int parse_template(const InstructionList *list, int start, char *dest);
+int count_hack_instructions(const char *code);
+int estimate_size(InstructionList *list, char *filename);
+int estimate_range_size(InstructionList *list, int start, int end, char *filename);
+int estimate_cycles(InstructionList *list, char *filename);
+void parse_push(char *filename, Keyword segment, int address, char *dest);
+void parse_pop(char *filename, Keyword segment, int address, char *dest);
+void parse_pop_immediate(char *filename, Instruction *instruction, char *dest);
 void parse_add(char *dest);
 void parse_sub(char *dest);
 void parse_neg(char *dest);
@@ -43,126 +122,643 @@ void parse_not(char *dest);
 void parse_eq(char *filename, char *dest);
 void parse_lt(char *filename, char *dest);
 void parse_gt(char *filename, char *dest);
-void parse_label(char *filename, Token *label, char *dest);
-void parse_goto(char *filename, Token *label, char *dest);
-void parse_ifgoto(char *filename, Token *label, char *dest);
-void parse_call(char *filename, Token *name, Token *args, char *dest);
-void parse_function(char *filename, Token *name, Token *local_vars, char *dest);
-void parse_return(char *dest);
-void parse_load_data(char *filename, Token *segment, Token *address, char *dest);
+void compare_top_two(char *filename, char *dest);
+void parse_immediate(char *filename, Instruction *instruction, char *dest);
+void parse_label(char *filename, char *label, char *dest);
+void parse_goto(char *filename, char *label, char *dest);
+void parse_ifgoto(char *filename, char *label, char *dest);
+void parse_compare_and_branch(char *filename, Instruction *instruction, char *dest);
+void parse_call(char *filename, char *name, int args, bool lean, char *dest);
+void parse_shared_call(char *filename, char *name, int args, char *dest);
+void parse_shared_compare(char *filename, Keyword command, char *dest);
+void parse_shared_routines(char *dest);
+void parse_bootstrap(char *dest);
+void parse_tail_call(char *filename, char *name, int args, char *dest);
+void parse_function(char *filename, char *name, int local_vars, char *dest);
+void parse_return(bool lean, char *dest);
+void parse_drop(int count, char *dest);
+void load_stack_address(int offset, char *dest);
+void sync_stack_pointer(char *dest);
+void parse_load_data(char *filename, Keyword segment, int address, char *dest);
+bool loads_without_d(Keyword segment, int address);
+void load_constant(int value, char *dest);
+void subtract_constant(int value, char *dest);
+void subtract_for_compare(char *filename, int value, char *dest);
+void set_label_scope(char *filename, char *function_name);
 void get_next_label_name(char *filename, char *dest);
 void get_function_label(char *function_name, char *dest);
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Please supply two arguments: an input .vm file or folder, and an output .asm file.\n");
+    if (argc < 3) {
+        printf("Please supply two arguments: an input .vm/.vmb file or folder, and an output .asm or .hack file (or a "
+               ".vm/.vmb file to convert between the two formats, or a .c file to get a C program). Give - as the input "
+               "to read VM code from stdin, or as the output to write assembly code to stdout. These can be followed "
+               "by:\n"
+               "    --profile [file]    Use the given profile of a previous run to guide optimisation.\n"
+               "    --lean-frames       Don't save THIS and THAT when calling functions which leave them alone, and have\n"
+               "                        those functions return their value in D as well as on the stack.\n"
+               "    --static-frames     Keep the locals of functions which can't recurse at fixed addresses.\n"
+               "    --rom-budget [n]    Make functions smaller if need be so the program fits in n words of ROM (default "
+               "%d).\n"
+               "    --bootstrap         Start with code calling Sys.init even when translating a single file or stdin.\n"
+               "    --cache [folder]    Keep each file's assembly code in the given folder, and reuse it if the file "
+               "hasn't changed.\n",
+               ROM_SIZE);
         exit(EXIT_FAILURE);
     }
 
     char *input_name = argv[1];
     char *output_name = argv[2];
+    Options options;
+    read_options(argc, argv, &options);
 
-    FILE *output = fopen(output_name, "w");
-    if (output == NULL) {
+    if (has_extension(output_name, ".vm") || has_extension(output_name, ".vmb")) {
+        if (is_folder(input_name)) {
+            printf("Please convert .vm and .vmb files one at a time.\n");
+            exit(EXIT_FAILURE);
+        }
+        convert_file(input_name, output_name);
+        return EXIT_SUCCESS;
+    }
+
+    // With - as the output, write assembly code to stdout, so the translator can sit in a pipeline.
+    bool to_stdout = (strcmp(output_name, "-") == 0);
+    FILE *output_file = to_stdout ? stdout : fopen(output_name, "w");
+    if (output_file == NULL) {
         exit(EXIT_FAILURE);
     }
 
-    if (is_folder(input_name)) {
-        compile_folder(input_name, output);
+    if (has_extension(output_name, ".c")) {
+        compile_to_c(input_name, output_file);
+        fclose(output_file);
+        return EXIT_SUCCESS;
+    }
+
+    // If we've been asked for a .hack file, assemble the code ourselves rather than writing it out as text.
+    Output *output = malloc_output(output_file, has_extension(output_name, ".hack"));
+
+    if (strcmp(input_name, "-") == 0) {
+        compile_stream(stdin, output, &options);
+    } else if (is_folder(input_name)) {
+        compile_folder(input_name, output, &options);
     } else {
-        compile_file(input_name, output, true);
+        compile_file(input_name, output, &options);
     }
 
-    fclose(output);
+    close_output(output);
+    if (!to_stdout) {
+        fclose(output_file);
+    }
 
     return EXIT_SUCCESS;
 }
 
-void compile_file(char *input_path, FILE *output, bool standalone) {
-    FILE *lex_output = fopen("temp.lex", "w");
-    if (lex_output == NULL) {
-        printf("Error opening .lex output file.");
+// Reads the options after the input and output names on the command line into options.
+void read_options(int argc, char *argv[], Options *options) {
+    options->profile_name = NULL;
+    options->lean_frames = false;
+    options->static_frames = false;
+    options->rom_budget = ROM_SIZE;
+    options->bootstrap = false;
+    options->cache_folder = NULL;
+    for (int i=3; i<argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0 && i+1 < argc) {
+            options->profile_name = argv[i+1];
+            i++;
+        } else if (strcmp(argv[i], "--lean-frames") == 0) {
+            options->lean_frames = true;
+        } else if (strcmp(argv[i], "--static-frames") == 0) {
+            options->static_frames = true;
+        } else if (strcmp(argv[i], "--rom-budget") == 0 && i+1 < argc) {
+            options->rom_budget = strtol(argv[i+1], NULL, 10);
+            i++;
+        } else if (strcmp(argv[i], "--bootstrap") == 0) {
+            options->bootstrap = true;
+        } else if (strcmp(argv[i], "--cache") == 0 && i+1 < argc) {
+            options->cache_folder = argv[i+1];
+            i++;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void compile_file(char *input_path, Output *output, const Options *options) {
+    InstructionList *instructions = read_vm_file(input_path);
+    if (options->bootstrap) {
+        char code[400] = "";
+        parse_bootstrap(code);
+        output_code(output, code);
+    }
+    parse_file(input_path, instructions, output, true, stdout);
+    free_instruction_list(instructions);
+}
+
+// Translates VM code from input as it arrives, one function at a time, so only the function being read is ever held in
+// memory and each function's code reaches output before the next one is read. Since the input can hold a whole program
+// (e.g. every class from the Jack compiler one after another), static variables and labels belong to the class named
+// before the dot in the function they're in, as they would if each class were translated from its own file.
+void compile_stream(FILE *input, Output *output, const Options *options) {
+    if (options->bootstrap) {
+        char code[400] = "";
+        parse_bootstrap(code);
+        output_code(output, code);
+    }
+
+    InstructionList *function = malloc_instruction_list();
+    char class_name[MAX_LINE_LENGTH] = "Stdin"; // For any code before the first function.
+    bool more = true;
+    while (more) {
+        more = read_next_instruction(input, function);
+        if (more && (function->list_array[function->list_length-1].command != FUNCTION ||
+                     function->list_length == 1)) {
+            continue;
+        }
+
+        // We've got a whole function (plus the start of the next one, unless we're at the end), so translate it.
+        InstructionList *next = malloc_instruction_list();
+        if (more) {
+            copy_instruction(next, &(function->list_array[function->list_length-1]));
+            remove_last_instruction(function);
+        }
+        if (function->list_length > 0 && function->list_array[0].command == FUNCTION) {
+            int length = strcspn(function->list_array[0].name, ".");
+            strncpy(class_name, function->list_array[0].name, length);
+            class_name[length] = '\0'; // Strncpy doesn't null-terminate.
+        }
+        parse_file(class_name, function, output, false, NULL);
+        if (output->file != NULL) {
+            fflush(output->file);
+        }
+        free_instruction_list(function);
+        function = next;
+    }
+    free_instruction_list(function);
+}
+
+// Converts the .vm or .vmb file at input_path to a .vm or .vmb file at output_path (depending on its extension) without
+// optimising it, so this can go either way.
+void convert_file(char *input_path, char *output_path) {
+    InstructionList *instructions = read_vm_file(input_path);
+
+    bool binary = has_extension(output_path, ".vmb");
+    FILE *output = fopen(output_path, binary ? "wb" : "w");
+    if (output == NULL) {
+        printf("Error opening output file %s.", output_path);
         exit(EXIT_FAILURE);
     }
+    if (binary) {
+        write_bytecode(instructions, output);
+    } else {
+        for (int i=0; i<instructions->list_length; i++) {
+            write_instruction(&(instructions->list_array[i]), output);
+        }
+    }
+    fclose(output);
+    free_instruction_list(instructions);
+}
+
+// Returns a list of the instructions in the VM file at input_path. .vmb files are read directly (see bytecode.h), and
+// anything else is lexed a line at a time.
+InstructionList *read_vm_file(char *input_path) {
+    if (has_extension(input_path, ".vmb")) {
+        FILE *input = fopen(input_path, "rb");
+        if (input == NULL) {
+            printf("Error opening input file %s.", input_path);
+            exit(EXIT_FAILURE);
+        }
+        InstructionList *instructions = read_bytecode(input);
+        fclose(input);
+        return instructions;
+    }
 
     FILE *input = fopen(input_path, "r");
     if (input == NULL) {
-        printf("Error opening input file %s in single-file mode.", input_path);
+        printf("Error opening input file %s.", input_path);
         exit(EXIT_FAILURE);
     }
+    InstructionList *instructions = malloc_instruction_list();
+    while (read_next_instruction(input, instructions)) {
+    }
+    fclose(input);
+    return instructions;
+}
 
-    lex_file(input, lex_output);
+// Reads lines from input up to the next VM instruction, skipping blank lines and comments, and adds that instruction to
+// the end of list. Returns false if input ran out first.
+bool read_next_instruction(FILE *input, InstructionList *list) {
+    char line[MAX_LINE_LENGTH];
+    Token *tokens[MAX_LINE_LENGTH];
+    while (fgets(line, MAX_LINE_LENGTH, input) != NULL) {
+        int length = lex_line(line, tokens);
+        if (length == 0) {
+            continue;
+        }
+        read_instruction(tokens, length, list);
+        for (int i=0; i<length; i++) {
+            free_token(tokens[i]);
+        }
+        return true;
+    }
+    return false;
+}
 
-    fclose(input);
-    fclose(lex_output);
+void compile_folder(char *input_path, Output *output, const Options *options) {
+    // Read every file into memory first, so that the optimiser can see the whole program at once.
+    int no_files;
+    VMFile *files = read_folder(input_path, &no_files);
 
-    FILE *lex_input = fopen("temp.lex", "r");
-    if (lex_input == NULL) {
-        printf("Error reopening .lex file for input.");
-        exit(EXIT_FAILURE);
+    Profile *profile = NULL;
+    if (options->profile_name != NULL) {
+        FILE *profile_file = fopen(options->profile_name, "r");
+        if (profile_file == NULL) {
+            printf("Error opening profile %s.", options->profile_name);
+            exit(EXIT_FAILURE);
+        }
+        profile = read_profile(profile_file);
+        fclose(profile_file);
     }
 
-    parse_file(input_path, lex_input, output, standalone);
-    fclose(lex_input);
+    char **demoted;
+    int no_demoted = fit_rom_budget(files, no_files, options, profile, &demoted);
+    translate_program(files, no_files, options, profile, demoted, no_demoted, output, stdout);
+
+    for (int i=0; i<no_demoted; i++) {
+        free(demoted[i]);
+    }
+    free(demoted);
+    if (profile != NULL) {
+        free_profile(profile);
+    }
+    free_files(files, no_files);
 }
 
-void compile_folder(char *input_path, FILE *output) {
+// Reads every .vm and .vmb file in the folder at input_path, sets *no_files to how many there are and returns them.
+VMFile *read_folder(char *input_path, int *no_files) {
     char **list;
-    int no_files = list_vm_files(input_path, &list);
+    *no_files = list_vm_files(input_path, &list);
 
-    // Send assembly code to initialise SP to 256 and call Sys.init to output
-    char code[400];
-    char init_label[200];
-    get_function_label("Sys.init", init_label);
-    sprintf(code, "@261\n"
-                  "D=A\n"
-                  "@LCL\n" // We set LCL rather than the stack pointer since the
-                  "M=D\n"  // function code will initialise SP to LCL.
-                  "@%s\n"
-                  "0;JMP", init_label);
-    fputs(code, output);
+    VMFile *files = (VMFile *)malloc(*no_files * sizeof(VMFile));
+    for (int i=0; i<*no_files; i++) {
+        int slash_pos = 0;
+        while(list[i][slash_pos] != '\\' && list[i][slash_pos] != '/') {
+            slash_pos++;
+        }
+        slash_pos++;
+        files[i].filename = (char *)malloc(strlen(list[i]+slash_pos)+1);
+        strcpy(files[i].filename, list[i]+slash_pos);
+        files[i].instructions = read_vm_file(list[i]);
+        free(list[i]);
+    }
+    free(list);
+    return files;
+}
 
-    for (int i=0; i<no_files; i++) {
-        FILE *lex_output = fopen("temp.lex", "w");
-        if (lex_output == NULL) {
-            printf("Error opening .lex output file.");
+// Translates the program in the .vm/.vmb file or folder at input_path into a C program (see cbackend.h) and writes it
+// to output. Apart from dropping unreachable functions, the code isn't optimised first, since the C compiler will do a
+// better job of that than we can.
+void compile_to_c(char *input_path, FILE *output) {
+    int no_files;
+    VMFile *files;
+    if (is_folder(input_path)) {
+        files = read_folder(input_path, &no_files);
+    } else {
+        no_files = 1;
+        files = (VMFile *)malloc(sizeof(VMFile));
+        files[0].filename = (char *)malloc(strlen(input_path)+1);
+        strcpy(files[0].filename, input_path);
+        files[0].instructions = read_vm_file(input_path);
+    }
+    int instructions_removed;
+    remove_unreachable_functions(files, no_files, &instructions_removed);
+    write_c_program(files, no_files, output);
+    free_files(files, no_files);
+}
+
+// Works out which functions need size-optimised code (see share_functions in optimiser.h) for the program in files to
+// fit in options->rom_budget words, by translating it in memory and then, while it's still too big, trying
+// size-optimised code for the coldest function not tried yet (according to profile, if there is one), largest first
+// among equally cold ones. Size-optimised code isn't always smaller (the shared routines cost words of their own, and a
+// shared call can be bigger than a lean one), so a function only stays demoted if that made the program smaller. Sets
+// *demoted to a newly-allocated array of the names of the functions demoted, prints them, and returns how many there
+// are. files itself is left alone.
+int fit_rom_budget(VMFile *files, int no_files, const Options *options, const Profile *profile, char ***demoted) {
+    FunctionTable *functions = find_functions(files, no_files);
+    char **names = (char **)malloc((functions->table_length + 1) * sizeof(char *));
+    int no_names = 0;
+    char **tried = (char **)malloc((functions->table_length + 1) * sizeof(char *));
+    int no_tried = 0;
+    free_function_table(functions);
+
+    // Trial translations shouldn't fill the cache with code we're going to throw away.
+    Options trial_options = *options;
+    trial_options.cache_folder = NULL;
+
+    VMFile *trial;
+    int size = measure_program(files, no_files, &trial_options, profile, names, no_names, &trial);
+    int original_size = size;
+    while (size > options->rom_budget) {
+        // Look through the translated functions for the best one to try next.
+        FunctionTable *trial_functions = find_functions(trial, no_files);
+        int best = -1;
+        long best_count = 0;
+        int best_size = 0;
+        for (int i=0; i<trial_functions->table_length; i++) {
+            FunctionInfo *function = &(trial_functions->table_array[i]);
+            bool already_tried = false;
+            for (int j=0; j<no_tried; j++) {
+                if (strcmp(tried[j], function->name) == 0) {
+                    already_tried = true;
+                }
+            }
+            if (already_tried) {
+                continue;
+            }
+            char label[MAX_LINE_LENGTH+10];
+            get_function_label(function->name, label);
+            long count = (profile == NULL) ? 0 : get_profile_count(profile, label);
+            int function_size = estimate_range_size(trial[function->file].instructions, function->start, function->end,
+                                                    trial[function->file].filename);
+            if (best == -1 || count < best_count || (count == best_count && function_size > best_size)) {
+                best = i;
+                best_count = count;
+                best_size = function_size;
+            }
+        }
+        if (best == -1) {
+            printf("Error: The smallest the program could be made was %d words of ROM, over the budget of %d.\n", size,
+                   options->rom_budget);
             exit(EXIT_FAILURE);
         }
+        if (no_tried == 0) {
+            printf("Program needs %d words of ROM, over the budget of %d.\n", size, options->rom_budget);
+        }
+        char *name = trial_functions->table_array[best].name;
+        tried[no_tried] = (char *)malloc(strlen(name)+1);
+        strcpy(tried[no_tried], name);
+        no_tried++;
+        free_function_table(trial_functions);
+
+        // Try it, and keep it only if it helps.
+        names[no_names] = tried[no_tried-1];
+        VMFile *new_trial;
+        int new_size = measure_program(files, no_files, &trial_options, profile, names, no_names+1, &new_trial);
+        if (new_size < size) {
+            printf("Using size-optimised code for %s (%d words", names[no_names], best_size);
+            if (profile != NULL) {
+                printf(", run %ld time%s", best_count, (best_count == 1) ? "" : "s");
+            }
+            printf(").\n");
+            no_names++;
+            size = new_size;
+            free_files(trial, no_files);
+            trial = new_trial;
+        } else {
+            if (new_size == size) {
+                printf("Not using size-optimised code for %s, which saves nothing.\n", names[no_names]);
+            } else {
+                printf("Not using size-optimised code for %s, which would cost %d more words.\n", names[no_names],
+                       new_size - size);
+            }
+            free_files(new_trial, no_files);
+        }
+    }
+    if (no_names > 0) {
+        printf("Program now fits in %d of %d words of ROM (down from %d).\n", size, options->rom_budget, original_size);
+    }
+    free_files(trial, no_files);
+
+    // The names of the functions demoted are shared with tried, so only free the others.
+    for (int i=0; i<no_tried; i++) {
+        bool kept = false;
+        for (int j=0; j<no_names; j++) {
+            if (names[j] == tried[i]) {
+                kept = true;
+            }
+        }
+        if (!kept) {
+            free(tried[i]);
+        }
+    }
+    free(tried);
+    *demoted = names;
+    return no_names;
+}
 
-        FILE *input = fopen(list[i], "r");
-        if (input == NULL) {
-            printf("Error opening input file %s for lexing.",list[i]);
-            exit(EXIT_FAILURE);
+// Translates a copy of the program in files in memory, using size-optimised code for the functions named in demoted,
+// and returns the number of words of ROM it takes. Sets *trial to the optimised copy, which the caller must free.
+int measure_program(VMFile *files, int no_files, const Options *options, const Profile *profile, char **demoted,
+                    int no_demoted, VMFile **trial) {
+    *trial = copy_files(files, no_files);
+    Output *measure = malloc_output(NULL, true);
+    translate_program(*trial, no_files, options, profile, demoted, no_demoted, measure, NULL);
+    int size = measure->rom_length;
+    close_output(measure);
+    return size;
+}
+
+// Optimises the program in files and writes Hack assembly code for it to output, using size-optimised code for the
+// functions named in demoted. If report isn't NULL, describes what the optimiser did to it, and to stdout.
+void translate_program(VMFile *files, int no_files, const Options *options, const Profile *profile, char **demoted,
+                       int no_demoted, Output *output, FILE *report) {
+    // This has to come before inlining, which leaves shared calls alone.
+    int instructions_shared = share_functions(files, no_files, demoted, no_demoted);
+
+    InlineReport *reports;
+    int no_reports = inline_functions(files, no_files, profile, &reports);
+    if (report != NULL) {
+        report_inlining(reports, no_reports);
+    }
+    free_inline_reports(reports, no_reports);
+
+    // Inlining can leave functions with no callers, so only look for unreachable code afterwards.
+    int instructions_removed;
+    int functions_removed = remove_unreachable_functions(files, no_files, &instructions_removed);
+    if (report != NULL && functions_removed > 0) {
+        fprintf(report, "Removed %d function%s unreachable from Sys.init (%d VM instructions).\n", functions_removed,
+                (functions_removed == 1) ? "" : "s", instructions_removed);
+    }
+
+    // Place the static variables now that we know which are left, since static frames go straight after them.
+    int *static_words;
+    int statics_end = allocate_statics(files, no_files, &static_words);
+    if (report != NULL) {
+        int address = FIRST_STATIC_ADDRESS;
+        for (int i=0; i<no_files; i++) {
+            if (static_words[i] > 0) {
+                if (static_words[i] == 1) {
+                    fprintf(report, "Static variables for %s: 1 word of RAM (address %d).\n", files[i].filename,
+                            address);
+                } else {
+                    fprintf(report, "Static variables for %s: %d words of RAM (addresses %d to %d).\n",
+                            files[i].filename, static_words[i], address, address + static_words[i] - 1);
+                }
+                address += static_words[i];
+            }
+        }
+    }
+    free(static_words);
+
+    char code[400] = "";
+    parse_bootstrap(code);
+    output_code(output, code);
+
+    // This has to come before sharing calls, since lean returns can't use the shared return routine.
+    if (options->lean_frames) {
+        int calls_lean;
+        int functions_lean = mark_lean_frames(files, no_files, &calls_lean);
+        if (report != NULL) {
+            fprintf(report, "Using lean frames for %d function%s which leave THIS and THAT alone (%d call site%s).\n",
+                    functions_lean, (functions_lean == 1) ? "" : "s", calls_lean, (calls_lean == 1) ? "" : "s");
         }
+    }
 
-        lex_file(input, lex_output);
+    int frame_words = 0;
+    if (options->static_frames) {
+        int functions_static = allocate_static_frames(files, no_files, statics_end, &frame_words);
+        if (report != NULL) {
+            fprintf(report, "Using static frames for %d function%s (%d word%s of RAM).\n", functions_static,
+                    (functions_static == 1) ? "" : "s", frame_words, (frame_words == 1) ? "" : "s");
+        }
+    }
+    if (report != NULL) {
+        fprintf(report, "RAM below the stack: %d of %d words used by static variables and %d by static frames.\n",
+                statics_end - FIRST_STATIC_ADDRESS, STACK_BASE - FIRST_STATIC_ADDRESS, frame_words);
+    }
 
-        fclose(input);
-        fclose(lex_output);
+    // Rarely-run calls and returns use shared routines to save space.
+    if (profile != NULL) {
+        int returns_shared;
+        int calls_shared = share_cold_calls(files, no_files, profile, &returns_shared);
+        if (report != NULL) {
+            fprintf(report, "Using the shared call and return routines for %d cold call site%s and %d cold return%s.\n",
+                    calls_shared, (calls_shared == 1) ? "" : "s", returns_shared, (returns_shared == 1) ? "" : "s");
+        }
+        instructions_shared += calls_shared + returns_shared;
+    }
+    if (instructions_shared > 0) {
+        char routines[8000] = "";
+        parse_shared_routines(routines);
+        output_code(output, routines);
+    }
 
-        FILE *lex_input = fopen("temp.lex", "r");
-        if (lex_input == NULL) {
-            printf("Error reopening .lex file for input.");
-            exit(EXIT_FAILURE);
+    int files_cached = 0;
+    for (int i=0; i<no_files; i++) {
+        if (options->cache_folder == NULL) {
+            parse_file(files[i].filename, files[i].instructions, output, false, report);
+        } else if (parse_file_cached(files[i].filename, files[i].instructions, output, options->cache_folder, report)) {
+            files_cached++;
         }
+    }
+    if (report != NULL && options->cache_folder != NULL) {
+        fprintf(report, "Reused cached code for %d of %d file%s.\n", files_cached, no_files, (no_files == 1) ? "" : "s");
+    }
+}
 
-        char filename[MAX_PATH] = "";
-        int slash_pos = 0;
-        while(list[i][slash_pos] != '\\' && list[i][slash_pos] != '/') {
-            slash_pos++;
+// Returns a newly-allocated copy of the no_files files in files, including their instructions.
+VMFile *copy_files(const VMFile *files, int no_files) {
+    VMFile *copy = (VMFile *)malloc((no_files + 1) * sizeof(VMFile));
+    for (int i=0; i<no_files; i++) {
+        copy[i].filename = (char *)malloc(strlen(files[i].filename)+1);
+        strcpy(copy[i].filename, files[i].filename);
+        copy[i].instructions = malloc_instruction_list();
+        for (int j=0; j<files[i].instructions->list_length; j++) {
+            copy_instruction(copy[i].instructions, &(files[i].instructions->list_array[j]));
         }
-        slash_pos++;
-        int pos = 0;
-        while(list[i][pos+slash_pos] != '\0') {
-            filename[pos] = list[i][pos+slash_pos];
-            pos++;
+    }
+    return copy;
+}
+
+// Frees each of the no_files files in files, then files itself.
+void free_files(VMFile *files, int no_files) {
+    for (int i=0; i<no_files; i++) {
+        free(files[i].filename);
+        free_instruction_list(files[i].instructions);
+    }
+    free(files);
+}
+
+// Prints a line for each inlined function saying how much faster each call has become and how much bigger the
+// program has become, together with the total change in program size. These are only estimates, since they count
+// each comparison as taking as long as its longest path and ignore any further optimisation of the inlined code.
+void report_inlining(InlineReport *reports, int no_reports) {
+    int total_sites = 0;
+    int total_size = 0;
+    for (int i=0; i<no_reports; i++) {
+        // Measure the code as it will actually be output, i.e. after constant folding.
+        InstructionList *call = malloc_instruction_list();
+        add_instruction(call, CALL, CONSTANT, reports[i].args, reports[i].name);
+        fold_constants(reports[i].function_code);
+        fold_constants(reports[i].inlined_code);
+
+        int call_cycles = estimate_cycles(call, "") + estimate_cycles(reports[i].function_code, "");
+        int inlined_cycles = estimate_cycles(reports[i].inlined_code, "");
+        int size_change = estimate_size(reports[i].inlined_code, "") - estimate_size(call, "");
+        free_instruction_list(call);
+
+        printf("Inlined %s at %d call site%s: about %d cycles saved per call, %+d words of ROM per call site.\n",
+               reports[i].name, reports[i].call_sites, (reports[i].call_sites == 1) ? "" : "s",
+               call_cycles - inlined_cycles, size_change);
+        total_sites += reports[i].call_sites;
+        total_size += reports[i].call_sites * size_change;
+    }
+    if (no_reports > 0) {
+        printf("Inlined %d call site%s in total: %+d words of ROM (not counting functions that are no longer "
+               "called).\n", total_sites, (total_sites == 1) ? "" : "s", total_size);
+    }
+}
+
+// Returns the number of Hack instructions it takes to translate list.
+int estimate_size(InstructionList *list, char *filename) {
+    return estimate_range_size(list, 0, list->list_length, filename);
+}
+
+// Returns the number of Hack instructions it takes to translate list->list_array[start] to list->list_array[end-1].
+int estimate_range_size(InstructionList *list, int start, int end, char *filename) {
+    int size = 0;
+    sp_lag = 0;
+    value_in_d = false;
+    for (int i=start; i<end; i++) {
+        char code[1000000];
+        code[0] = '\0';
+        translate_instruction(&(list->list_array[i]), filename, code);
+        size += count_hack_instructions(code);
+    }
+    char sync_code[100] = "";
+    sync_stack_pointer(sync_code);
+    return size + count_hack_instructions(sync_code);
+}
+
+// Returns roughly the number of cycles it takes to run list, assuming it doesn't jump backwards anywhere except in
+// function instructions (where we add in the loop that initialises each local variable).
+int estimate_cycles(InstructionList *list, char *filename) {
+    int cycles = estimate_size(list, filename);
+    for (int i=0; i<list->list_length; i++) {
+        if (list->list_array[i].command == FUNCTION) {
+            cycles += 14 * list->list_array[i].index;
         }
-        parse_file(filename, lex_input, output, false);
+    }
+    return cycles;
+}
 
-        fclose(lex_input);
-        free(list[i]);
+// Returns the number of Hack instructions in the given assembly code, i.e. the number of lines which aren't blank,
+// comments or labels.
+int count_hack_instructions(const char *code) {
+    int count = 0;
+    const char *line = code;
+    while (*line != '\0') {
+        if (*line != '\n' && *line != '(' && strncmp(line, "//", 2) != 0) {
+            count++;
+        }
+        while (*line != '\0' && *line != '\n') {
+            line++;
+        }
+        if (*line == '\n') {
+            line++;
+        }
     }
-    free(list);
+    return count;
 }
 
 // Note that folder names can have .s in them, so we do need to do this the clever way.
@@ -186,7 +782,22 @@ bool is_folder(const char *path) {
 #endif
 }
 
-// Sets **list to a list of paths of all .vm files in the folder path. The return value is the length of the list
+// Returns true if path ends in the given extension (ignoring case), e.g. has_extension("Main.VM", ".vm") is true.
+bool has_extension(const char *path, const char *extension) {
+    int path_length = strlen(path);
+    int extension_length = strlen(extension);
+    if (path_length < extension_length) {
+        return false;
+    }
+    for (int i=0; i<extension_length; i++) {
+        if (tolower(path[path_length - extension_length + i]) != tolower(extension[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sets **list to a list of paths of all .vm and .vmb files in the folder path. The return value is the length of the list
 // (counting from 0). Full disclosure, this is beyond my C abilities and I turned to every corner of the Internet for
 // help. I would feel bad about this if I taught C, but I don't, so I don't! :-D
 int list_vm_files(const char *path, char ***list) {
@@ -196,7 +807,7 @@ int list_vm_files(const char *path, char ***list) {
     HANDLE hFind = NULL;
 
     char s_path[2048];
-    sprintf(s_path, "%s\\*.vm", path);
+    sprintf(s_path, "%s\\*.vm*", path); // This also matches e.g. .vmx, so we check the extension properly below.
     int length = 0;
 
     hFind = FindFirstFile(s_path, &fd_file);
@@ -206,17 +817,22 @@ int list_vm_files(const char *path, char ***list) {
         exit(EXIT_FAILURE);
     }
     do {
-        length++;
+        if (has_extension(fd_file.cFileName, ".vm") || has_extension(fd_file.cFileName, ".vmb")) {
+            length++;
+        }
     } while(FindNextFile(hFind, &fd_file));
     FindClose(hFind);
 
     *list = (char **)malloc(length * sizeof(char *));
     hFind = FindFirstFile(s_path, &fd_file);
-    for(int i=0; i<length; i++) {
-        (*list)[i] = (char *)malloc((MAX_PATH+1)*sizeof(char));
-        sprintf((*list)[i], "%s\\%s", path, fd_file.cFileName);
-        FindNextFile(hFind, &fd_file);
-    }
+    int i = 0;
+    do {
+        if (has_extension(fd_file.cFileName, ".vm") || has_extension(fd_file.cFileName, ".vmb")) {
+            (*list)[i] = (char *)malloc((MAX_PATH+1)*sizeof(char));
+            sprintf((*list)[i], "%s\\%s", path, fd_file.cFileName);
+            i++;
+        }
+    } while(FindNextFile(hFind, &fd_file));
     FindClose(hFind);
 
     return length;
@@ -234,7 +850,8 @@ int list_vm_files(const char *path, char ***list) {
     int length = 0;
     entry = readdir(dir);
     while (entry != NULL) {
-        if (fnmatch("*.vm", entry->d_name, FNM_CASEFOLD) == 0) {
+        if (fnmatch("*.vm", entry->d_name, FNM_CASEFOLD) == 0 ||
+                fnmatch("*.vmb", entry->d_name, FNM_CASEFOLD) == 0) {
             length++;
         }
         entry = readdir(dir);
@@ -246,7 +863,8 @@ int list_vm_files(const char *path, char ***list) {
     dir = opendir(path);
     entry = readdir(dir);
     while (entry != NULL) {
-        if (fnmatch("*.vm", entry->d_name, FNM_CASEFOLD) == 0) {
+        if (fnmatch("*.vm", entry->d_name, FNM_CASEFOLD) == 0 ||
+                fnmatch("*.vmb", entry->d_name, FNM_CASEFOLD) == 0) {
             (*list)[i] = (char *)malloc((MAX_PATH+1)*sizeof(char));
             sprintf((*list)[i], "%s/%s", path, entry->d_name);
             i++;
@@ -259,23 +877,16 @@ int list_vm_files(const char *path, char ***list) {
 #endif
 }
 
-// Outputs a tokenised version of input to output.
-void lex_file(FILE *input, FILE *output) {
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, MAX_LINE_LENGTH, input) != NULL) {
-        lex_line(line, output);
-    }
-}
-
-// Reads the next line from input, tokenises it, and writes the resulting tokens to output.
-void lex_line(const char *line, FILE *output) {
+// Tokenises the given line of VM code into dest, ignoring whitespace and comments, and returns the number of tokens.
+// Blank lines and comments give no tokens at all.
+int lex_line(const char *line, Token *dest[]) {
     int pos = 0;
-    bool tokens_on_line = false;
+    int length = 0;
 
     // In each iteration of this loop, everything up to line[pos] has been lexed.
-    while ((line[pos] != '\n') && (line[pos] != '\r')) {
+    while ((line[pos] != '\n') && (line[pos] != '\r') && (line[pos] != '\0')) {
         // Ignore all whitespace.
-        if (line[pos] == ' ') {
+        if (line[pos] == ' ' || line[pos] == '\t') {
             pos++;
             continue;
         }
@@ -285,21 +896,11 @@ void lex_line(const char *line, FILE *output) {
             break;
         }
 
-        // Otherwise, we have at least one non-newline token, so lex it.
-        tokens_on_line = true;
-        Token *next = malloc_token();
-        pos += lex_token(next, line + pos);
-        write_token(next, output);
-        free_token(next);
-    }
-
-    // Ignore empty lines, but otherwise lex the newline at the end.
-    if (tokens_on_line) {
-        Token *next = malloc_token();
-        lex_token(next, "\n");
-        write_token(next, output);
-        free_token(next);
+        dest[length] = malloc_token();
+        pos += lex_token(dest[length], line + pos);
+        length++;
     }
+    return length;
 }
 
 // Reads the next token from a non-empty, non-label, non-comment line into dest, then returns the number of characters
@@ -323,7 +924,8 @@ int lex_token(Token *dest, const char *line) {
         // Either way, it keeps going until reaching either a space, a newline. (Per the definition of an identifier
         // token, if there's a // before a space, it counts as part of the identifier rather than a comment.)
         length = 0;
-        while(line[length] != ' ' && line[length] != '\n' && line[length] != '\r'){
+        while(line[length] != ' ' && line[length] != '\t' && line[length] != '\n' && line[length] != '\r' &&
+                line[length] != '\0'){
             length++;
         }
 
@@ -388,9 +990,9 @@ int lex_token(Token *dest, const char *line) {
     return length;
 }
 
-// Input should be a tokenised file. Writes Hack assembly code to output.
-void parse_file(char *filename, FILE *input, FILE *output, bool standalone) {
-    Token *instruction[MAX_LINE_LENGTH];
+// Optimises the given instructions from the file filename, then writes Hack assembly code for them to output. If report
+// isn't NULL, the optimiser describes what it did there.
+void parse_file(char *filename, InstructionList *instructions, Output *output, bool standalone, FILE *report) {
     if (standalone) {
         // Send code to output to initialise SP. Comment out to make week 10 test scripts work.
 /*        fputs("@256\n"
@@ -398,192 +1000,334 @@ void parse_file(char *filename, FILE *input, FILE *output, bool standalone) {
                 "@SP\n"
                 "M=D\n", output); */
     }
-    while (1) {
-        // Get the next instruction.
-        int length = get_next_instruction(instruction, input);
-        // If we just have an EOF, free the token and finish.
-        if (length == 0) {
-            free_token(instruction[0]);
-            break;
-        }
-        // Otherwise, actually parse the instruction, free the token and repeat.
-        parse_instruction(instruction, filename, output);
-        for(int i=0; i<length; i++) {
-            free_token(instruction[i]);
+
+    // Folding constants can turn if-goto conditions into constants, so simplify the jumps again afterwards.
+    simplify_jumps(instructions);
+    fold_constants(instructions);
+    simplify_jumps(instructions);
+    set_label_scope(filename, NULL);
+    value_in_d = false;
+    convert_tail_calls(instructions, report);
+    for (int i=0; i<instructions->list_length; i++) {
+        char template_code[200] = "";
+        int matched = parse_template(instructions, i, template_code);
+        if (matched > 0) {
+            output_code(output, template_code);
+            i += matched - 1;
+        } else {
+            parse_instruction(&(instructions->list_array[i]), filename, output);
         }
     }
+    char sync_code[100] = "";
+    sync_stack_pointer(sync_code);
+    output_code(output, sync_code);
+
     if (standalone) {
         // Send code to output to end with infinite loop.
-        fputs("(HaltInfiniteLoop)\n"
-              "@HaltInfiniteLoop\n"
-              "0;JMP", output);
+        output_code(output, "(HaltInfiniteLoop)\n"
+                            "@HaltInfiniteLoop\n"
+                            "0;JMP");
     }
 }
 
-// Copies a list of tokens corresponding to the next Hack VM instruction into dest, omitting the newline. Returns number
-// of tokens.
-int get_next_instruction(Token *dest[], FILE *input) {
-    dest[0] = malloc_token();
-    bool instruction_exists = read_token(dest[0], input);
-    if (!instruction_exists) {
-        return 0;
-    }
-    int length = 1;
-    while (1) {
-        dest[length] = malloc_token();
-        read_token(dest[length], input);
-        if (dest[length]->type == NEWLINE) {
-            free_token(dest[length]);
-            break;
+// Like parse_file (with standalone false), but if the cache in cache_folder (see cache.h) already has the code for
+// instructions it's used as it is, and otherwise the code is stored there as well as sent to output. Either way, what
+// the optimiser reported about the file goes to report (if it isn't NULL), so a cached file reports the same as one
+// translated afresh. Returns true if the code came from the cache.
+bool parse_file_cached(char *filename, InstructionList *instructions, Output *output, const char *cache_folder,
+                       FILE *report) {
+    unsigned long long hash = hash_file(filename, instructions);
+    char *code = read_cache(cache_folder, hash, ".asm");
+    char *messages = read_cache(cache_folder, hash, ".txt");
+    bool cached = (code != NULL && messages != NULL);
+    if (!cached) {
+        free(code);
+        free(messages);
+        FILE *report_entry = start_cache_entry(cache_folder, hash, ".txt");
+        FILE *entry = start_cache_entry(cache_folder, hash, ".asm");
+        Output *entry_output = malloc_output(entry, false);
+        parse_file(filename, instructions, entry_output, false, report_entry);
+        close_output(entry_output);
+        finish_cache_entry(report_entry, cache_folder, hash, ".txt");
+        finish_cache_entry(entry, cache_folder, hash, ".asm");
+        code = read_cache(cache_folder, hash, ".asm");
+        messages = read_cache(cache_folder, hash, ".txt");
+        if (code == NULL || messages == NULL) {
+            printf("Error reading back cached code for %s.", filename);
+            exit(EXIT_FAILURE);
         }
-        length++;
     }
-    return length;
+    output_code(output, code);
+    if (report != NULL) {
+        fputs(messages, report);
+    }
+    free(code);
+    free(messages);
+    return cached;
 }
 
-// Parse the given VM instruction and write the corresponding assembly code to the output file.
-void parse_instruction(Token *instruction[], char *filename, FILE *output) {
-    char code_to_output[1000000] = "";
-
+// Checks the syntax of the given tokenised VM instruction and adds it to the end of list.
+void read_instruction(Token *tokens[], int length, InstructionList *list) {
     // We can tell the entire syntax of the instruction from the first token, which should be a keyword.
-    if (instruction[0]->type != KEYWORD) {
+    if (tokens[0]->type != KEYWORD) {
         printf("Malformed instruction!");
         exit(EXIT_FAILURE);
-    } switch (instruction[0]->value.key_val) {
-        case PUSH:     parse_push(filename, instruction[1], instruction[2], code_to_output); break;
-        case POP:      parse_pop(filename, instruction[1], instruction[2], code_to_output); break;
+    }
+    Keyword command = tokens[0]->value.key_val;
+    switch (command) {
+        case PUSH:
+        case POP:
+            if (length != 3 || tokens[1]->type != KEYWORD || tokens[2]->type != INTEGER_LITERAL) {
+                printf("Malformed instruction!");
+                exit(EXIT_FAILURE);
+            }
+            add_instruction(list, command, tokens[1]->value.key_val, tokens[2]->value.int_val, NULL);
+            break;
+        case LABEL:
+        case GOTO:
+        case IFGOTO:
+            if (length != 2 || tokens[1]->type != IDENTIFIER) {
+                printf("Malformed instruction!");
+                exit(EXIT_FAILURE);
+            }
+            add_instruction(list, command, CONSTANT, 0, tokens[1]->value.str_val);
+            break;
+        case FUNCTION:
+        case CALL:
+            if (length != 3 || tokens[1]->type != IDENTIFIER || tokens[2]->type != INTEGER_LITERAL) {
+                printf("Malformed instruction!");
+                exit(EXIT_FAILURE);
+            }
+            add_instruction(list, command, CONSTANT, tokens[2]->value.int_val, tokens[1]->value.str_val);
+            break;
+        case ADD: case SUB: case NEG: case AND: case OR: case NOT: case EQ: case GT: case LT: case RETURN:
+            add_instruction(list, command, CONSTANT, 0, NULL);
+            break;
+        default: printf("Malformed instruction!"); exit(EXIT_FAILURE);
+    }
+}
+
+// Parse the given VM instruction and write the corresponding assembly code to the output file.
+void parse_instruction(Instruction *instruction, char *filename, Output *output) {
+    char code_to_output[1000000];
+    code_to_output[0] = '\0'; // Don't use = "" here, which would fill the whole megabyte with zeroes every time.
+    translate_instruction(instruction, filename, code_to_output);
+    output_code(output, code_to_output);
+}
+
+// If the instructions starting at list->list_array[start] match a template (see templates.h) for the current sp_lag,
+// appends the template's code into dest and returns the number of instructions it covers, choosing the template that
+// covers the most. Otherwise returns 0.
+int parse_template(const InstructionList *list, int start, char *dest) {
+    const Template *best = NULL;
+    for (int i=0; i<NumTemplates; i++) {
+        const Template *template = &Templates[i];
+        if (template->lag_in != sp_lag || start + template->no_commands > list->list_length ||
+                (best != NULL && best->no_commands >= template->no_commands)) {
+            continue;
+        }
+        bool match = true;
+        for (int j=0; j<template->no_commands && match; j++) {
+            const Instruction *instruction = &(list->list_array[start+j]);
+            const TemplateCommand *command = &(template->commands[j]);
+            match = !instruction->immediate && instruction->command == command->command &&
+                    instruction->segment == command->segment &&
+                    (command->command != PUSH || instruction->index == command->index);
+        }
+        if (match) {
+            best = template;
+        }
+    }
+    if (best == NULL) {
+        return 0;
+    }
+    strcat(dest, "// template\n");
+    strcat(dest, best->code);
+    sp_lag = best->lag_out;
+    value_in_d = false;
+    return best->no_commands;
+}
+
+// Append assembly code for the given VM instruction into code_to_output.
+void translate_instruction(Instruction *instruction, char *filename, char *code_to_output) {
+    // Static variables in inlined code belong to the file the code came from, see instruction.h.
+    char *variable_file = (instruction->name != NULL) ? instruction->name : filename;
+
+    // SP has to be right in RAM wherever control can arrive from or go to somewhere else. If-gotos sync it themselves,
+    // after popping their condition. Functions set SP from scratch, and control can't fall into them.
+    switch (instruction->command) {
+        case LABEL: case GOTO: case CALL: case RETURN: sync_stack_pointer(code_to_output); break;
+        case FUNCTION: sp_lag = 0; set_label_scope(filename, instruction->name); break;
+        default: break;
+    }
+
+    if (instruction->command == IFGOTO && instruction->segment != CONSTANT) {
+        parse_compare_and_branch(filename, instruction, code_to_output);
+    } else if (instruction->immediate) {
+        if (instruction->command == POP) {
+            parse_pop_immediate(variable_file, instruction, code_to_output);
+        } else {
+            parse_immediate(filename, instruction, code_to_output);
+        }
+    } else switch (instruction->command) {
+        case PUSH:     parse_push(variable_file, instruction->segment, instruction->index, code_to_output); break;
+        case POP:      parse_pop(variable_file, instruction->segment, instruction->index, code_to_output); break;
         case ADD:      parse_add(code_to_output); break;
         case SUB:      parse_sub(code_to_output); break;
         case NEG:      parse_neg(code_to_output); break;
         case AND:      parse_and(code_to_output); break;
         case OR:       parse_or(code_to_output); break;
         case NOT:      parse_not(code_to_output); break;
-        case EQ:       parse_eq(filename, code_to_output); break;
-        case LT:       parse_lt(filename, code_to_output); break;
-        case GT:       parse_gt(filename, code_to_output); break;
-        case LABEL:    parse_label(filename, instruction[1], code_to_output); break;
-        case GOTO:     parse_goto(filename, instruction[1], code_to_output); break;
-        case IFGOTO:   parse_ifgoto(filename, instruction[1], code_to_output); break;
-        case FUNCTION: parse_function(filename, instruction[1], instruction[2], code_to_output); break;
-        case CALL:     parse_call(filename, instruction[1], instruction[2], code_to_output); break;
-        case RETURN:   parse_return(code_to_output); break;
+        case EQ:
+        case LT:
+        case GT:
+            if (instruction->shared) {
+                parse_shared_compare(filename, instruction->command, code_to_output);
+            } else if (instruction->command == EQ) {
+                parse_eq(filename, code_to_output);
+            } else if (instruction->command == LT) {
+                parse_lt(filename, code_to_output);
+            } else {
+                parse_gt(filename, code_to_output);
+            }
+            break;
+        case LABEL:    parse_label(filename, instruction->name, code_to_output); break;
+        case GOTO:     parse_goto(filename, instruction->name, code_to_output); break;
+        case IFGOTO:   parse_ifgoto(filename, instruction->name, code_to_output); break;
+        case FUNCTION: parse_function(filename, instruction->name, instruction->index, code_to_output); break;
+        case CALL:
+            if (instruction->segment == RETURN) {
+                parse_tail_call(filename, instruction->name, instruction->index, code_to_output);
+            } else if (instruction->shared) {
+                parse_shared_call(filename, instruction->name, instruction->index, code_to_output);
+            } else {
+                parse_call(filename, instruction->name, instruction->index, instruction->lean, code_to_output);
+            }
+            break;
+        case RETURN:
+            if (instruction->shared && !instruction->lean) {
+                strcat(code_to_output, "// Shared return\n"
+                                       "@shared$return\n"
+                                       "0;JMP\n");
+            } else {
+                parse_return(instruction->lean, code_to_output);
+            }
+            break;
+        case DROP:     parse_drop(instruction->index, code_to_output); break;
         default: printf("Malformed instruction!"); exit(EXIT_FAILURE);
     }
 
-    fputs(code_to_output, output);
-    fflush(output);
+    if (sp_lag > MAX_SP_LAG || sp_lag < -MAX_SP_LAG) {
+        sync_stack_pointer(code_to_output);
+    }
+    value_in_d = (instruction->command == CALL && instruction->segment != RETURN && instruction->lean);
 }
 
 // Append assembly code for an "add" instruction into dest.
 void parse_add(char *dest) {
-    strcat(dest, "// add\n"
-                 "@SP\n"
-                 "M=M-1\n"
-                 "A=M\n"
-                 "D=M\n"
-                 "@SP\n"
-                 "A=M-1\n"
+    strcat(dest, "// add\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "D=M\n"
+                 "A=A-1\n"
                  "M=M+D\n");
+    sp_lag--;
 }
 
 // Append assembly code for the instruction "push [segment] [address]" into dest.
-void parse_push(char *filename, Token *segment, Token *address, char *dest) {
-    if (segment->type != KEYWORD) {
-        printf("Malformed instruction!");
-        exit(EXIT_FAILURE);
-    }
-    if (segment->value.key_val == CONSTANT) {
-        char code[200] = "";
-        sprintf(code, "//push\n"
-                      "@%d\n"
-                      "D=A\n"
-                      "@SP\n"
-                      "M=M+1\n"
-                      "A=M-1\n"
-                      "M=D\n", address->value.int_val);
-        strcat(dest, code);
+void parse_push(char *filename, Keyword segment, int address, char *dest) {
+    if (segment == CONSTANT) {
+        // The optimiser can give us any 16-bit constant here, not just the 0 to 32767 allowed in VM code. The ALU can
+        // produce 0, 1 and -1 directly, so we don't need to go via D for them.
+        strcat(dest, "//push\n");
+        if (address >= -1 && address <= 1) {
+            char code[200] = "";
+            load_stack_address(0, dest);
+            sprintf(code, "M=%d\n", address);
+            strcat(dest, code);
+        } else {
+            load_constant(address, dest);
+            load_stack_address(0, dest);
+            strcat(dest, "M=D\n");
+        }
     } else {
         parse_load_data(filename, segment, address, dest);
-        strcat(dest, "D=M\n"
-                     "@SP\n"
-                     "M=M+1\n"
-                     "A=M-1\n"
-                     "M=D\n");
+        strcat(dest, "D=M\n");
+        load_stack_address(0, dest);
+        strcat(dest, "M=D\n");
     }
+    sp_lag++;
 }
 
 // Append assembly code for the instruction "pop [segment] [address]" into dest.
-void parse_pop(char *filename, Token *segment, Token *address, char *dest) {
-    if (segment->type != KEYWORD) {
-        printf("Malformed instruction!");
-        exit(EXIT_FAILURE);
-    }
+void parse_pop(char *filename, Keyword segment, int address, char *dest) {
     strcat(dest, "//pop\n");
+    // If we can find the address without using D, we can pop the value into D first and skip R13. (The stack segment
+    // is relative to SP, so once we've popped its offset is one less, though it's still the same distance from RAM[SP].)
+    int popped_address = (segment == STACK) ? address-1 : address;
+    if (popped_address >= 0 && loads_without_d(segment, address)) {
+        if (!value_in_d) {
+            load_stack_address(-1, dest);
+            strcat(dest, "D=M\n");
+        }
+        sp_lag--;
+        parse_load_data(filename, segment, popped_address, dest);
+        strcat(dest, "M=D\n");
+        return;
+    }
     parse_load_data(filename, segment, address, dest);
     strcat(dest, "D=A\n"
                  "@R13\n"
-                 "M=D\n" // Now R13 contains the address we want to pop into
-                 "@SP\n"
-                 "M=M-1\n"
-                 "A=M\n"
-                 "D=M\n" // Now we have decremented SP and stored the value we want to pop in D
+                 "M=D\n"); // Now R13 contains the address we want to pop into
+    load_stack_address(-1, dest);
+    strcat(dest, "D=M\n" // Now we have the value we want to pop in D
                  "@R13\n"
                  "A=M\n"
                  "M=D\n");
+    sp_lag--;
 }
 
 // Append assembly code for the instruction "sub" into dest.
 void parse_sub(char *dest) {
-    strcat(dest, "// sub\n"
-                 "@SP\n"
-                 "M=M-1\n"
-                 "A=M\n"
-                 "D=M\n"
-                 "@SP\n"
-                 "A=M-1\n"
+    strcat(dest, "// sub\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "D=M\n"
+                 "A=A-1\n"
                  "M=M-D\n");
+    sp_lag--;
 }
 
 // Append assembly code for the instruction "neg" into dest.
 void parse_neg(char *dest) {
-    strcat(dest, "// neg\n"
-                 "@SP\n"
-                 "A=M-1\n"
-                 "D=-M\n"
-                 "M=D\n");
+    strcat(dest, "// neg\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "M=-M\n");
 }
 
 // Append assembly code for the instruction "and" into dest.
 void parse_and(char *dest) {
-    strcat(dest, "// and\n"
-                 "@SP\n"
-                 "M=M-1\n"
-                 "A=M\n"
-                 "D=M\n"
-                 "@SP\n"
-                 "A=M-1\n"
+    strcat(dest, "// and\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "D=M\n"
+                 "A=A-1\n"
                  "M=M&D\n");
+    sp_lag--;
 }
 
 // Append assembly code for the instruction "or" into dest.
 void parse_or(char *dest) {
-    strcat(dest, "// or\n"
-                 "@SP\n"
-                 "M=M-1\n"
-                 "A=M\n"
-                 "D=M\n"
-                 "@SP\n"
-                 "A=M-1\n"
+    strcat(dest, "// or\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "D=M\n"
+                 "A=A-1\n"
                  "M=M|D\n");
+    sp_lag--;
 }
 
 // Append assembly code for the instruction "not" into dest.
 void parse_not(char *dest) {
-    strcat(dest, "// not\n"
-                 "@SP\n"
-                 "A=M-1\n"
-                 "D=!M\n"
-                 "M=D\n");
+    strcat(dest, "// not\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "M=!M\n");
 }
 
 // Append assembly code for the instruction "eq" into dest.
@@ -594,160 +1338,392 @@ void parse_eq(char *filename, char *dest) {
     get_next_label_name(filename, new_label2);
 
     char code[4*MAX_LINE_LENGTH+200];
-    sprintf(code, "// eq\n"
-                  "@SP\n"
-                  "M=M-1\n"
-                  "A=M\n"
-                  "D=M\n"
-                  "@SP\n"
-                  "A=M-1\n"
-                  "D=D-M\n" // D now contains RAM[SP-1] - RAM[SP-2], and SP has been decremented
-                  "@%s\n"
-                  "D;JEQ\n"
-                  "@SP\n" // If we are here then RAM[SP-2] != RAM[SP-1], so write 0x0000 to RAM[SP-2]
-                  "A=M-1\n"
-                  "M=0\n"
+    strcat(dest, "// eq\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "D=M\n"
+                 "A=A-1\n"
+                 "D=D-M\n"); // D now contains y - x, where x is under y on the stack
+    sp_lag--;
+    sprintf(code, "@%s\n"
+                  "D;JEQ\n", new_label1);
+    strcat(dest, code);
+    load_stack_address(-1, dest); // If we are here then x != y, so write 0x0000 to x's slot
+    sprintf(code, "M=0\n"
                   "@%s\n"
                   "0;JMP\n"
-                  "(%s)\n"
-                  "@SP\n"
-                  "A=M-1\n"
-                  "M=-1\n" // If we are here then RAM[SP-2] == RAM[SP-1], so write 0xFFFF to RAM[SP-2]
-                  "(%s)\n", new_label1, new_label2, new_label1, new_label2);
+                  "(%s)\n", new_label2, new_label1);
+    strcat(dest, code);
+    load_stack_address(-1, dest); // If we are here then x == y, so write 0xFFFF to x's slot
+    sprintf(code, "M=-1\n"
+                  "(%s)\n", new_label2);
     strcat(dest, code);
 }
 
 // Append assembly code for the instruction "lt" into dest.
 void parse_lt(char *filename, char *dest) {
-    char new_label1[MAX_LINE_LENGTH] = "";
-    get_next_label_name(filename, new_label1);
-    char new_label2[MAX_LINE_LENGTH] = "";
-    get_next_label_name(filename, new_label2);
-
-    char code[4*MAX_LINE_LENGTH+200];
-    sprintf(code, "// lt\n"
-                  "@SP\n"
-                  "M=M-1\n"
-                  "A=M\n"
-                  "D=M\n"
-                  "@SP\n"
-                  "A=M-1\n"
-                  "D=D-M\n" // D now contains RAM[SP-1] - RAM[SP-2], and SP has been decremented
-                  "@%s\n"
-                  "D;JGT\n"
-                  "@SP\n" // If we are here then RAM[SP-2] >= RAM[SP-1], so write 0x0000 to RAM[SP-2]
-                  "A=M-1\n"
-                  "M=0\n"
+    char new_label[MAX_LINE_LENGTH] = "";
+    char code[MAX_LINE_LENGTH+200];
+    strcat(dest, "// lt\n");
+    compare_top_two(filename, dest); // D now has the sign of x - y, where x is under y on the stack
+    sp_lag--;
+    get_next_label_name(filename, new_label);
+    load_stack_address(-1, dest); // Write 0xFFFF to x's slot, and leave it there if x < y
+    sprintf(code, "M=-1\n"
                   "@%s\n"
-                  "0;JMP\n"
-                  "(%s)\n"
-                  "@SP\n"
-                  "A=M-1\n"
-                  "M=-1\n" // If we are here then RAM[SP-2] < RAM[SP-1], so write 0xFFFF to RAM[SP-2]
-                  "(%s)\n", new_label1, new_label2, new_label1, new_label2);
+                  "D;JLT\n", new_label);
+    strcat(dest, code);
+    load_stack_address(-1, dest); // If we are here then x >= y, so write 0x0000 to x's slot
+    sprintf(code, "M=0\n"
+                  "(%s)\n", new_label);
     strcat(dest, code);
 }
 
 // Append assembly code for the instruction "gt" into dest.
 void parse_gt(char *filename, char *dest) {
-    char new_label1[MAX_LINE_LENGTH] = "";
-    get_next_label_name(filename, new_label1);
-    char new_label2[MAX_LINE_LENGTH] = "";
-    get_next_label_name(filename, new_label2);
+    char new_label[MAX_LINE_LENGTH] = "";
+    char code[MAX_LINE_LENGTH+200];
+    strcat(dest, "// gt\n");
+    compare_top_two(filename, dest); // D now has the sign of x - y, where x is under y on the stack
+    sp_lag--;
+    get_next_label_name(filename, new_label);
+    load_stack_address(-1, dest); // Write 0xFFFF to x's slot, and leave it there if x > y
+    sprintf(code, "M=-1\n"
+                  "@%s\n"
+                  "D;JGT\n", new_label);
+    strcat(dest, code);
+    load_stack_address(-1, dest); // If we are here then x <= y, so write 0x0000 to x's slot
+    sprintf(code, "M=0\n"
+                  "(%s)\n", new_label);
+    strcat(dest, code);
+}
 
-    char code[4*MAX_LINE_LENGTH+200];
-    sprintf(code, "// gt\n"
-                  "@SP\n"
-                  "M=M-1\n"
-                  "A=M\n"
-                  "D=M\n"
-                  "@SP\n"
-                  "A=M-1\n"
-                  "D=D-M\n" // D now contains RAM[SP-1] - RAM[SP-2], and SP has been decremented
+// Append assembly code which sets D to a number with the same sign as x - y into dest, where y is the value on top of
+// the stack and x is the one under it, leaving the stack as it is. Working out x - y directly overflows when x and y
+// are far apart, which can only happen when one of them is negative and the other isn't, so in that case we use x (if
+// it's the negative one) or 1 instead. Comparisons then give the same answers as they do in the VM emulator.
+void compare_top_two(char *filename, char *dest) {
+    char subtract_label[MAX_LINE_LENGTH] = "";
+    get_next_label_name(filename, subtract_label);
+    char done_label[MAX_LINE_LENGTH] = "";
+    get_next_label_name(filename, done_label);
+
+    char code[2*MAX_LINE_LENGTH+200];
+    load_stack_address(-1, dest); // x | y is negative if either of them is, and x & y only if both are
+    sprintf(code, "D=M\n"
+                  "A=A-1\n"
+                  "D=D|M\n"
+                  "@%s\n"
+                  "D;JGE\n", subtract_label);
+    strcat(dest, code);
+    load_stack_address(-1, dest);
+    sprintf(code, "D=M\n"
+                  "A=A-1\n"
+                  "D=D&M\n"
+                  "@%s\n"
+                  "D;JLT\n", subtract_label);
+    strcat(dest, code);
+    load_stack_address(-2, dest); // If we are here then just one of x and y is negative
+    sprintf(code, "D=M\n"
                   "@%s\n"
                   "D;JLT\n"
-                  "@SP\n" // If we are here then RAM[SP-2] <= RAM[SP-1], so write 0x0000 to RAM[SP-2]
-                  "A=M-1\n"
-                  "M=0\n"
+                  "D=1\n"
                   "@%s\n"
                   "0;JMP\n"
-                  "(%s)\n"
-                  "@SP\n"
-                  "A=M-1\n"
-                  "M=-1\n" // If we are here then RAM[SP-2] > RAM[SP-1], so write 0xFFFF to RAM[SP-2]
-                  "(%s)\n", new_label1, new_label2, new_label1, new_label2);
+                  "(%s)\n", done_label, done_label, subtract_label);
+    strcat(dest, code);
+    load_stack_address(-1, dest);
+    sprintf(code, "D=M\n"
+                  "A=A-1\n"
+                  "D=M-D\n"
+                  "(%s)\n", done_label);
+    strcat(dest, code);
+}
+
+// Append assembly code for an immediate pop (i.e. "push constant [constant], pop [segment] [address]") into dest.
+void parse_pop_immediate(char *filename, Instruction *instruction, char *dest) {
+    int value = instruction->constant;
+    strcat(dest, "//pop immediate\n");
+    if (value >= -1 && value <= 1) {
+        // The ALU can write these to memory directly.
+        char code[20] = "";
+        parse_load_data(filename, instruction->segment, instruction->index, dest);
+        sprintf(code, "M=%d\n", value);
+        strcat(dest, code);
+    } else if (loads_without_d(instruction->segment, instruction->index)) {
+        load_constant(value, dest);
+        parse_load_data(filename, instruction->segment, instruction->index, dest);
+        strcat(dest, "M=D\n");
+    } else {
+        parse_load_data(filename, instruction->segment, instruction->index, dest);
+        strcat(dest, "D=A\n"
+                     "@R13\n"
+                     "M=D\n"); // Now R13 contains the address we want to pop into
+        load_constant(value, dest);
+        strcat(dest, "@R13\n"
+                     "A=M\n"
+                     "M=D\n");
+    }
+}
+
+// Append assembly code for an immediate arithmetic, logical or comparison instruction into dest. Here the top of the
+// stack is the first operand and the instruction's constant is the second, so e.g. an immediate sub with constant 3
+// replaces x with x-3.
+void parse_immediate(char *filename, Instruction *instruction, char *dest) {
+    int value = instruction->constant;
+    char code[4*MAX_LINE_LENGTH+200] = "";
+    char label[MAX_LINE_LENGTH] = "";
+    char *jump;
+
+    switch (instruction->command) {
+        case ADD:
+        case SUB:
+            if (instruction->command == SUB) {
+                value = to_word(-value);
+            }
+            strcat(dest, "// add immediate\n");
+            if (value == 0) {
+                return;
+            } else if (value == 1 || value == -1) {
+                load_stack_address(-1, dest);
+                sprintf(code, "M=M%c1\n", (value == 1) ? '+' : '-');
+                strcat(dest, code);
+            } else {
+                load_constant(value, dest);
+                load_stack_address(-1, dest);
+                strcat(dest, "M=M+D\n");
+            }
+            return;
+        case AND:
+        case OR:
+            strcat(dest, (instruction->command == AND) ? "// and immediate\n" : "// or immediate\n");
+            if ((instruction->command == AND && value == -1) || (instruction->command == OR && value == 0)) {
+                return;
+            } else if (value == 0 || value == -1) {
+                // "and 0" and "or -1" don't depend on the value on the stack at all.
+                load_stack_address(-1, dest);
+                sprintf(code, "M=%d\n", value);
+                strcat(dest, code);
+            } else {
+                load_constant(value, dest);
+                load_stack_address(-1, dest);
+                strcat(dest, (instruction->command == AND) ? "M=M&D\n" : "M=M|D\n");
+            }
+            return;
+        case EQ: jump = "JEQ"; break;
+        case LT: jump = "JLT"; break;
+        case GT: jump = "JGT"; break;
+        default: printf("Malformed instruction!"); exit(EXIT_FAILURE);
+    }
+
+    // If we get here we have a comparison. We compute x - [constant] in D (or something with the same sign, see
+    // subtract_for_compare), optimistically write true to the stack, then overwrite it with false if we don't jump
+    // past that code.
+    get_next_label_name(filename, label);
+    strcat(dest, "// compare immediate\n");
+    load_stack_address(-1, dest);
+    strcat(dest, "D=M\n");
+    if (instruction->command == EQ) {
+        subtract_constant(value, dest);
+    } else {
+        subtract_for_compare(filename, value, dest);
+    }
+    load_stack_address(-1, dest);
+    sprintf(code, "M=-1\n"
+                  "@%s\n"
+                  "D;%s\n", label, jump);
+    strcat(dest, code);
+    load_stack_address(-1, dest);
+    sprintf(code, "M=0\n"
+                  "(%s)\n", label);
+    strcat(dest, code);
+}
+
+// Append assembly code which sets D to the given 16-bit value into dest. A-instructions can only hold values from 0 to
+// 32767, so negative values need an extra step.
+void load_constant(int value, char *dest) {
+    char code[100] = "";
+    if (value >= 0) {
+        sprintf(code, "@%d\n"
+                      "D=A\n", value);
+    } else if (value > -32768) {
+        sprintf(code, "@%d\n"
+                      "D=-A\n", -value);
+    } else {
+        sprintf(code, "@32767\n"
+                      "D=-A\n"
+                      "D=D-1\n");
+    }
+    strcat(dest, code);
+}
+
+// Append assembly code which subtracts the given 16-bit value from D into dest.
+void subtract_constant(int value, char *dest) {
+    char code[100] = "";
+    if (value == 0) {
+        return;
+    } else if (value == 1 || value == -1) {
+        sprintf(code, "D=D%c1\n", (value == 1) ? '-' : '+');
+    } else if (value > 0) {
+        sprintf(code, "@%d\n"
+                      "D=D-A\n", value);
+    } else if (value > -32768) {
+        sprintf(code, "@%d\n"
+                      "D=D+A\n", -value);
+    } else {
+        // x - (-32768) wraps around to x + 32768, which is the same as x - 32768.
+        sprintf(code, "@32767\n"
+                      "D=D-A\n"
+                      "D=D-1\n");
+    }
+    strcat(dest, code);
+}
+
+// Append assembly code which, with x in D, sets D to a number with the same sign as x - value into dest (see
+// compare_top_two). Subtracting can only overflow when x and value have different signs, and then x itself has the
+// right sign unless it's 0, so we skip the subtraction when x is negative and value positive or the other way round.
+void subtract_for_compare(char *filename, int value, char *dest) {
+    char label[MAX_LINE_LENGTH] = "";
+    char code[MAX_LINE_LENGTH+100] = "";
+    if (value == 0) {
+        return;
+    }
+    get_next_label_name(filename, label);
+    if (value == -32768) {
+        // Every x but -32768 itself is bigger, and x - (-32768) is only negative when x >= 0, so we fix that up after.
+        subtract_constant(value, dest);
+        sprintf(code, "@%s\n"
+                      "D;JGE\n"
+                      "D=1\n"
+                      "(%s)\n", label, label);
+        strcat(dest, code);
+        return;
+    }
+    sprintf(code, "@%s\n"
+                  "D;%s\n", label, (value > 0) ? "JLT" : "JGT");
+    strcat(dest, code);
+    subtract_constant(value, dest);
+    sprintf(code, "(%s)\n", label);
     strcat(dest, code);
 }
 
 // Append assembly code for the instruction "label [label]" into dest.
-void parse_label(char *filename, Token *label, char *dest) {
+void parse_label(char *filename, char *label, char *dest) {
     char code[MAX_LINE_LENGTH+200] = "";
-    sprintf(code, "// Label\n(manual$%s$%s)\n", filename, label->value.str_val);
+    sprintf(code, "// Label\n(manual$%s$%s)\n", filename, label);
     strcat(dest, code);
 }
 
 // Append assembly code for the instruction "goto [label]" into dest.
-void parse_goto(char *filename, Token *label, char *dest) {
+void parse_goto(char *filename, char *label, char *dest) {
     char code[MAX_LINE_LENGTH+200] = "";
     sprintf(code, "// Goto\n@manual$%s$%s\n"
-                  "0;JMP\n", filename, label->value.str_val);
+                  "0;JMP\n", filename, label);
     strcat(dest, code);
 }
 
 // Append assembly code for the instruction "if-goto [label]" into dest.
-void parse_ifgoto(char *filename, Token *label, char *dest) {
+void parse_ifgoto(char *filename, char *label, char *dest) {
     char code[MAX_LINE_LENGTH+200] = "";
-    sprintf(code, "// If-goto\n@SP\n"
-                  "M=M-1\n"
-                  "A=M\n"
-                  "D=M\n"
-                  "@manual$%s$%s\n"
-                  "D;JNE\n", filename, label->value.str_val);
+    strcat(dest, "// If-goto\n");
+    if (!value_in_d) {
+        load_stack_address(-1, dest);
+        strcat(dest, "D=M\n");
+    }
+    sp_lag--;
+    sync_stack_pointer(dest);
+    sprintf(code, "@manual$%s$%s\n"
+                  "D;JNE\n", filename, label);
+    strcat(dest, code);
+}
+
+// Append assembly code for a comparison fused with the if-goto after it (see instruction.h) into dest. We work out
+// x - y in D (or something with the same sign) exactly as the comparison would, then jump on it directly instead of
+// pushing a boolean.
+void parse_compare_and_branch(char *filename, Instruction *instruction, char *dest) {
+    char code[MAX_LINE_LENGTH+200] = "";
+    char *jump;
+    bool negate = (instruction->index == 1);
+    switch (instruction->segment) {
+        case EQ: jump = negate ? "JNE" : "JEQ"; break;
+        case GT: jump = negate ? "JLE" : "JGT"; break;
+        case LT: jump = negate ? "JGE" : "JLT"; break;
+        default: printf("Malformed instruction!"); exit(EXIT_FAILURE);
+    }
+
+    strcat(dest, "// Compare and branch\n");
+    if (!instruction->immediate) {
+        compare_top_two(filename, dest);
+        sp_lag -= 2;
+    } else {
+        if (!value_in_d) {
+            load_stack_address(-1, dest);
+            strcat(dest, "D=M\n");
+        }
+        sp_lag--;
+        if (instruction->segment == EQ) {
+            subtract_constant(instruction->constant, dest);
+        } else {
+            subtract_for_compare(filename, instruction->constant, dest);
+        }
+    }
+    sync_stack_pointer(dest);
+    sprintf(code, "@manual$%s$%s\n"
+                  "D;%s\n", filename, instruction->name, jump);
     strcat(dest, code);
 }
 
 // Append assembly code to dest which loads the RAM address pointed to by [segment] [address] into A, where [segment]
 // cannot be the keyword "constant".
-void parse_load_data(char *filename, Token *segment, Token *address, char *dest) {
+void parse_load_data(char *filename, Keyword segment, int address, char *dest) {
     char code[200] = "";
 
-    switch (segment->value.key_val) {
+    char *base;
+
+    switch (segment) {
         case LOCAL:
-            sprintf(code, "@%d\n"
-                          "D=A\n"
-                          "@LCL\n"
-                          "A=M+D\n", address->value.int_val);
-            break;
         case ARGUMENT:
-            sprintf(code, "@%d\n"
-                          "D=A\n"
-                          "@ARG\n"
-                          "A=M+D\n", address->value.int_val);
-            break;
         case KW_THIS:
-            sprintf(code, "@%d\n"
-                          "D=A\n"
-                          "@THIS\n"
-                          "A=M+D\n", address->value.int_val);
-            break;
         case THAT:
-            sprintf(code, "@%d\n"
-                          "D=A\n"
-                          "@THAT\n"
-                          "A=M+D\n", address->value.int_val);
+            base = (segment == LOCAL) ? "LCL" : (segment == ARGUMENT) ? "ARG" : (segment == KW_THIS) ? "THIS" : "THAT";
+            if (address > MAX_CHAIN_OFFSET) {
+                sprintf(code, "@%d\n"
+                              "D=A\n"
+                              "@%s\n"
+                              "A=M+D\n", address, base);
+            } else {
+                // Small offsets are cheaper (and leave D alone) if we just count up from the base address.
+                sprintf(code, "@%s\n", base);
+                strcat(code, (address == 0) ? "A=M\n" : "A=M+1\n");
+                for (int i=1; i<address; i++) {
+                    strcat(code, "A=A+1\n");
+                }
+            }
             break;
         case POINTER:
-            if (address->value.int_val == 0) {
+            if (address == 0) {
                 strcat(code, "@THIS\n");
             } else {
                 strcat(code, "@THAT\n");
             }
             break;
         case TEMP:
-            sprintf(code,"@R%d\n", 5 + address->value.int_val);
+            // Static frames use temp past R15 to reach fixed addresses (see allocate_static_frames).
+            sprintf(code, (5 + address <= 15) ? "@R%d\n" : "@%d\n", 5 + address);
             break;
         case STATIC:
-            sprintf(code,"@%s.%d\n", filename, address->value.int_val);
+            sprintf(code,"@%s.%d\n", filename, address);
+            break;
+        case STACK:
+            // The value [address] places below the top of the stack is at SP-1-[address], where SP is the real stack
+            // pointer RAM[SP] + sp_lag.
+            if (loads_without_d(segment, address)) {
+                load_stack_address(-1-address, code);
+            } else {
+                sprintf(code, "@%d\n"
+                              "D=A\n"
+                              "@SP\n"
+                              "A=M-D\n", address+1-sp_lag);
+            }
             break;
         case CONSTANT:
             printf("Error: CONSTANT passed to parse_load_data.");
@@ -759,12 +1735,33 @@ void parse_load_data(char *filename, Token *segment, Token *address, char *dest)
     strcat(dest,code);
 }
 
-void parse_call(char *filename, Token *name, Token *args, char *dest) {
+// Returns true if parse_load_data can load the address of [segment] [address] into A without changing D.
+bool loads_without_d(Keyword segment, int address) {
+    switch (segment) {
+        case LOCAL:
+        case ARGUMENT:
+        case KW_THIS:
+        case THAT:
+            return address <= MAX_CHAIN_OFFSET;
+        case STACK:
+            return sp_lag - 1 - address >= -3;
+        case POINTER:
+        case TEMP:
+        case STATIC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Appends assembly code for "call [name] [args]" into dest. If lean is true, the THIS and THAT slots of the new frame
+// are left unfilled (see instruction.h).
+void parse_call(char *filename, char *name, int args, bool lean, char *dest) {
     char code[500+4*MAX_LINE_LENGTH] = "";
     char return_label[MAX_LINE_LENGTH] = "";
     get_next_label_name(filename, return_label);
     char function_label[MAX_LINE_LENGTH] = "";
-    get_function_label(name->value.str_val, function_label);
+    get_function_label(name, function_label);
     sprintf(code, "// Call\n"
                   "@%s // Push call frame to stack\n"
                   "D=A\n"
@@ -783,50 +1780,338 @@ void parse_call(char *filename, Token *name, Token *args, char *dest) {
                   "@SP\n"
                   "A=M+1\n"
                   "A=A+1\n"
-                  "M=D\n"
+                  "M=D\n", return_label);
+    strcat(dest, code);
 
-                  "@THIS\n"
-                  "D=M\n"
-                  "@SP\n"
-                  "A=M+1\n"
-                  "A=A+1\n"
-                  "A=A+1\n"
+    if (lean) {
+        sprintf(code, "D=A+1 // Update LCL, skipping THIS and THAT\n"
+                      "D=D+1\n"
+                      "D=D+1\n"
+                      "@LCL\n"
+                      "M=D\n"
+
+                      "@%d // Update ARG\n"
+                      "D=D-A\n", args+5);
+    } else {
+        sprintf(code, "@THIS\n"
+                      "D=M\n"
+                      "@SP\n"
+                      "A=M+1\n"
+                      "A=A+1\n"
+                      "A=A+1\n"
+                      "M=D\n"
+
+                      "@THAT\n"
+                      "D=M\n"
+                      "@SP\n"
+                      "A=M+1\n"
+                      "A=A+1\n"
+                      "A=A+1\n"
+                      "A=A+1\n"
+                      "M=D \n"
+
+                      "D=A+1 // Update LCL\n"
+                      "@LCL\n"
+                      "M=D\n"
+
+                      "@SP // Update ARG\n"
+                      "D=M\n"
+                      "@%d\n"
+                      "D=D-A\n", args);
+    }
+    strcat(dest, code);
+
+    sprintf(code, "@ARG\n"
                   "M=D\n"
+                  "@%s // Jump to function\n"
+                  "0;JMP\n"
+                  "(%s) // Return label\n", function_label, return_label);
+    strcat(dest, code);
+}
 
-                  "@THAT\n"
-                  "D=M\n"
-                  "@SP\n"
-                  "A=M+1\n"
-                  "A=A+1\n"
-                  "A=A+1\n"
-                  "A=A+1\n"
-                  "M=D \n"
+// Appends assembly code for a call using the shared call routine into dest. We pass the function's address in R13, the
+// number of arguments in R14 and the return address in D.
+void parse_shared_call(char *filename, char *name, int args, char *dest) {
+    char code[500+4*MAX_LINE_LENGTH] = "";
+    char return_label[MAX_LINE_LENGTH] = "";
+    get_next_label_name(filename, return_label);
+    char function_label[MAX_LINE_LENGTH] = "";
+    get_function_label(name, function_label);
+    sprintf(code, "// Shared call\n"
+                  "@%d\n"
+                  "D=A\n"
+                  "@R14\n"
+                  "M=D\n"
+                  "@%s\n"
+                  "D=A\n"
+                  "@R13\n"
+                  "M=D\n"
+                  "@%s\n"
+                  "D=A\n"
+                  "@shared$call\n"
+                  "0;JMP\n"
+                  "(%s) // Return label\n", args, function_label, return_label, return_label);
+    strcat(dest, code);
+}
 
-                  "D=A+1 // Update LCL\n"
-                  "@LCL\n"
+// Appends assembly code for a comparison using the shared comparison routine for command (EQ, LT or GT) into dest. We
+// pass the return address in R15, and SP has to be up to date.
+void parse_shared_compare(char *filename, Keyword command, char *dest) {
+    char code[200+2*MAX_LINE_LENGTH] = "";
+    char return_label[MAX_LINE_LENGTH] = "";
+    get_next_label_name(filename, return_label);
+    sync_stack_pointer(dest);
+    sprintf(code, "// Shared %s\n"
+                  "@%s\n"
+                  "D=A\n"
+                  "@R15\n"
                   "M=D\n"
+                  "@shared$%s\n"
+                  "0;JMP\n"
+                  "(%s) // Return label\n", KeywordToString[command], return_label, KeywordToString[command],
+            return_label);
+    strcat(dest, code);
+}
 
-                  "@SP // Update ARG\n"
+// Appends assembly code to initialise the stack and call Sys.init into dest.
+void parse_bootstrap(char *dest) {
+    char code[400];
+    char init_label[200];
+    get_function_label("Sys.init", init_label);
+    sprintf(code, "@261\n"
+                  "D=A\n"
+                  "@LCL\n" // We set LCL rather than the stack pointer since the
+                  "M=D\n"  // function code will initialise SP to LCL.
+                  "@%s\n"
+                  "0;JMP\n", init_label);
+    strcat(dest, code);
+}
+
+// Appends assembly code for the routines used by shared calls, returns and comparisons into dest. The call routine
+// does exactly what parse_call's code does, but with its inputs passed as described in parse_shared_call, and the
+// return routine is just parse_return's code. The comparison routines pop y and x, push x == y, x < y or x > y, and
+// jump back to the address in R15. lt and gt share the code which compares x and y, which jumps back to the address
+// in R14 to test the result.
+void parse_shared_routines(char *dest) {
+    strcat(dest, "// Shared call routine\n"
+                 "(shared$call)\n"
+                 "@SP // Push call frame to stack\n"
+                 "A=M\n"
+                 "M=D\n"
+                 "@LCL\n"
+                 "D=M\n"
+                 "@SP\n"
+                 "A=M+1\n"
+                 "M=D\n"
+                 "@ARG\n"
+                 "D=M\n"
+                 "@SP\n"
+                 "A=M+1\n"
+                 "A=A+1\n"
+                 "M=D\n"
+                 "@THIS\n"
+                 "D=M\n"
+                 "@SP\n"
+                 "A=M+1\n"
+                 "A=A+1\n"
+                 "A=A+1\n"
+                 "M=D\n"
+                 "@THAT\n"
+                 "D=M\n"
+                 "@SP\n"
+                 "A=M+1\n"
+                 "A=A+1\n"
+                 "A=A+1\n"
+                 "A=A+1\n"
+                 "M=D\n"
+                 "D=A+1 // Update LCL\n"
+                 "@LCL\n"
+                 "M=D\n"
+                 "@SP // Update ARG\n"
+                 "D=M\n"
+                 "@R14\n"
+                 "D=D-M\n"
+                 "@ARG\n"
+                 "M=D\n"
+                 "@R13 // Jump to function\n"
+                 "A=M\n"
+                 "0;JMP\n"
+                 "// Shared comparison routines\n"
+                 "(shared$eq)\n"
+                 "@SP\n"
+                 "AM=M-1\n"
+                 "D=M\n"
+                 "A=A-1\n"
+                 "D=M-D\n"
+                 "M=-1\n"
+                 "@shared$compared\n"
+                 "D;JEQ\n"
+                 "@shared$false\n"
+                 "0;JMP\n"
+                 "(shared$lt)\n"
+                 "@shared$less\n"
+                 "D=A\n"
+                 "@shared$compare\n"
+                 "0;JMP\n"
+                 "(shared$gt)\n"
+                 "@shared$greater\n"
+                 "D=A\n"
+                 "(shared$compare) // Like compare_top_two, but D is the address to go on to\n"
+                 "@R14\n"
+                 "M=D\n"
+                 "@SP\n"
+                 "AM=M-1\n"
+                 "D=M\n"
+                 "A=A-1\n"
+                 "D=D|M\n"
+                 "@shared$subtract\n"
+                 "D;JGE\n"
+                 "@SP\n"
+                 "A=M\n"
+                 "D=M\n"
+                 "A=A-1\n"
+                 "D=D&M\n"
+                 "@shared$subtract\n"
+                 "D;JLT\n"
+                 "@SP\n"
+                 "A=M-1\n"
+                 "D=M\n"
+                 "@shared$test\n"
+                 "D;JLT\n"
+                 "D=1\n"
+                 "@shared$test\n"
+                 "0;JMP\n"
+                 "(shared$subtract)\n"
+                 "@SP\n"
+                 "A=M\n"
+                 "D=M\n"
+                 "A=A-1\n"
+                 "D=M-D\n"
+                 "(shared$test)\n"
+                 "@SP\n"
+                 "A=M-1\n"
+                 "M=-1\n"
+                 "@R14\n"
+                 "A=M\n"
+                 "0;JMP\n"
+                 "(shared$less)\n"
+                 "@shared$compared\n"
+                 "D;JLT\n"
+                 "@shared$false\n"
+                 "0;JMP\n"
+                 "(shared$greater)\n"
+                 "@shared$compared\n"
+                 "D;JGT\n"
+                 "(shared$false)\n"
+                 "@SP\n"
+                 "A=M-1\n"
+                 "M=0\n"
+                 "(shared$compared)\n"
+                 "@R15\n"
+                 "A=M\n"
+                 "0;JMP\n"
+                 "// Shared return routine\n"
+                 "(shared$return)\n");
+    parse_return(false, dest);
+}
+
+// Appends assembly code for "call [name] [args], return" into dest. Rather than building a new frame on top of ours, the
+// callee takes over our frame, so that it returns straight to our caller. We slide the callee's arguments down so they
+// start at ARG, which is safe to do one word at a time from the bottom up since everything moves downwards. If the
+// callee has as many arguments as we do (e.g. in a recursive call), our saved frame (return address, LCL, ARG, THIS,
+// THAT) is already where the callee needs it. Otherwise we first copy the frame to the top of the stack just above
+// the arguments, so it slides down along with them. Either way ARG is already right for the callee, and LCL goes just
+// after the frame.
+void parse_tail_call(char *filename, char *name, int args, char *dest) {
+    char code[1000+4*MAX_LINE_LENGTH] = "";
+    char function_label[MAX_LINE_LENGTH] = "";
+    get_function_label(name, function_label);
+    char move_label[MAX_LINE_LENGTH] = "";
+    get_next_label_name(filename, move_label);
+    char loop_label[MAX_LINE_LENGTH] = "";
+    get_next_label_name(filename, loop_label);
+    char end_label[MAX_LINE_LENGTH] = "";
+    get_next_label_name(filename, end_label);
+
+    sprintf(code, "// Tail call\n"
+                  "@%d // R15 counts the words left to move\n"
+                  "D=A\n"
+                  "@R15\n"
+                  "M=D\n"
+                  "@ARG // Check whether the frame is already in place, i.e. LCL == ARG+%d\n"
+                  "D=M\n"
+                  "@%d\n"
+                  "D=D+A\n"
+                  "@LCL\n"
+                  "D=D-M\n"
+                  "@%s\n"
+                  "D;JEQ\n", args, args+5, args+5, move_label);
+    strcat(dest, code);
+    for (int i=0; i<5; i++) {
+        sprintf(code, "@%d\n"
+                      "D=A\n"
+                      "@LCL\n"
+                      "A=M-D\n"
+                      "D=M\n"
+                      "@SP\n"
+                      "A=M\n", 5-i);
+        strcat(dest, code);
+        for (int j=0; j<i; j++) {
+            strcat(dest, "A=A+1\n");
+        }
+        strcat(dest, "M=D\n");
+    }
+    sprintf(code, "@5\n"
+                  "D=A\n"
+                  "@R15\n"
+                  "M=M+D\n"
+                  "(%s)\n"
+                  "@SP // R14 points to the next word to move\n"
                   "D=M\n"
                   "@%d\n"
                   "D=D-A\n"
-
-                  "@ARG\n"
+                  "@R14\n"
                   "M=D\n"
-                  "@%s // Jump to function\n"
+                  "@ARG // R13 points to where it goes\n"
+                  "D=M\n"
+                  "@R13\n"
+                  "M=D\n"
+                  "(%s)\n"
+                  "@R15\n"
+                  "MD=M-1\n"
+                  "@%s\n"
+                  "D;JLT\n"
+                  "@R14\n"
+                  "AM=M+1\n"
+                  "A=A-1\n"
+                  "D=M\n"
+                  "@R13\n"
+                  "AM=M+1\n"
+                  "A=A-1\n"
+                  "M=D\n"
+                  "@%s\n"
                   "0;JMP\n"
-                  "(%s) // Return label\n", return_label, args->value.int_val, function_label, return_label);
+                  "(%s)\n"
+                  "@ARG // Update LCL\n"
+                  "D=M\n"
+                  "@%d\n"
+                  "D=D+A\n"
+                  "@LCL\n"
+                  "M=D\n"
+                  "@%s // Jump to function\n"
+                  "0;JMP\n", move_label, args, loop_label, end_label, loop_label, end_label, args+5,
+            function_label);
     strcat(dest, code);
 }
 
-void parse_function(char *filename, Token *name, Token *local_vars, char *dest) {
+void parse_function(char *filename, char *name, int local_vars, char *dest) {
     char code[500+4*MAX_LINE_LENGTH] = "";
     char loop_start_label[MAX_LINE_LENGTH] = "";
     get_next_label_name(filename, loop_start_label);
     char loop_end_label[MAX_LINE_LENGTH] = "";
     get_next_label_name(filename, loop_end_label);
     char function_label[MAX_LINE_LENGTH] = "";
-    get_function_label(name->value.str_val, function_label);
+    get_function_label(name, function_label);
     sprintf(code, "// Function\n"
                   "(%s) // Function label\n"
                   "@R13 // Initialise local segment via loop\n"
@@ -852,12 +2137,14 @@ void parse_function(char *filename, Token *name, Token *local_vars, char *dest)
                   "@LCL\n"
                   "D=M+D\n"
                   "@SP\n"
-                  "M=D\n", function_label, loop_start_label, local_vars->value.int_val, loop_end_label,
-            loop_start_label, loop_end_label, local_vars->value.int_val);
+                  "M=D\n", function_label, loop_start_label, local_vars, loop_end_label,
+            loop_start_label, loop_end_label, local_vars);
     strcat(dest, code);
 }
 
-void parse_return(char *dest) {
+// Appends assembly code for "return" into dest. If lean is true, THIS and THAT are left as they are rather than being
+// restored from the frame, and the return value is left in D as well (see instruction.h).
+void parse_return(bool lean, char *dest) {
     strcat(dest, "// Return\n"
                  "@5 // Store return address in R13\n"
                  "D=A\n"
@@ -874,19 +2161,21 @@ void parse_return(char *dest) {
                  "M=D\n"
                  "D=A+1 // Update SP\n"
                  "@SP\n"
-                 "M=D\n"
-                 "@LCL // Restore THAT\n"
-                 "A=M-1\n"
-                 "D=M\n"
-                 "@THAT\n"
-                 "M=D\n"
-                 "@LCL // Restore THIS\n"
-                 "A=M-1\n"
-                 "A=A-1\n"
-                 "D=M\n"
-                 "@THIS\n"
-                 "M=D\n"
-                 "@3 // Restore ARG\n"
+                 "M=D\n");
+    if (!lean) {
+        strcat(dest, "@LCL // Restore THAT\n"
+                     "A=M-1\n"
+                     "D=M\n"
+                     "@THAT\n"
+                     "M=D\n"
+                     "@LCL // Restore THIS\n"
+                     "A=M-1\n"
+                     "A=A-1\n"
+                     "D=M\n"
+                     "@THIS\n"
+                     "M=D\n");
+    }
+    strcat(dest, "@3 // Restore ARG\n"
                  "D=A\n"
                  "@LCL\n"
                  "A=M-D\n"
@@ -899,19 +2188,81 @@ void parse_return(char *dest) {
                  "A=M-D\n"
                  "D=M\n"
                  "@LCL\n"
-                 "M=D\n"
-                 "@R13 // Jump to return address\n"
+                 "M=D\n");
+    if (lean) {
+        strcat(dest, "@SP // Load return value into D\n"
+                     "A=M-1\n"
+                     "D=M\n");
+    }
+    strcat(dest, "@R13 // Jump to return address\n"
                  "A=M\n"
                  "0;JMP\n");
 }
 
-// Puts a label name of the form auto$[filename]$[number] into dest, where [number] is unique to the file.
-// Labels with names specified directly in VM code are translated into the form manual$[filename]$[label_name], so
-// there's no danger of duplication.
+// Append assembly code which discards the top count values on the stack into dest. This is free unless it takes sp_lag
+// past MAX_SP_LAG, in which case we sync SP, and that's cheaper in one go with D.
+void parse_drop(int count, char *dest) {
+    char code[200] = "";
+    strcat(dest, "// Drop\n");
+    sp_lag -= count;
+    if (sp_lag < -MAX_SP_LAG) {
+        sprintf(code, "@%d\n"
+                      "D=A\n"
+                      "@SP\n"
+                      "M=M-D\n", -sp_lag);
+        strcat(dest, code);
+        sp_lag = 0;
+    }
+}
+
+// Append assembly code which loads the address offset places above the real top of the stack (see sp_lag) into A,
+// without changing D. So offset 0 is the first free slot and offset -1 is the value on top of the stack.
+void load_stack_address(int offset, char *dest) {
+    int from_sp = sp_lag + offset;
+    strcat(dest, "@SP\n");
+    if (from_sp == 0) {
+        strcat(dest, "A=M\n");
+    } else {
+        strcat(dest, (from_sp > 0) ? "A=M+1\n" : "A=M-1\n");
+        for (int i=1; i<abs(from_sp); i++) {
+            strcat(dest, (from_sp > 0) ? "A=A+1\n" : "A=A-1\n");
+        }
+    }
+}
+
+// Append assembly code which writes the real stack pointer (see sp_lag) back to SP in RAM into dest, without changing
+// D.
+void sync_stack_pointer(char *dest) {
+    if (sp_lag == 0) {
+        return;
+    }
+    strcat(dest, "@SP\n");
+    for (int i=0; i<abs(sp_lag); i++) {
+        strcat(dest, (sp_lag > 0) ? "M=M+1\n" : "M=M-1\n");
+    }
+    sp_lag = 0;
+}
+
+// Starts numbering made-up labels from 0 again, for the function called function_name in file filename, or for code
+// in filename outside any function if function_name is NULL.
+void set_label_scope(char *filename, char *function_name) {
+    if (function_name == NULL) {
+        sprintf(label_scope, "%.*s", MAX_SCOPE_NAME, filename);
+    } else {
+        sprintf(label_scope, "%.*s$%.*s", MAX_SCOPE_NAME, filename, MAX_SCOPE_NAME, function_name);
+    }
+    label_count = 0;
+}
+
+// Puts a new label name of the form auto$[file]$[function]$[n] into dest (see label_scope). The filename argument is
+// only used if no scope has been set yet. Labels with names specified directly in VM code are translated into the form
+// manual$[filename]$[label_name], so there's no danger of duplication.
 void get_next_label_name(char *filename, char *dest) {
-    static int label_count = 0;
+    if (label_scope[0] == '\0') {
+        set_label_scope(filename, NULL);
+    }
     char buffer[MAX_LINE_LENGTH] = "";
-    sprintf(buffer, "auto$%s$%d", filename, label_count);
+    sprintf(buffer, "auto$%s$%d", label_scope, label_count);
     strcat(dest, buffer);
     label_count++;
 }
@@ -0,0 +1,1103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "optimiser.h"
+
+// Only variables with an index below this are tracked by constant propagation. Jack code rarely has more locals than
+// this, and keeping the table small makes forgetting everything at a label cheap.
+#define MAX_TRACKED_INDEX 16
+
+// known[segment][index] is true if we know for certain that the given variable currently holds value[segment][index].
+struct KnownValues {
+    bool known[NUM_KWS][MAX_TRACKED_INDEX];
+    int value[NUM_KWS][MAX_TRACKED_INDEX];
+}; typedef struct KnownValues KnownValues;
+
+bool is_constant_push(const Instruction *instruction);
+bool is_tracked(const Instruction *instruction);
+void forget_all(KnownValues *values);
+int apply_binary(Keyword command, int x, int y);
+int apply_unary(Keyword command, int x);
+bool is_no_op(const Instruction *instruction);
+bool is_inlinable(const InstructionList *code, const FunctionInfo *function, int args, int threshold);
+bool pops_pointer(const InstructionList *code, const FunctionInfo *function, int pointer);
+void inline_call(VMFile *files, const FunctionInfo *function, int args, InstructionList *dest);
+int stack_effect(const Instruction *instruction);
+void remove_instructions(InstructionList *list, int start, int end);
+int find_label(const InstructionList *list, const char *label);
+int count_jumps_to(const InstructionList *list, const char *label);
+const char *resolve_jump(const InstructionList *list, const char *label);
+bool ends_block(const Instruction *instruction);
+long *get_block_counts(const VMFile *file, const Profile *profile);
+int find_file(const VMFile *files, int no_files, const char *filename);
+bool calls_back(const VMFile *files, const FunctionTable *functions, int function);
+void add_static_frame_entry(InstructionList *dest, const Instruction *function, int address, const int *arg_addresses,
+                            int no_args);
+
+void fold_constants(InstructionList *list) {
+    Instruction *array = list->list_array;
+    KnownValues values;
+    forget_all(&values);
+
+    // We compact the list as we go: array[0..length-1] holds the optimised version of everything before array[i].
+    // Since every instruction turns into at most one instruction, we never overwrite anything we haven't read yet.
+    int length = 0;
+    for (int i=0; i<list->list_length; i++) {
+        Instruction current = array[i];
+        Instruction *last = (length >= 1) ? &array[length-1] : NULL;
+        Instruction *second_last = (length >= 2) ? &array[length-2] : NULL;
+
+        switch (current.command) {
+            case PUSH:
+                // Constant propagation: pushing a variable we know the value of is the same as pushing that value.
+                if (is_tracked(&current) && values.known[current.segment][current.index]) {
+                    current.index = values.value[current.segment][current.index];
+                    current.segment = CONSTANT;
+                }
+                break;
+
+            case POP:
+                // Popping into this or that might overwrite any variable (since THIS and THAT could point anywhere),
+                // so in that case forget everything. Otherwise we only forget the variable we're popping into.
+                if (current.segment == KW_THIS || current.segment == THAT) {
+                    forget_all(&values);
+                } else if (is_tracked(&current)) {
+                    values.known[current.segment][current.index] = false;
+                }
+                // (Popping the constant into stack 0 would just throw it away again, so we leave that alone.)
+                if (is_constant_push(last) && !(current.segment == STACK && current.index == 0)) {
+                    current.immediate = true;
+                    current.constant = last->index;
+                    length--;
+                    if (current.segment == STACK) {
+                        current.index--; // The stack is one value shorter now that the push has gone.
+                    }
+                    if (is_tracked(&current)) {
+                        values.known[current.segment][current.index] = true;
+                        values.value[current.segment][current.index] = current.constant;
+                    }
+                }
+                break;
+
+            case ADD:
+            case SUB:
+            case AND:
+            case OR:
+            case EQ:
+            case GT:
+            case LT:
+                if (is_constant_push(last) && is_constant_push(second_last)) {
+                    // Both operands are constants, so replace all three instructions with a single push.
+                    second_last->index = apply_binary(current.command, second_last->index, last->index);
+                    length--;
+                    continue;
+                }
+                if (is_constant_push(last)) {
+                    current.immediate = true;
+                    current.constant = last->index;
+                    length--;
+                    last = second_last;
+
+                    // "add 3, sub 1" is the same as "add 2". Since add and sub are the only commands we merge like
+                    // this, we can treat sub c as add -c.
+                    if ((current.command == ADD || current.command == SUB) && last != NULL && last->immediate &&
+                            (last->command == ADD || last->command == SUB)) {
+                        int total = (last->command == ADD) ? last->constant : -(last->constant);
+                        total += (current.command == ADD) ? current.constant : -(current.constant);
+                        last->command = ADD;
+                        last->constant = to_word(total);
+                        if (is_no_op(last)) {
+                            length--;
+                        }
+                        continue;
+                    }
+                    if (is_no_op(&current)) {
+                        continue;
+                    }
+                }
+                break;
+
+            case NEG:
+            case NOT:
+                if (is_constant_push(last)) {
+                    last->index = apply_unary(current.command, last->index);
+                    continue;
+                }
+                break;
+
+            case DROP:
+                break;
+
+            case IFGOTO:
+                // Fuse "[comparison], if-goto" and "[comparison], not, if-goto" into a single instruction, so that we
+                // never have to put the result of the comparison on the stack. A lone "not, if-goto" jumps unless the
+                // top value is -1 (not is bitwise, so this isn't the same as jumping if it's 0), which is the same as
+                // "push constant -1, eq, not, if-goto".
+                if (last != NULL && last->command == NOT) {
+                    current.index = 1;
+                    length--;
+                    last = second_last;
+                    if (last != NULL && (last->command == EQ || last->command == GT || last->command == LT)) {
+                        current.segment = last->command;
+                        current.immediate = last->immediate;
+                        current.constant = last->constant;
+                        length--;
+                    } else {
+                        current.segment = EQ;
+                        current.immediate = true;
+                        current.constant = -1;
+                    }
+                } else if (last != NULL && (last->command == EQ || last->command == GT || last->command == LT)) {
+                    current.segment = last->command;
+                    current.index = 0;
+                    current.immediate = last->immediate;
+                    current.constant = last->constant;
+                    length--;
+                }
+                forget_all(&values);
+                break;
+
+            case FUNCTION:
+                // The function's code will initialise all its local variables to 0.
+                forget_all(&values);
+                for (int j=0; j<current.index && j<MAX_TRACKED_INDEX; j++) {
+                    values.known[LOCAL][j] = true;
+                    values.value[LOCAL][j] = 0;
+                }
+                break;
+
+            default:
+                // Anything else starts or ends a basic block: we could have jumped to a label from anywhere, and a
+                // call could change any static variable (or anything else via THIS and THAT).
+                forget_all(&values);
+        }
+        array[length] = current;
+        length++;
+    }
+    list->list_length = length;
+}
+
+int simplify_jumps(InstructionList *list) {
+    int original_length = list->list_length;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        Instruction *array = list->list_array;
+        // Whenever we remove instructions, we look at the one before again, since e.g. removing a label can make the
+        // code after an earlier goto unreachable.
+        for (int i=0; i<list->list_length; i++) {
+            Instruction *current = &array[i];
+
+            // "push constant c, if-goto L" always jumps unless c is 0, and never jumps if it is.
+            if (current->command == IFGOTO && current->segment == CONSTANT && i > 0 &&
+                    is_constant_push(&array[i-1]) && !array[i-1].immediate) {
+                if (array[i-1].index != 0) {
+                    array[i-1].command = GOTO;
+                    array[i-1].index = 0;
+                    array[i-1].name = current->name;
+                    current->name = NULL;
+                    remove_instructions(list, i, i+1);
+                } else {
+                    remove_instructions(list, i-1, i+1);
+                }
+                changed = true;
+                i = (i >= 2) ? i-3 : -1;
+                continue;
+            }
+
+            if (current->command == GOTO || current->command == IFGOTO) {
+                // Jump threading: go straight to wherever the label's code would jump to anyway.
+                const char *target = resolve_jump(list, current->name);
+                if (strcmp(target, current->name) != 0) {
+                    char *name = (char *)malloc(strlen(target)+1);
+                    strcpy(name, target);
+                    free(current->name);
+                    current->name = name;
+                    changed = true;
+                }
+
+                // A jump to a label straight after it does nothing but pop its condition (if it's an if-goto).
+                int next = i+1;
+                while (next < list->list_length && array[next].command == LABEL &&
+                       strcmp(array[next].name, current->name) != 0) {
+                    next++;
+                }
+                if (next < list->list_length && array[next].command == LABEL) {
+                    if (current->command == IFGOTO) {
+                        current->index = -stack_effect(current);
+                        current->command = DROP;
+                        current->segment = CONSTANT;
+                        current->immediate = false;
+                        free(current->name);
+                        current->name = NULL;
+                    } else {
+                        remove_instructions(list, i, i+1);
+                        i = (i >= 1) ? i-2 : -1;
+                    }
+                    changed = true;
+                    continue;
+                }
+            }
+
+            // "if-goto L, goto M, label L" is the same as jumping to M unless the condition holds. We can only flip
+            // the condition once it's been fused with its comparison (see instruction.h), since a plain if-goto has no
+            // opposite.
+            if (current->command == IFGOTO && current->segment != CONSTANT && i+2 < list->list_length &&
+                    array[i+1].command == GOTO && array[i+2].command == LABEL &&
+                    strcmp(array[i+2].name, current->name) == 0) {
+                free(current->name);
+                current->name = array[i+1].name;
+                current->index = 1 - current->index;
+                array[i+1].name = NULL;
+                remove_instructions(list, i+1, i+2);
+                changed = true;
+                i--;
+                continue;
+            }
+
+            // Where several labels are in a row, jump to the first one so that the rest can be removed.
+            if (current->command == LABEL && i+1 < list->list_length && array[i+1].command == LABEL) {
+                for (int j=0; j<list->list_length; j++) {
+                    if ((array[j].command == GOTO || array[j].command == IFGOTO) &&
+                            strcmp(array[j].name, array[i+1].name) == 0) {
+                        char *name = (char *)malloc(strlen(current->name)+1);
+                        strcpy(name, current->name);
+                        free(array[j].name);
+                        array[j].name = name;
+                        changed = true;
+                    }
+                }
+            }
+
+            // Nothing can reach the code after a goto or return until the next label or function.
+            if (ends_block(current)) {
+                int end = i+1;
+                while (end < list->list_length && array[end].command != LABEL && array[end].command != FUNCTION) {
+                    end++;
+                }
+                if (end > i+1) {
+                    remove_instructions(list, i+1, end);
+                    changed = true;
+                }
+            }
+
+            if (current->command == LABEL && count_jumps_to(list, current->name) == 0) {
+                remove_instructions(list, i, i+1);
+                changed = true;
+                i = (i >= 1) ? i-2 : -1;
+            }
+        }
+    }
+    return original_length - list->list_length;
+}
+
+int to_word(int value) {
+    value &= 0xFFFF;
+    return (value >= 0x8000) ? value - 0x10000 : value;
+}
+
+// Returns true if instruction is a "push constant" (and not NULL).
+bool is_constant_push(const Instruction *instruction) {
+    return instruction != NULL && instruction->command == PUSH && instruction->segment == CONSTANT;
+}
+
+// Returns true if constant propagation keeps track of the value of the variable the given push or pop refers to.
+// Static variables inlined from another file (i.e. with a name) aren't tracked, since they'd clash with our own.
+bool is_tracked(const Instruction *instruction) {
+    Keyword segment = instruction->segment;
+    int index = instruction->index;
+    if (segment == STATIC && instruction->name != NULL) {
+        return false;
+    }
+    return (segment == LOCAL || segment == ARGUMENT || segment == STATIC || segment == TEMP) &&
+           index >= 0 && index < MAX_TRACKED_INDEX;
+}
+
+void forget_all(KnownValues *values) {
+    memset(values->known, 0, sizeof(values->known));
+}
+
+// Returns the result of "push constant x, push constant y, [command]" as a VM value (so true is -1).
+int apply_binary(Keyword command, int x, int y) {
+    switch (command) {
+        case ADD: return to_word(x + y);
+        case SUB: return to_word(x - y);
+        case AND: return to_word(x & y);
+        case OR:  return to_word(x | y);
+        case EQ:  return (to_word(x) == to_word(y)) ? -1 : 0;
+        case GT:  return (to_word(x) > to_word(y)) ? -1 : 0;
+        case LT:  return (to_word(x) < to_word(y)) ? -1 : 0;
+        default: printf("Error: apply_binary called on a non-binary command.\n"); exit(EXIT_FAILURE);
+    }
+}
+
+// Returns the result of "push constant x, [command]".
+int apply_unary(Keyword command, int x) {
+    switch (command) {
+        case NEG: return to_word(-x);
+        case NOT: return to_word(~x);
+        default: printf("Error: apply_unary called on a non-unary command.\n"); exit(EXIT_FAILURE);
+    }
+}
+
+// Returns true if the given immediate instruction leaves the stack exactly as it found it, e.g. "add 0" or "and -1".
+bool is_no_op(const Instruction *instruction) {
+    switch (instruction->command) {
+        case ADD:
+        case SUB:
+        case OR:  return instruction->constant == 0;
+        case AND: return instruction->constant == -1;
+        default:  return false;
+    }
+}
+
+int inline_functions(VMFile *files, int no_files, const Profile *profile, InlineReport **reports) {
+    FunctionTable *functions = find_functions(files, no_files);
+
+    // reports[i] describes function i in the table; we squash out the functions we didn't inline at the end.
+    InlineReport *results = (InlineReport *)malloc((functions->table_length + 1) * sizeof(InlineReport));
+    for (int i=0; i<functions->table_length; i++) {
+        results[i].call_sites = 0;
+    }
+
+    // The function table refers to the original instruction lists, so we keep them intact until every file is done.
+    InstructionList **new_lists = (InstructionList **)malloc(no_files * sizeof(InstructionList *));
+    for (int i=0; i<no_files; i++) {
+        InstructionList *old = files[i].instructions;
+        long *counts = (profile == NULL) ? NULL : get_block_counts(&(files[i]), profile);
+        new_lists[i] = malloc_instruction_list();
+        for (int j=0; j<old->list_length; j++) {
+            Instruction *current = &(old->list_array[j]);
+            int function = (current->command == CALL) ? get_function(functions, current->name) : -1;
+            int threshold = INLINE_THRESHOLD;
+            if (counts != NULL && counts[j] * COLD_FRACTION < profile->max_count) {
+                threshold = -1;
+            } else if (counts != NULL && counts[j] * HOT_FRACTION >= profile->max_count) {
+                threshold = HOT_INLINE_THRESHOLD;
+            }
+            if (function == -1 || current->shared || !is_inlinable(files[functions->table_array[function].file].instructions,
+                                                &(functions->table_array[function]), current->index, threshold)) {
+                copy_instruction(new_lists[i], current);
+                continue;
+            }
+
+            int inline_start = new_lists[i]->list_length;
+            inline_call(files, &(functions->table_array[function]), current->index, new_lists[i]);
+
+            InlineReport *result = &(results[function]);
+            if (result->call_sites == 0) {
+                FunctionInfo *info = &(functions->table_array[function]);
+                InstructionList *code = files[info->file].instructions;
+                result->name = malloc(strlen(info->name)+1);
+                strcpy(result->name, info->name);
+                result->args = current->index;
+                result->function_code = malloc_instruction_list();
+                for (int k=info->start; k<info->end; k++) {
+                    copy_instruction(result->function_code, &(code->list_array[k]));
+                }
+                result->inlined_code = malloc_instruction_list();
+                for (int k=inline_start; k<new_lists[i]->list_length; k++) {
+                    copy_instruction(result->inlined_code, &(new_lists[i]->list_array[k]));
+                }
+            }
+            result->call_sites++;
+        }
+        free(counts);
+    }
+
+    for (int i=0; i<no_files; i++) {
+        free_instruction_list(files[i].instructions);
+        files[i].instructions = new_lists[i];
+    }
+    free(new_lists);
+
+    int no_reports = 0;
+    for (int i=0; i<functions->table_length; i++) {
+        if (results[i].call_sites > 0) {
+            results[no_reports] = results[i];
+            no_reports++;
+        }
+    }
+    free_function_table(functions);
+    *reports = results;
+    return no_reports;
+}
+
+void free_inline_reports(InlineReport *reports, int no_reports) {
+    for (int i=0; i<no_reports; i++) {
+        free(reports[i].name);
+        free_instruction_list(reports[i].function_code);
+        free_instruction_list(reports[i].inlined_code);
+    }
+    free(reports);
+}
+
+// Returns true if calls to the given function with the given number of arguments can be inlined. The function must be
+// at most threshold instructions long (not counting function and return), must end in its only return, must not call
+// anything or use labels (which would clash with the caller's), must not use arguments it isn't given, and must never
+// pop more than it has pushed.
+bool is_inlinable(const InstructionList *code, const FunctionInfo *function, int args, int threshold) {
+    if (function->end - function->start - 2 > threshold || code->list_array[function->end-1].command != RETURN) {
+        return false;
+    }
+    int depth = 0;
+    for (int i=function->start+1; i<function->end-1; i++) {
+        const Instruction *current = &(code->list_array[i]);
+        switch (current->command) {
+            case LABEL: case GOTO: case IFGOTO: case FUNCTION: case CALL: case RETURN:
+                return false;
+            case PUSH:
+            case POP:
+                if (current->segment == STACK || current->index < 0 ||
+                        (current->segment == ARGUMENT && current->index >= args) ||
+                        (current->segment == LOCAL && current->index >= function->locals)) {
+                    return false;
+                }
+                break;
+            default:
+                break;
+        }
+        depth += stack_effect(current);
+        if (depth < 0) {
+            return false;
+        }
+    }
+    return depth >= 1;
+}
+
+// Returns true if the given function pops anything into pointer 0 (if pointer is 0) or pointer 1 (if pointer is 1).
+bool pops_pointer(const InstructionList *code, const FunctionInfo *function, int pointer) {
+    for (int i=function->start+1; i<function->end; i++) {
+        const Instruction *current = &(code->list_array[i]);
+        if (current->command == POP && current->segment == POINTER && current->index == pointer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds an inlined copy of the given function to the end of dest, to replace a call with args arguments. Everything the
+// function would keep in its own frame lives on the stack instead: first the arguments (which the caller has already
+// pushed), then the locals, then the old values of THIS and THAT if the function changes them. We refer to all of these
+// with the stack segment, keeping track of how deep the stack is at each point. At the end, the return value is moved
+// down to where the first argument was and everything above it is dropped, exactly as a real return would.
+void inline_call(VMFile *files, const FunctionInfo *function, int args, InstructionList *dest) {
+    const InstructionList *code = files[function->file].instructions;
+    int depth = 0; // The number of values on the stack above the arguments.
+    int saved_pointer[2] = {-1, -1}; // Where the old values of THIS and THAT are, counting from the first argument.
+
+    for (int i=0; i<function->locals; i++) {
+        add_instruction(dest, PUSH, CONSTANT, 0, NULL);
+        depth++;
+    }
+    for (int pointer=0; pointer<2; pointer++) {
+        if (pops_pointer(code, function, pointer)) {
+            saved_pointer[pointer] = args + depth;
+            add_instruction(dest, PUSH, POINTER, pointer, NULL);
+            depth++;
+        }
+    }
+
+    for (int i=function->start+1; i<function->end-1; i++) {
+        const Instruction *current = &(code->list_array[i]);
+        copy_instruction(dest, current);
+        Instruction *copy = &(dest->list_array[dest->list_length-1]);
+        if (copy->command == PUSH || copy->command == POP) {
+            if (copy->segment == ARGUMENT) {
+                copy->segment = STACK;
+                copy->index = args + depth - 1 - copy->index;
+            } else if (copy->segment == LOCAL) {
+                copy->segment = STACK;
+                copy->index = depth - 1 - copy->index;
+            } else if (copy->segment == STATIC && copy->name == NULL) {
+                copy->name = malloc(strlen(files[function->file].filename)+1);
+                strcpy(copy->name, files[function->file].filename);
+            }
+        }
+        depth += stack_effect(current);
+    }
+
+    for (int pointer=0; pointer<2; pointer++) {
+        if (saved_pointer[pointer] != -1) {
+            add_instruction(dest, PUSH, STACK, args + depth - 1 - saved_pointer[pointer], NULL);
+            add_instruction(dest, POP, POINTER, pointer, NULL);
+        }
+    }
+    if (args + depth - 1 > 0) {
+        add_instruction(dest, POP, STACK, args + depth - 1, NULL);
+        depth--;
+        if (args + depth - 1 > 0) {
+            add_instruction(dest, DROP, CONSTANT, args + depth - 1, NULL);
+        }
+    }
+}
+
+// Returns the change in the number of values on the stack caused by the given instruction, ignoring function calls.
+int stack_effect(const Instruction *instruction) {
+    switch (instruction->command) {
+        case PUSH:
+            return 1;
+        case POP:
+        case ADD: case SUB: case AND: case OR: case EQ: case GT: case LT:
+            return instruction->immediate ? 0 : -1;
+        case DROP:
+            return -(instruction->index);
+        case IFGOTO:
+            return (instruction->segment == CONSTANT || instruction->immediate) ? -1 : -2;
+        default:
+            return 0;
+    }
+}
+
+int remove_unreachable_functions(VMFile *files, int no_files, int *instructions_removed) {
+    FunctionTable *functions = find_functions(files, no_files);
+    *instructions_removed = 0;
+    int start = get_function(functions, "Sys.init");
+    if (start == -1) {
+        free_function_table(functions);
+        return 0;
+    }
+
+    // Search the call graph from Sys.init. to_visit is a stack of functions we've reached but not yet scanned for
+    // calls; each function goes on it at most once, so it never needs more space than there are functions.
+    bool *reachable = (bool *)calloc(functions->table_length, sizeof(bool));
+    int *to_visit = (int *)malloc(functions->table_length * sizeof(int));
+    int no_to_visit = 1;
+    to_visit[0] = start;
+    reachable[start] = true;
+    while (no_to_visit > 0) {
+        no_to_visit--;
+        FunctionInfo *function = &(functions->table_array[to_visit[no_to_visit]]);
+        InstructionList *code = files[function->file].instructions;
+        for (int i=function->start; i<function->end; i++) {
+            if (code->list_array[i].command != CALL) {
+                continue;
+            }
+            int callee = get_function(functions, code->list_array[i].name);
+            if (callee != -1 && !reachable[callee]) {
+                reachable[callee] = true;
+                to_visit[no_to_visit] = callee;
+                no_to_visit++;
+            }
+        }
+    }
+
+    // Remove functions from the end of each file backwards, so the indices of the ones still to go don't change.
+    int removed = 0;
+    for (int i=functions->table_length-1; i>=0; i--) {
+        if (!reachable[i]) {
+            FunctionInfo *function = &(functions->table_array[i]);
+            remove_instructions(files[function->file].instructions, function->start, function->end);
+            *instructions_removed += function->end - function->start;
+            removed++;
+        }
+    }
+
+    free(reachable);
+    free(to_visit);
+    free_function_table(functions);
+    return removed;
+}
+
+// Returns i such that list->list_array[i] is "label [label]", or -1 if there's no such label in list.
+int find_label(const InstructionList *list, const char *label) {
+    for (int i=0; i<list->list_length; i++) {
+        if (list->list_array[i].command == LABEL && strcmp(list->list_array[i].name, label) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the number of gotos and if-gotos in list which jump to label.
+int count_jumps_to(const InstructionList *list, const char *label) {
+    int count = 0;
+    for (int i=0; i<list->list_length; i++) {
+        const Instruction *current = &(list->list_array[i]);
+        if ((current->command == GOTO || current->command == IFGOTO) && strcmp(current->name, label) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Returns the label a jump to label really ends up at, following any chain of labels whose code is just a goto. Gives
+// up (returning the label reached so far) if the chain loops or leaves list.
+const char *resolve_jump(const InstructionList *list, const char *label) {
+    const char *target = label;
+    for (int steps=0; steps<list->list_length; steps++) {
+        int pos = find_label(list, target);
+        if (pos == -1) {
+            break;
+        }
+        while (pos < list->list_length && list->list_array[pos].command == LABEL) {
+            pos++;
+        }
+        if (pos == list->list_length || list->list_array[pos].command != GOTO ||
+                strcmp(list->list_array[pos].name, target) == 0) {
+            break;
+        }
+        target = list->list_array[pos].name;
+    }
+    return target;
+}
+
+// Returns true if control never falls through from instruction to the one after it.
+bool ends_block(const Instruction *instruction) {
+    return instruction->command == GOTO || instruction->command == RETURN ||
+           (instruction->command == CALL && instruction->segment == RETURN);
+}
+
+// Removes list->list_array[start] to list->list_array[end-1] from list.
+void remove_instructions(InstructionList *list, int start, int end) {
+    for (int i=start; i<end; i++) {
+        free(list->list_array[i].name);
+    }
+    for (int i=end; i<list->list_length; i++) {
+        list->list_array[i - (end-start)] = list->list_array[i];
+    }
+    list->list_length -= end - start;
+}
+
+int convert_tail_calls(InstructionList *list, FILE *report) {
+    Instruction *array = list->list_array;
+    char *function = NULL;
+    int converted = 0;
+
+    // As in fold_constants, array[0..length-1] holds the new version of everything before array[i].
+    int length = 0;
+    for (int i=0; i<list->list_length; i++) {
+        if (array[i].command == FUNCTION) {
+            function = array[i].name;
+        }
+        if (array[i].command == RETURN && length > 0 && array[length-1].command == CALL &&
+                array[length-1].segment != RETURN && array[length-1].lean == array[i].lean && function != NULL &&
+                strcmp(function, "Sys.init") != 0) {
+            array[length-1].segment = RETURN;
+            if (report != NULL) {
+                fprintf(report, "Tail call from %s to %s.\n", function, array[length-1].name);
+            }
+            converted++;
+            continue;
+        }
+        array[length] = array[i];
+        length++;
+    }
+    list->list_length = length;
+    return converted;
+}
+
+int share_functions(VMFile *files, int no_files, char **names, int no_names) {
+    int shared = 0;
+    char *function = NULL;
+    for (int i=0; i<no_files; i++) {
+        InstructionList *list = files[i].instructions;
+        for (int j=0; j<list->list_length; j++) {
+            Instruction *current = &(list->list_array[j]);
+            if (current->command == FUNCTION) {
+                function = NULL;
+                for (int k=0; k<no_names; k++) {
+                    if (strcmp(names[k], current->name) == 0) {
+                        function = current->name;
+                    }
+                }
+            } else if (function != NULL && (current->command == CALL || current->command == RETURN ||
+                                            current->command == EQ || current->command == LT || current->command == GT)) {
+                current->shared = true;
+                shared++;
+            }
+        }
+    }
+    return shared;
+}
+
+int share_cold_calls(VMFile *files, int no_files, const Profile *profile, int *returns_shared) {
+    int calls_shared = 0;
+    *returns_shared = 0;
+    for (int i=0; i<no_files; i++) {
+        InstructionList *list = files[i].instructions;
+        long *counts = get_block_counts(&(files[i]), profile);
+        long function_count = 0;
+        for (int j=0; j<list->list_length; j++) {
+            Instruction *current = &(list->list_array[j]);
+            if (current->command == FUNCTION) {
+                function_count = counts[j];
+            } else if (current->command == CALL && counts[j] * COLD_FRACTION < profile->max_count) {
+                current->shared = true;
+                calls_shared++;
+            } else if (current->command == RETURN && !current->lean &&
+                    function_count * COLD_FRACTION < profile->max_count) {
+                current->shared = true;
+                (*returns_shared)++;
+            }
+        }
+        free(counts);
+    }
+    return calls_shared;
+}
+
+int mark_lean_frames(VMFile *files, int no_files, int *calls_lean) {
+    FunctionTable *functions = find_functions(files, no_files);
+
+    // Start by assuming every function is lean unless it pops to pointer itself, then keep crossing off functions which
+    // call one that isn't until nothing changes. This handles recursion, since a cycle of calls stays lean unless
+    // something in it changes THIS or THAT.
+    bool *lean = (bool *)malloc((functions->table_length + 1) * sizeof(bool));
+    for (int i=0; i<functions->table_length; i++) {
+        FunctionInfo *function = &(functions->table_array[i]);
+        InstructionList *code = files[function->file].instructions;
+        lean[i] = true;
+        for (int j=function->start; j<function->end; j++) {
+            if (code->list_array[j].command == POP && code->list_array[j].segment == POINTER) {
+                lean[i] = false;
+            }
+        }
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i=0; i<functions->table_length; i++) {
+            if (!lean[i]) {
+                continue;
+            }
+            FunctionInfo *function = &(functions->table_array[i]);
+            InstructionList *code = files[function->file].instructions;
+            for (int j=function->start; j<function->end && lean[i]; j++) {
+                if (code->list_array[j].command == CALL) {
+                    int callee = get_function(functions, code->list_array[j].name);
+                    if (callee == -1 || !lean[callee]) {
+                        lean[i] = false;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    int functions_lean = 0;
+    *calls_lean = 0;
+    for (int i=0; i<functions->table_length; i++) {
+        FunctionInfo *function = &(functions->table_array[i]);
+        InstructionList *code = files[function->file].instructions;
+        if (lean[i]) {
+            functions_lean++;
+        }
+        for (int j=function->start; j<function->end; j++) {
+            Instruction *current = &(code->list_array[j]);
+            if (current->command == RETURN) {
+                current->lean = lean[i];
+            } else if (current->command == CALL) {
+                int callee = get_function(functions, current->name);
+                current->lean = (callee != -1 && lean[callee]);
+                if (current->lean) {
+                    (*calls_lean)++;
+                }
+            }
+        }
+    }
+
+    free(lean);
+    free_function_table(functions);
+    return functions_lean;
+}
+
+int allocate_statics(VMFile *files, int no_files, int **words) {
+    // Find which indices each file uses. Static variables in inlined code belong to the file in their name.
+    int *no_indices = (int *)calloc(no_files + 1, sizeof(int));
+    for (int i=0; i<no_files; i++) {
+        InstructionList *list = files[i].instructions;
+        for (int j=0; j<list->list_length; j++) {
+            Instruction *current = &(list->list_array[j]);
+            if ((current->command != PUSH && current->command != POP) || current->segment != STATIC) {
+                continue;
+            }
+            int file = (current->name == NULL) ? i : find_file(files, no_files, current->name);
+            if (file == -1) {
+                printf("Error: Static variable from unknown file %s.", current->name);
+                exit(EXIT_FAILURE);
+            }
+            if (current->index >= no_indices[file]) {
+                no_indices[file] = current->index + 1;
+            }
+        }
+    }
+    int **address = (int **)malloc((no_files + 1) * sizeof(int *));
+    for (int i=0; i<no_files; i++) {
+        address[i] = (int *)malloc((no_indices[i] + 1) * sizeof(int));
+        for (int j=0; j<no_indices[i]; j++) {
+            address[i][j] = -1;
+        }
+    }
+    for (int i=0; i<no_files; i++) {
+        InstructionList *list = files[i].instructions;
+        for (int j=0; j<list->list_length; j++) {
+            Instruction *current = &(list->list_array[j]);
+            if ((current->command == PUSH || current->command == POP) && current->segment == STATIC) {
+                int file = (current->name == NULL) ? i : find_file(files, no_files, current->name);
+                address[file][current->index] = 0; // Used, but not placed yet.
+            }
+        }
+    }
+
+    // Place them, file by file.
+    *words = (int *)malloc((no_files + 1) * sizeof(int));
+    int next_address = FIRST_STATIC_ADDRESS;
+    for (int i=0; i<no_files; i++) {
+        (*words)[i] = 0;
+        for (int j=0; j<no_indices[i]; j++) {
+            if (address[i][j] != -1) {
+                address[i][j] = next_address;
+                next_address++;
+                (*words)[i]++;
+            }
+        }
+    }
+    if (next_address > STACK_BASE) {
+        printf("Error: The program's static variables need %d words of RAM, but only %d are free (addresses %d to "
+               "%d).\n", next_address - FIRST_STATIC_ADDRESS, STACK_BASE - FIRST_STATIC_ADDRESS, FIRST_STATIC_ADDRESS,
+               STACK_BASE - 1);
+        for (int i=0; i<no_files; i++) {
+            if ((*words)[i] > 0) {
+                printf("    %s: %d word%s\n", files[i].filename, (*words)[i], ((*words)[i] == 1) ? "" : "s");
+            }
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i=0; i<no_files; i++) {
+        InstructionList *list = files[i].instructions;
+        for (int j=0; j<list->list_length; j++) {
+            Instruction *current = &(list->list_array[j]);
+            if ((current->command == PUSH || current->command == POP) && current->segment == STATIC) {
+                int file = (current->name == NULL) ? i : find_file(files, no_files, current->name);
+                current->segment = TEMP;
+                current->index = address[file][current->index] - 5;
+                free(current->name);
+                current->name = NULL;
+            }
+        }
+    }
+
+    for (int i=0; i<no_files; i++) {
+        free(address[i]);
+    }
+    free(address);
+    free(no_indices);
+    return next_address;
+}
+
+int allocate_static_frames(VMFile *files, int no_files, int first_address, int *words_used) {
+    FunctionTable *functions = find_functions(files, no_files);
+    int no_functions = functions->table_length;
+
+    // Work out what would go in each function's frame: size[i] words in all, with arg_address[i][j] giving the offset
+    // of argument j in the frame, or -1 if it stays on the stack.
+    int *size = (int *)malloc((no_functions + 1) * sizeof(int));
+    int *no_args = (int *)malloc((no_functions + 1) * sizeof(int));
+    int **arg_address = (int **)malloc((no_functions + 1) * sizeof(int *));
+    for (int i=0; i<no_functions; i++) {
+        FunctionInfo *function = &(functions->table_array[i]);
+        InstructionList *code = files[function->file].instructions;
+        no_args[i] = 0;
+        for (int j=function->start; j<function->end; j++) {
+            Instruction *current = &(code->list_array[j]);
+            if ((current->command == PUSH || current->command == POP) && current->segment == ARGUMENT &&
+                    current->index >= no_args[i]) {
+                no_args[i] = current->index + 1;
+            }
+        }
+        arg_address[i] = (int *)malloc((no_args[i] + 1) * sizeof(int));
+        size[i] = 0;
+        if (calls_back(files, functions, i)) {
+            continue;
+        }
+        size[i] = function->locals;
+        for (int j=0; j<no_args[i]; j++) {
+            int uses = 0;
+            for (int k=function->start; k<function->end; k++) {
+                Instruction *current = &(code->list_array[k]);
+                if ((current->command == PUSH || current->command == POP) && current->segment == ARGUMENT &&
+                        current->index == j) {
+                    uses++;
+                }
+            }
+            arg_address[i][j] = (uses >= STATIC_ARG_USES) ? size[i] : -1;
+            if (uses >= STATIC_ARG_USES) {
+                size[i]++;
+            }
+        }
+    }
+
+    // A function's frame goes just above the frames of everything which might be running when it's called, i.e. the
+    // highest frame of any of its callers. Functions without static frames pass their callers' frames on to their
+    // callees; they can be recursive, but since a cycle of calls never includes a static frame, the offsets in it stop
+    // growing. If anything ends up too high, give up on the largest frame that does and start again.
+    int *offset = (int *)malloc((no_functions + 1) * sizeof(int));
+    while (1) {
+        for (int i=0; i<no_functions; i++) {
+            offset[i] = 0;
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int i=0; i<no_functions; i++) {
+                FunctionInfo *function = &(functions->table_array[i]);
+                InstructionList *code = files[function->file].instructions;
+                for (int j=function->start; j<function->end; j++) {
+                    if (code->list_array[j].command != CALL) {
+                        continue;
+                    }
+                    int callee = get_function(functions, code->list_array[j].name);
+                    if (callee != -1 && offset[callee] < offset[i] + size[i]) {
+                        offset[callee] = offset[i] + size[i];
+                        changed = true;
+                    }
+                }
+            }
+        }
+        int words = 0;
+        int largest = -1;
+        for (int i=0; i<no_functions; i++) {
+            if (offset[i] + size[i] > words) {
+                words = offset[i] + size[i];
+            }
+            if (size[i] > 0 && first_address + offset[i] + size[i] > STACK_BASE &&
+                    (largest == -1 || size[i] > size[largest])) {
+                largest = i;
+            }
+        }
+        if (largest == -1) {
+            *words_used = words;
+            break;
+        }
+        size[largest] = 0;
+    }
+
+    // As in inline_functions, the function table refers to the original instruction lists, so build new ones.
+    int allocated = 0;
+    for (int i=0; i<no_files; i++) {
+        InstructionList *old = files[i].instructions;
+        InstructionList *new_list = malloc_instruction_list();
+        int function = -1;
+        for (int j=0; j<old->list_length; j++) {
+            Instruction *current = &(old->list_array[j]);
+            if (current->command == FUNCTION) {
+                function = get_function(functions, current->name);
+            }
+            if (function == -1 || size[function] == 0) {
+                copy_instruction(new_list, current);
+                continue;
+            }
+            int address = first_address + offset[function];
+            if (current->command == FUNCTION) {
+                add_static_frame_entry(new_list, current, address, arg_address[function], no_args[function]);
+                allocated++;
+                continue;
+            }
+            copy_instruction(new_list, current);
+            Instruction *copy = &(new_list->list_array[new_list->list_length-1]);
+            if ((copy->command == PUSH || copy->command == POP) && copy->segment == LOCAL) {
+                copy->segment = TEMP;
+                copy->index += address - 5;
+            } else if ((copy->command == PUSH || copy->command == POP) && copy->segment == ARGUMENT &&
+                       arg_address[function][copy->index] != -1) {
+                copy->segment = TEMP;
+                copy->index = address + arg_address[function][copy->index] - 5;
+            }
+        }
+        free_instruction_list(old);
+        files[i].instructions = new_list;
+    }
+
+    for (int i=0; i<no_functions; i++) {
+        free(arg_address[i]);
+    }
+    free(arg_address);
+    free(no_args);
+    free(size);
+    free(offset);
+    free_function_table(functions);
+    return allocated;
+}
+
+// Returns i such that files[i] is called filename, or -1 if there's no such file.
+int find_file(const VMFile *files, int no_files, const char *filename) {
+    for (int i=0; i<no_files; i++) {
+        if (strcmp(files[i].filename, filename) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns true if the given function (an index into functions) might be called again before it returns: if following
+// calls from it leads back to it, or to a function outside the program, which might call anything.
+bool calls_back(const VMFile *files, const FunctionTable *functions, int function) {
+    // As in remove_unreachable_functions, search the call graph with a stack of functions still to scan.
+    bool *reached = (bool *)calloc(functions->table_length + 1, sizeof(bool));
+    int *to_visit = (int *)malloc((functions->table_length + 1) * sizeof(int));
+    int no_to_visit = 1;
+    to_visit[0] = function;
+    bool result = false;
+    while (no_to_visit > 0 && !result) {
+        no_to_visit--;
+        const FunctionInfo *current = &(functions->table_array[to_visit[no_to_visit]]);
+        const InstructionList *code = files[current->file].instructions;
+        for (int i=current->start; i<current->end && !result; i++) {
+            if (code->list_array[i].command != CALL) {
+                continue;
+            }
+            int callee = get_function(functions, code->list_array[i].name);
+            if (callee == -1 || callee == function) {
+                result = true;
+            } else if (!reached[callee]) {
+                reached[callee] = true;
+                to_visit[no_to_visit] = callee;
+                no_to_visit++;
+            }
+        }
+    }
+    free(reached);
+    free(to_visit);
+    return result;
+}
+
+// Adds the start of a function with a static frame at address to the end of dest: function, which no longer pushes any
+// locals, then code to zero the locals and copy in each argument j with an arg_addresses[j] other than -1.
+void add_static_frame_entry(InstructionList *dest, const Instruction *function, int address, const int *arg_addresses,
+                            int no_args) {
+    add_instruction(dest, FUNCTION, CONSTANT, 0, function->name);
+    for (int i=0; i<function->index; i++) {
+        add_instruction(dest, PUSH, CONSTANT, 0, NULL);
+        add_instruction(dest, POP, TEMP, address + i - 5, NULL);
+    }
+    for (int i=0; i<no_args; i++) {
+        if (arg_addresses[i] != -1) {
+            add_instruction(dest, PUSH, ARGUMENT, i, NULL);
+            add_instruction(dest, POP, TEMP, address + arg_addresses[i] - 5, NULL);
+        }
+    }
+}
+
+// Returns a newly-allocated array giving, for each instruction in file, the number of times profile says the code
+// around it ran. This is the count for the closest label or function instruction before it, which is exact for straight
+// line code. Labels nothing jumps to are skipped, since simplify_jumps removes them from the code that was profiled.
+long *get_block_counts(const VMFile *file, const Profile *profile) {
+    const InstructionList *list = file->instructions;
+    long *counts = (long *)malloc((list->list_length + 1) * sizeof(long));
+    long count = 0;
+    char label[3*MAX_LINE_LENGTH];
+    for (int i=0; i<list->list_length; i++) {
+        const Instruction *current = &(list->list_array[i]);
+        if (current->command == FUNCTION) {
+            sprintf(label, "call$%s", current->name);
+            count = get_profile_count(profile, label);
+        } else if (current->command == LABEL && count_jumps_to(list, current->name) > 0) {
+            sprintf(label, "manual$%s$%s", file->filename, current->name);
+            count = get_profile_count(profile, label);
+        }
+        counts[i] = count;
+    }
+    return counts;
+}
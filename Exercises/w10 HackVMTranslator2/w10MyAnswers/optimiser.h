@@ -0,0 +1,110 @@
+#ifndef OPTIMISER_H
+#define OPTIMISER_H
+
+#include "instruction.h"
+#include "program.h"
+#include "profile.h"
+
+// Functions whose bodies have at most this many VM instructions (not counting function and return) can be inlined.
+#define INLINE_THRESHOLD 10
+
+// With a profile, code which runs at least 1/HOT_FRACTION as often as the most frequently reached label is hot, and
+// code which runs less than 1/COLD_FRACTION as often is cold. Hot call sites can inline functions up to
+// HOT_INLINE_THRESHOLD instructions long, while cold call sites never inline and use the shared call routine instead.
+#define HOT_FRACTION 10
+#define COLD_FRACTION 1000
+#define HOT_INLINE_THRESHOLD 20
+
+// Describes one function that inline_functions has inlined. name is the function's name, args is the number of
+// arguments it is called with, and call_sites is the number of calls replaced. function_code is a copy of the
+// function's original code (from its function instruction to its return), and inlined_code is a copy of the code
+// that replaced one of the calls.
+struct InlineReport {
+    char *name;
+    int args;
+    int call_sites;
+    InstructionList *function_code;
+    InstructionList *inlined_code;
+}; typedef struct InlineReport InlineReport;
+
+// Rewrites list so that it does the same thing with less work at runtime. Arithmetic, comparisons and logic on
+// constants are evaluated now rather than at runtime (e.g. "push constant 3, push constant 4, add" becomes "push
+// constant 7"), constants stored in local, argument, static or temp variables are propagated to later pushes of the
+// same variable within a basic block, and any remaining "push constant c" followed by a binary command or a pop is
+// turned into a single immediate instruction (see instruction.h).
+void fold_constants(InstructionList *list);
+
+// Simplifies the control flow of list. Jumps to a label followed only by "goto L" go straight to L instead (jump
+// threading), if-gotos on a constant condition become a goto or disappear, a fused if-goto (see instruction.h) jumping
+// over a goto is flipped to jump to the goto's label instead, jumps to the very next instruction are removed, and jumps
+// to one of several labels in a row go to the first one. Then code which can't be reached (after a goto or return and
+// before the next label) is removed, and so are labels nothing jumps to, which merges the basic blocks either side of
+// them. Returns the number of instructions removed.
+int simplify_jumps(InstructionList *list);
+
+// Replaces calls to small leaf functions (i.e. functions which call nothing, have no labels and have at most
+// INLINE_THRESHOLD instructions) with a copy of the function's code, which works on the caller's stack directly using
+// the stack segment instead of setting up a new frame. The functions themselves are left in place. If profile isn't
+// NULL, it's used to inline more at hot call sites and not at all at cold ones. Calls already marked as shared are
+// never inlined. Sets *reports to a newly-allocated array describing each function inlined and returns its length.
+int inline_functions(VMFile *files, int no_files, const Profile *profile, InlineReport **reports);
+// Frees every entry in reports, then reports itself.
+void free_inline_reports(InlineReport *reports, int no_reports);
+
+// Removes every function which can't be reached by following calls from Sys.init. If there is no Sys.init, nothing is
+// removed. Returns the number of functions removed, and sets *instructions_removed to the number of instructions they
+// contained.
+int remove_unreachable_functions(VMFile *files, int no_files, int *instructions_removed);
+
+// Turns every "call f n" followed immediately by "return" into a tail call (see instruction.h), except in Sys.init,
+// which has no real frame to reuse, and except where only one of the call and the return is lean (since f's return must
+// restore THIS and THAT exactly when our caller saved them). Writes a line to report (unless it's NULL) for each call
+// converted, and returns the number converted.
+int convert_tail_calls(InstructionList *list, FILE *report);
+
+// Marks every call at a cold call site, and every return from a cold function (unless it's lean), as shared (see
+// instruction.h) according to profile. Returns the number of calls marked, and sets *returns_shared to the number of
+// returns marked.
+int share_cold_calls(VMFile *files, int no_files, const Profile *profile, int *returns_shared);
+
+// Marks every call, return and comparison in the functions named in names as shared (see instruction.h), so that they
+// take as little space as possible. Returns the number of instructions marked.
+int share_functions(VMFile *files, int no_files, char **names, int no_names);
+
+// Marks every call to a function which never changes THIS or THAT, either itself or through the functions it calls, as
+// lean (see instruction.h), along with every return from such a function. Calls to functions outside the program are
+// assumed to change them. Returns the number of functions found, and sets *calls_lean to the number of calls marked.
+int mark_lean_frames(VMFile *files, int no_files, int *calls_lean);
+
+// RAM addresses from FIRST_STATIC_ADDRESS up to (but not including) STACK_BASE are free for static variables (see
+// allocate_statics) and static frames (see allocate_static_frames).
+#define FIRST_STATIC_ADDRESS 16
+#define STACK_BASE 256
+
+// An argument is only given a fixed address in a static frame if the function uses it at least this many times, since
+// copying it there when the function starts only pays for itself if the function then uses it several times.
+#define STATIC_ARG_USES 4
+
+// Gives every static variable in files its own RAM address, rather than leaving it to the assembler, so that we know
+// exactly how much RAM they take. Each file's variables go together in order of index (leaving out any index the file
+// never uses), starting at FIRST_STATIC_ADDRESS with the first file. Every push and pop of a static variable then uses
+// its address directly through the temp segment (see instruction.h). Sets *words to a newly-allocated array giving the
+// number of variables in each file, and returns the first address after them all. If they would reach STACK_BASE,
+// prints an error and exits, since the stack would overwrite them.
+int allocate_statics(VMFile *files, int no_files, int **words);
+
+// Gives functions which can never be running twice at once (i.e. which can't call themselves, even indirectly, and
+// don't call anything outside the program which might call back in) a static frame: fixed RAM addresses from
+// first_address up (i.e. above the static variables) for their locals, and for any argument used at least
+// STATIC_ARG_USES times. Their code then uses those addresses directly, through the temp segment with an index past 7
+// (temp i is always RAM address 5+i), rather than going through LCL or ARG. Locals are zeroed and arguments copied in
+// when the function starts, and the function instruction itself no longer pushes any locals. Functions which can't both
+// be running at once share addresses, so the frames stack up like the call graph does. While any would reach
+// STACK_BASE, the largest of those is left alone. Returns the number of functions given static frames, and sets
+// *words_used to the number of addresses their frames take up.
+int allocate_static_frames(VMFile *files, int no_files, int first_address, int *words_used);
+
+// Returns value wrapped into the range of a 16-bit Hack word, i.e. -32768 to 32767.
+int to_word(int value);
+
+#endif
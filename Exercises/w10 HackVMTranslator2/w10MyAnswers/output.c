@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+#include "token.h"
+
+// The comp part of every C-instruction the Hack CPU understands, together with its a-bit and c-bits.
+const char *CompStrings[] = {"0", "1", "-1", "D", "A", "!D", "!A", "-D", "-A", "D+1", "A+1", "D-1", "A-1", "D+A",
+                             "D-A", "A-D", "D&A", "D|A", "M", "!M", "-M", "M+1", "M-1", "D+M", "D-M", "M-D", "D&M",
+                             "D|M"};
+const int CompBits[] = {0x2A, 0x3F, 0x3A, 0x0C, 0x30, 0x0D, 0x31, 0x0F, 0x33, 0x1F, 0x37, 0x0E, 0x32, 0x02,
+                        0x13, 0x07, 0x00, 0x15, 0x70, 0x71, 0x73, 0x77, 0x72, 0x42, 0x53, 0x47, 0x40,
+                        0x55};
+#define NUM_COMPS 28
+
+// The jump part of a C-instruction, where JumpStrings[i] has jump bits i (and no jump has bits 0).
+const char *JumpStrings[] = {"", "JGT", "JEQ", "JGE", "JLT", "JNE", "JLE", "JMP"};
+
+void assemble_line(Output *output, char *line);
+int assemble_c_instruction(char *line);
+int get_comp_bits(char *comp);
+unsigned int hash_symbol(const char *name);
+
+Output *malloc_output(FILE *file, bool hack) {
+    const int initial_space = 1024;
+
+    Output *output = (Output *)malloc(sizeof(Output));
+    output->file = file;
+    output->hack = hack;
+    output->rom_length = 0;
+    output->rom_space = initial_space;
+    output->rom_array = (RomWord *)malloc(initial_space * sizeof(RomWord));
+    for (int i=0; i<SYMBOL_BUCKETS; i++) {
+        output->labels[i] = NULL;
+    }
+
+    // The predefined symbols behave exactly like labels, so we just put them in the label table.
+    char name[10];
+    for (int i=0; i<16; i++) {
+        sprintf(name, "R%d", i);
+        add_symbol(output->labels, name, i);
+    }
+    add_symbol(output->labels, "SP", 0);
+    add_symbol(output->labels, "LCL", 1);
+    add_symbol(output->labels, "ARG", 2);
+    add_symbol(output->labels, "THIS", 3);
+    add_symbol(output->labels, "THAT", 4);
+    add_symbol(output->labels, "SCREEN", 16384);
+    add_symbol(output->labels, "KBD", 24576);
+    return output;
+}
+
+void output_code(Output *output, const char *code) {
+    if (!output->hack) {
+        if (output->file == NULL) {
+            return;
+        }
+        fputs(code, output->file);
+        return;
+    }
+
+    char line[MAX_LINE_LENGTH+100];
+    int pos = 0;
+    while (code[pos] != '\0') {
+        int length = 0;
+        while (code[pos+length] != '\n' && code[pos+length] != '\0') {
+            length++;
+        }
+        if (length >= MAX_LINE_LENGTH+100) {
+            printf("Error: Assembly line too long.");
+            exit(EXIT_FAILURE);
+        }
+        strncpy(line, code+pos, length);
+        line[length] = '\0'; // Strncpy doesn't null-terminate.
+        assemble_line(output, line);
+        pos += length;
+        if (code[pos] == '\n') {
+            pos++;
+        }
+    }
+}
+
+void close_output(Output *output) {
+    if (output->hack) {
+        // Now we know where every label is, we can fill in the remaining A-instructions. Anything which isn't a label
+        // is a variable, and variables get addresses from 16 upwards in the order they first appear.
+        Symbol *variables[SYMBOL_BUCKETS] = {NULL};
+        int next_variable = 16;
+        for (int i=0; i<output->rom_length; i++) {
+            RomWord *current = &(output->rom_array[i]);
+            if (current->symbol != NULL) {
+                Symbol *symbol = get_symbol(output->labels, current->symbol);
+                if (symbol == NULL) {
+                    symbol = get_symbol(variables, current->symbol);
+                }
+                if (symbol == NULL) {
+                    add_symbol(variables, current->symbol, next_variable);
+                    next_variable++;
+                    symbol = get_symbol(variables, current->symbol);
+                }
+                current->word = symbol->address;
+                free(current->symbol);
+            }
+
+            char binary[18];
+            for (int bit=0; bit<16; bit++) {
+                binary[bit] = (current->word & (1 << (15-bit))) ? '1' : '0';
+            }
+            binary[16] = '\n';
+            binary[17] = '\0';
+            if (output->file != NULL) {
+                fputs(binary, output->file);
+            }
+        }
+        free_symbols(variables);
+    }
+
+    free_symbols(output->labels);
+    free(output->rom_array);
+    free(output);
+}
+
+// Assembles a single line of assembly code (without its newline), which may be blank, a comment or a label.
+void assemble_line(Output *output, char *line) {
+    // Strip out the comment (if any) and all whitespace, which leaves just the instruction or label.
+    int length = 0;
+    for (int pos=0; line[pos] != '\0'; pos++) {
+        if (line[pos] == '/' && line[pos+1] == '/') {
+            break;
+        }
+        if (line[pos] != ' ' && line[pos] != '\t' && line[pos] != '\r') {
+            line[length] = line[pos];
+            length++;
+        }
+    }
+    line[length] = '\0';
+    if (length == 0) {
+        return;
+    }
+
+    if (line[0] == '(') {
+        if (line[length-1] != ')') {
+            printf("Error: Malformed label %s in generated assembly.", line);
+            exit(EXIT_FAILURE);
+        }
+        line[length-1] = '\0';
+        // As in the assembler, if a label appears twice then the first one wins.
+        if (get_symbol(output->labels, line+1) == NULL) {
+            add_symbol(output->labels, line+1, output->rom_length);
+        }
+        return;
+    }
+
+    // If our rom_array array is full, allocate more memory.
+    if (output->rom_length == output->rom_space) {
+        RomWord *new_array = (RomWord *)malloc(2 * output->rom_space * sizeof(RomWord));
+        for (int i=0; i<output->rom_length; i++) {
+            new_array[i] = output->rom_array[i];
+        }
+        free(output->rom_array);
+        output->rom_array = new_array;
+        output->rom_space *= 2;
+    }
+
+    RomWord *new = &(output->rom_array[output->rom_length]);
+    new->word = 0;
+    new->symbol = NULL;
+    if (line[0] != '@') {
+        new->word = assemble_c_instruction(line);
+    } else if (line[1] >= '0' && line[1] <= '9') {
+        new->word = strtol(line+1, NULL, 10);
+        if (new->word > 32767) {
+            printf("Error: Constant %s too large for an A-instruction.", line+1);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        new->symbol = malloc(strlen(line+1)+1);
+        strcpy(new->symbol, line+1);
+    }
+    output->rom_length++;
+}
+
+// Returns the Hack code for the given C-instruction, which should have no whitespace or comments.
+int assemble_c_instruction(char *line) {
+    int dest_bits = 0;
+    int jump_bits = 0;
+    char *comp = line;
+
+    char *equals = strchr(line, '=');
+    if (equals != NULL) {
+        for (char *pos=line; pos<equals; pos++) {
+            switch (*pos) {
+                case 'A': dest_bits |= 4; break;
+                case 'D': dest_bits |= 2; break;
+                case 'M': dest_bits |= 1; break;
+                default: printf("Error: Malformed C-instruction %s in generated assembly.", line); exit(EXIT_FAILURE);
+            }
+        }
+        comp = equals+1;
+    }
+
+    char *semicolon = strchr(comp, ';');
+    if (semicolon != NULL) {
+        *semicolon = '\0';
+        jump_bits = -1;
+        for (int i=1; i<8; i++) {
+            if (strcmp(semicolon+1, JumpStrings[i]) == 0) {
+                jump_bits = i;
+            }
+        }
+        if (jump_bits == -1) {
+            printf("Error: Malformed jump %s in generated assembly.", semicolon+1);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return 0xE000 | (get_comp_bits(comp) << 6) | (dest_bits << 3) | jump_bits;
+}
+
+// Returns the a-bit and c-bits for the given comp part of a C-instruction. Operands of +, & and | can go either way
+// round, so e.g. "M+D" works as well as "D+M".
+int get_comp_bits(char *comp) {
+    for (int attempt=0; attempt<2; attempt++) {
+        for (int i=0; i<NUM_COMPS; i++) {
+            if (strcmp(comp, CompStrings[i]) == 0) {
+                return CompBits[i];
+            }
+        }
+        if (strlen(comp) != 3 || (comp[1] != '+' && comp[1] != '&' && comp[1] != '|')) {
+            break;
+        }
+        char swap = comp[0];
+        comp[0] = comp[2];
+        comp[2] = swap;
+    }
+    printf("Error: Malformed comp %s in generated assembly.", comp);
+    exit(EXIT_FAILURE);
+}
+
+void add_symbol(Symbol *table[], const char *name, int address) {
+    unsigned int bucket = hash_symbol(name);
+    Symbol *new = (Symbol *)malloc(sizeof(Symbol));
+    new->name = malloc(strlen(name)+1);
+    strcpy(new->name, name);
+    new->address = address;
+    new->next = table[bucket];
+    table[bucket] = new;
+}
+
+Symbol *get_symbol(Symbol *table[], const char *name) {
+    for (Symbol *current = table[hash_symbol(name)]; current != NULL; current = current->next) {
+        if (strcmp(current->name, name) == 0) {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+void free_symbols(Symbol *table[]) {
+    for (int i=0; i<SYMBOL_BUCKETS; i++) {
+        Symbol *current = table[i];
+        while (current != NULL) {
+            Symbol *next = current->next;
+            free(current->name);
+            free(current);
+            current = next;
+        }
+    }
+}
+
+// Returns which bucket of a symbol table the given name belongs in. (This is the djb2 hash function.)
+unsigned int hash_symbol(const char *name) {
+    unsigned int hash = 5381;
+    for (int i=0; name[i] != '\0'; i++) {
+        hash = hash * 33 + (unsigned char)name[i];
+    }
+    return hash % SYMBOL_BUCKETS;
+}
@@ -0,0 +1,56 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// Number of buckets in the hash table of symbols used by the built-in assembler.
+#define SYMBOL_BUCKETS 4096
+
+// One entry in the built-in assembler's symbol table, holding the address of a label or variable. Entries with the same
+// hash are chained together through next.
+struct Symbol {
+    char *name;
+    int address;
+    struct Symbol *next;
+}; typedef struct Symbol Symbol;
+
+// One Hack instruction assembled so far. If symbol is NULL, word holds the finished instruction. Otherwise it's an
+// A-instruction loading symbol, which we can't fill in until we know where every label is.
+struct RomWord {
+    int word;
+    char *symbol;
+}; typedef struct RomWord RomWord;
+
+// An Output is where the translator sends the assembly code it generates. If hack is false, the code is written to file
+// as text, exactly as before. If hack is true, the code is assembled in memory as it arrives instead: instructions are
+// stored in rom_array (with rom_length and rom_space working as for an InstructionList), labels are stored in labels,
+// and the finished .hack file is written to file by close_output. The code still arrives as text, which output_code
+// splits into lines and parses again, so this saves writing the text out and running a separate assembler over it, but
+// not the work of formatting and parsing each instruction.
+struct Output {
+    FILE *file;
+    bool hack;
+    RomWord *rom_array;
+    int rom_length;
+    int rom_space;
+    Symbol *labels[SYMBOL_BUCKETS];
+}; typedef struct Output Output;
+
+// Creates a new Output writing to file, which should already be open. If hack is true, the output will be a .hack file
+// rather than assembly code. file can be NULL, in which case nothing is written, but with hack set the code is still
+// assembled, so rom_length gives its size.
+Output *malloc_output(FILE *file, bool hack);
+// Sends the given assembly code (any number of lines, each ending in a newline) to output.
+void output_code(Output *output, const char *code);
+// Finishes writing output (assembling it if need be) and frees it. Doesn't close the underlying file.
+void close_output(Output *output);
+
+// A symbol table is an array of SYMBOL_BUCKETS pointers, all NULL to begin with. add_symbol adds a new symbol with the
+// given name (which is copied) and address to table, and get_symbol returns the symbol called name in table, or NULL if
+// there isn't one. free_symbols frees every symbol in table (but not table itself).
+void add_symbol(Symbol *table[], const char *name, int address);
+Symbol *get_symbol(Symbol *table[], const char *name);
+void free_symbols(Symbol *table[]);
+
+#endif
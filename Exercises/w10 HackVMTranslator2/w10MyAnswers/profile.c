@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "token.h"
+
+Profile *read_profile(FILE *input) {
+    const int initial_space = 64;
+
+    Profile *profile = (Profile *)malloc(sizeof(Profile));
+    profile->entry_length = 0;
+    profile->entry_space = initial_space;
+    profile->entry_array = (ProfileEntry *)malloc(initial_space * sizeof(ProfileEntry));
+    profile->max_count = 0;
+
+    char line[MAX_LINE_LENGTH];
+    char label[MAX_LINE_LENGTH];
+    long count;
+    while (fgets(line, MAX_LINE_LENGTH, input) != NULL) {
+        if (strncmp(line, "//", 2) == 0) {
+            continue;
+        }
+        int read = sscanf(line, "%255s %ld", label, &count);
+        if (read <= 0) {
+            continue;
+        }
+        if (read != 2 || count < 0) {
+            printf("Error: Malformed profile line %s", line);
+            exit(EXIT_FAILURE);
+        }
+
+        // If our entry_array array is full, allocate more memory.
+        if (profile->entry_length == profile->entry_space) {
+            ProfileEntry *new_array = (ProfileEntry *)malloc(2 * profile->entry_space * sizeof(ProfileEntry));
+            for (int i=0; i<profile->entry_length; i++) {
+                new_array[i] = profile->entry_array[i];
+            }
+            free(profile->entry_array);
+            profile->entry_array = new_array;
+            profile->entry_space *= 2;
+        }
+        ProfileEntry *new = &(profile->entry_array[profile->entry_length]);
+        new->label = malloc(strlen(label)+1);
+        strcpy(new->label, label);
+        new->count = count;
+        profile->entry_length++;
+        if (count > profile->max_count) {
+            profile->max_count = count;
+        }
+    }
+    return profile;
+}
+
+void free_profile(Profile *profile) {
+    for (int i=0; i<profile->entry_length; i++) {
+        free(profile->entry_array[i].label);
+    }
+    free(profile->entry_array);
+    free(profile);
+}
+
+long get_profile_count(const Profile *profile, const char *label) {
+    for (int i=0; i<profile->entry_length; i++) {
+        if (strcmp(profile->entry_array[i].label, label) == 0) {
+            return profile->entry_array[i].count;
+        }
+    }
+    return 0;
+}
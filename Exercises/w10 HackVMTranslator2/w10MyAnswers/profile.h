@@ -0,0 +1,31 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+// A Profile records how many times each label in the translator's assembly output was reached when the program was
+// run, e.g. in an emulator. Function entry points appear as call$[function_name] and labels from the VM code appear as
+// manual$[filename]$[label], as in the assembly code. entry_array holds the counts, entry_length is the number of
+// entries, and entry_space is only used internally and tracks the memory allocated to entry_array. max_count is the
+// largest count in the profile.
+struct ProfileEntry {
+    char *label;
+    long count;
+}; typedef struct ProfileEntry ProfileEntry;
+
+struct Profile {
+    ProfileEntry *entry_array;
+    int entry_length;
+    int entry_space;
+    long max_count;
+}; typedef struct Profile Profile;
+
+// Reads a profile from input. Each line should contain a label followed by a count, separated by whitespace; blank
+// lines and lines starting with // are ignored.
+Profile *read_profile(FILE *input);
+// Frees every entry in profile, then profile itself.
+void free_profile(Profile *profile);
+// Returns the count for the given label, or 0 if it isn't in the profile (since then it was never reached).
+long get_profile_count(const Profile *profile, const char *label);
+
+#endif
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "program.h"
+
+void add_function(FunctionTable *table, const char *name, int file, int start, int locals);
+
+FunctionTable *find_functions(VMFile *files, int no_files) {
+    const int initial_space = 16;
+
+    FunctionTable *table = (FunctionTable *)malloc(sizeof(FunctionTable));
+    table->table_length = 0;
+    table->table_space = initial_space;
+    table->table_array = (FunctionInfo *)malloc(initial_space * sizeof(FunctionInfo));
+
+    for (int i=0; i<no_files; i++) {
+        InstructionList *list = files[i].instructions;
+        for (int j=0; j<list->list_length; j++) {
+            if (list->list_array[j].command != FUNCTION) {
+                continue;
+            }
+            // Each function runs until the next one starts, so this is also where the previous one ends.
+            if (table->table_length > 0 && table->table_array[table->table_length-1].file == i) {
+                table->table_array[table->table_length-1].end = j;
+            }
+            add_function(table, list->list_array[j].name, i, j, list->list_array[j].index);
+        }
+        if (table->table_length > 0 && table->table_array[table->table_length-1].file == i) {
+            table->table_array[table->table_length-1].end = list->list_length;
+        }
+    }
+    return table;
+}
+
+void free_function_table(FunctionTable *table) {
+    for (int i=0; i<table->table_length; i++) {
+        free(table->table_array[i].name);
+    }
+    free(table->table_array);
+    free(table);
+}
+
+int get_function(const FunctionTable *table, const char *search_name) {
+    for (int i=0; i<table->table_length; i++) {
+        if (strcmp(table->table_array[i].name, search_name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Adds a new function to the end of table. The name is copied, and end is left for the caller to fill in.
+void add_function(FunctionTable *table, const char *name, int file, int start, int locals) {
+    if (table->table_length == table->table_space) {
+        FunctionInfo *new_array = (FunctionInfo *)malloc(2 * table->table_space * sizeof(FunctionInfo));
+        for (int i=0; i<table->table_length; i++) {
+            new_array[i] = table->table_array[i];
+        }
+        free(table->table_array);
+        table->table_array = new_array;
+        table->table_space *= 2;
+    }
+
+    FunctionInfo *new = &(table->table_array[table->table_length]);
+    new->name = malloc(strlen(name)+1);
+    strcpy(new->name, name);
+    new->file = file;
+    new->start = start;
+    new->end = start+1;
+    new->locals = locals;
+    table->table_length++;
+}
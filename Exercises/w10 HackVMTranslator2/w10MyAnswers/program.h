@@ -0,0 +1,41 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "instruction.h"
+
+// A VMFile is one .vm file we're translating: its instructions, together with the file name the generated code uses
+// for the file's labels and static variables.
+struct VMFile {
+    char *filename;
+    InstructionList *instructions;
+}; typedef struct VMFile VMFile;
+
+// Each entry in a function table records where one VM function lives: the function's name, the index of its file in
+// the files array, and the range of its instructions in that file (from its function instruction at start up to but
+// not including end). locals is the number of local variables given in the function instruction.
+struct FunctionInfo {
+    char *name;
+    int file;
+    int start;
+    int end;
+    int locals;
+}; typedef struct FunctionInfo FunctionInfo;
+
+// A FunctionTable is a list of FunctionInfos stored in table_array, with the number of entries stored in
+// table_length. The table_space variable is only used internally and tracks the memory allocated to table_array.
+struct FunctionTable {
+    FunctionInfo *table_array;
+    int table_length;
+    int table_space;
+}; typedef struct FunctionTable FunctionTable;
+
+// Scans every file for function instructions and returns a table of all the functions found. Note that the table
+// refers to instruction indices, so it becomes out of date if any of the files' instruction lists change.
+FunctionTable *find_functions(VMFile *files, int no_files);
+// Frees every entry in table, then table itself.
+void free_function_table(FunctionTable *table);
+// If table contains a function called search_name, returns i such that table->table_array[i] is that function.
+// Otherwise returns -1.
+int get_function(const FunctionTable *table, const char *search_name);
+
+#endif
@@ -0,0 +1,130 @@
+// Generated by superopt/superopt.c, which explains how. Don't edit this file by hand; change and rerun that
+// instead.
+#include "templates.h"
+
+const Template Templates[] = {
+    // add, from lag -1
+    {{{ADD, CONSTANT, 0}}, 1, -1, -2, "@SP\nD=M-1\nA=D-1\nD=M\nA=A-1\nM=D+M\n"},
+    // add, from lag 0
+    {{{ADD, CONSTANT, 0}}, 1, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=D+M\n"},
+    // add, from lag 1
+    {{{ADD, CONSTANT, 0}}, 1, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=D+M\n"},
+    // add, from lag 2
+    {{{ADD, CONSTANT, 0}}, 1, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=D+M\n"},
+    // sub, from lag -1
+    {{{SUB, CONSTANT, 0}}, 1, -1, -2, "@SP\nD=M-1\nA=D-1\nD=M\nA=A-1\nM=M-D\n"},
+    // sub, from lag 0
+    {{{SUB, CONSTANT, 0}}, 1, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=M-D\n"},
+    // sub, from lag 1
+    {{{SUB, CONSTANT, 0}}, 1, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=M-D\n"},
+    // sub, from lag 2
+    {{{SUB, CONSTANT, 0}}, 1, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=M-D\n"},
+    // and, from lag -1
+    {{{AND, CONSTANT, 0}}, 1, -1, -2, "@SP\nD=M-1\nA=D-1\nD=M\nA=A-1\nM=D&M\n"},
+    // and, from lag 0
+    {{{AND, CONSTANT, 0}}, 1, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=D&M\n"},
+    // and, from lag 1
+    {{{AND, CONSTANT, 0}}, 1, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=D&M\n"},
+    // and, from lag 2
+    {{{AND, CONSTANT, 0}}, 1, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=D&M\n"},
+    // or, from lag -1
+    {{{OR, CONSTANT, 0}}, 1, -1, -2, "@SP\nD=M-1\nA=D-1\nD=M\nA=A-1\nM=D|M\n"},
+    // or, from lag 0
+    {{{OR, CONSTANT, 0}}, 1, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=D|M\n"},
+    // or, from lag 1
+    {{{OR, CONSTANT, 0}}, 1, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=D|M\n"},
+    // or, from lag 2
+    {{{OR, CONSTANT, 0}}, 1, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=D|M\n"},
+    // neg, from lag -2
+    {{{NEG, CONSTANT, 0}}, 1, -2, -2, "@SP\nD=M-1\nD=D-1\nA=D-1\nM=-M\n"},
+    // neg, from lag -1
+    {{{NEG, CONSTANT, 0}}, 1, -1, -1, "@SP\nD=M-1\nA=D-1\nM=-M\n"},
+    // neg, from lag 0
+    {{{NEG, CONSTANT, 0}}, 1, 0, 0, "@SP\nA=M-1\nM=-M\n"},
+    // neg, from lag 1
+    {{{NEG, CONSTANT, 0}}, 1, 1, 1, "@SP\nA=M\nM=-M\n"},
+    // neg, from lag 2
+    {{{NEG, CONSTANT, 0}}, 1, 2, 2, "@SP\nA=M+1\nM=-M\n"},
+    // not, from lag -2
+    {{{NOT, CONSTANT, 0}}, 1, -2, -2, "@SP\nD=M-1\nD=D-1\nA=D-1\nM=!M\n"},
+    // not, from lag -1
+    {{{NOT, CONSTANT, 0}}, 1, -1, -1, "@SP\nD=M-1\nA=D-1\nM=!M\n"},
+    // not, from lag 0
+    {{{NOT, CONSTANT, 0}}, 1, 0, 0, "@SP\nA=M-1\nM=!M\n"},
+    // not, from lag 1
+    {{{NOT, CONSTANT, 0}}, 1, 1, 1, "@SP\nA=M\nM=!M\n"},
+    // not, from lag 2
+    {{{NOT, CONSTANT, 0}}, 1, 2, 2, "@SP\nA=M+1\nM=!M\n"},
+    // neg, add, from lag -1
+    {{{NEG, CONSTANT, 0}, {ADD, CONSTANT, 0}}, 2, -1, -2, "@SP\nD=M-1\nA=D-1\nD=M\nA=A-1\nM=M-D\n"},
+    // neg, add, from lag 0
+    {{{NEG, CONSTANT, 0}, {ADD, CONSTANT, 0}}, 2, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=M-D\n"},
+    // neg, add, from lag 1
+    {{{NEG, CONSTANT, 0}, {ADD, CONSTANT, 0}}, 2, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=M-D\n"},
+    // neg, add, from lag 2
+    {{{NEG, CONSTANT, 0}, {ADD, CONSTANT, 0}}, 2, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=M-D\n"},
+    // sub, neg, from lag -1
+    {{{SUB, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, -1, -2, "@SP\nD=M-1\nA=D-1\nD=M\nA=A-1\nM=D-M\n"},
+    // sub, neg, from lag 0
+    {{{SUB, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=D-M\n"},
+    // sub, neg, from lag 1
+    {{{SUB, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=D-M\n"},
+    // sub, neg, from lag 2
+    {{{SUB, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=D-M\n"},
+    // not, and, from lag -1
+    {{{NOT, CONSTANT, 0}, {AND, CONSTANT, 0}}, 2, -1, -2, "@SP\nD=M-1\nA=D-1\nD=!M\nA=A-1\nM=D&M\n"},
+    // not, and, from lag 0
+    {{{NOT, CONSTANT, 0}, {AND, CONSTANT, 0}}, 2, 0, -1, "@SP\nA=M-1\nD=!M\nA=A-1\nM=D&M\n"},
+    // not, and, from lag 1
+    {{{NOT, CONSTANT, 0}, {AND, CONSTANT, 0}}, 2, 1, 0, "@SP\nA=M\nD=!M\nA=A-1\nM=D&M\n"},
+    // not, and, from lag 2
+    {{{NOT, CONSTANT, 0}, {AND, CONSTANT, 0}}, 2, 2, 1, "@SP\nA=M+1\nD=!M\nA=A-1\nM=D&M\n"},
+    // not, or, from lag -1
+    {{{NOT, CONSTANT, 0}, {OR, CONSTANT, 0}}, 2, -1, -2, "@SP\nD=M-1\nA=D-1\nD=!M\nA=A-1\nM=D|M\n"},
+    // not, or, from lag 0
+    {{{NOT, CONSTANT, 0}, {OR, CONSTANT, 0}}, 2, 0, -1, "@SP\nA=M-1\nD=!M\nA=A-1\nM=D|M\n"},
+    // not, or, from lag 1
+    {{{NOT, CONSTANT, 0}, {OR, CONSTANT, 0}}, 2, 1, 0, "@SP\nA=M\nD=!M\nA=A-1\nM=D|M\n"},
+    // not, or, from lag 2
+    {{{NOT, CONSTANT, 0}, {OR, CONSTANT, 0}}, 2, 2, 1, "@SP\nA=M+1\nD=!M\nA=A-1\nM=D|M\n"},
+    // and, not, from lag 0
+    {{{AND, CONSTANT, 0}, {NOT, CONSTANT, 0}}, 2, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=D&M\nM=!M\n"},
+    // and, not, from lag 1
+    {{{AND, CONSTANT, 0}, {NOT, CONSTANT, 0}}, 2, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=D&M\nM=!M\n"},
+    // and, not, from lag 2
+    {{{AND, CONSTANT, 0}, {NOT, CONSTANT, 0}}, 2, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=D&M\nM=!M\n"},
+    // or, not, from lag 0
+    {{{OR, CONSTANT, 0}, {NOT, CONSTANT, 0}}, 2, 0, -1, "@SP\nA=M-1\nD=M\nA=A-1\nM=D|M\nM=!M\n"},
+    // or, not, from lag 1
+    {{{OR, CONSTANT, 0}, {NOT, CONSTANT, 0}}, 2, 1, 0, "@SP\nA=M\nD=M\nA=A-1\nM=D|M\nM=!M\n"},
+    // or, not, from lag 2
+    {{{OR, CONSTANT, 0}, {NOT, CONSTANT, 0}}, 2, 2, 1, "@SP\nA=M+1\nD=M\nA=A-1\nM=D|M\nM=!M\n"},
+    // add, neg, from lag -1
+    {{{ADD, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, -1, -2, "@SP\nD=M-1\nA=D-1\nD=-M\nA=A-1\nM=D-M\n"},
+    // add, neg, from lag 0
+    {{{ADD, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, 0, -1, "@SP\nA=M-1\nD=-M\nA=A-1\nM=D-M\n"},
+    // add, neg, from lag 1
+    {{{ADD, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, 1, 0, "@SP\nA=M\nD=-M\nA=A-1\nM=D-M\n"},
+    // add, neg, from lag 2
+    {{{ADD, CONSTANT, 0}, {NEG, CONSTANT, 0}}, 2, 2, 1, "@SP\nA=M+1\nD=-M\nA=A-1\nM=D-M\n"},
+    // push stack 0, from lag -1
+    {{{PUSH, STACK, 0}}, 1, -1, 0, "@SP\nD=M-1\nA=D-1\nD=M\nA=A+1\nM=D\n"},
+    // push stack 0, from lag 0
+    {{{PUSH, STACK, 0}}, 1, 0, 1, "@SP\nA=M-1\nD=M\nA=A+1\nM=D\n"},
+    // push stack 0, from lag 1
+    {{{PUSH, STACK, 0}}, 1, 1, 2, "@SP\nA=M\nD=M\nA=A+1\nM=D\n"},
+    // push stack 0, from lag 2
+    {{{PUSH, STACK, 0}}, 1, 2, 2, "@SP\nAM=M+1\nD=M\nA=A+1\nM=D\n"},
+    // push stack 0, add, from lag -2
+    {{{PUSH, STACK, 0}, {ADD, CONSTANT, 0}}, 2, -2, -2, "@SP\nD=M-1\nD=D-1\nA=D-1\nD=M\nM=D+M\n"},
+    // push stack 0, add, from lag -1
+    {{{PUSH, STACK, 0}, {ADD, CONSTANT, 0}}, 2, -1, -1, "@SP\nD=M-1\nA=D-1\nD=M\nM=D+M\n"},
+    // push stack 0, add, from lag 0
+    {{{PUSH, STACK, 0}, {ADD, CONSTANT, 0}}, 2, 0, 0, "@SP\nA=M-1\nD=M\nM=D+M\n"},
+    // push stack 0, add, from lag 1
+    {{{PUSH, STACK, 0}, {ADD, CONSTANT, 0}}, 2, 1, 1, "@SP\nA=M\nD=M\nM=D+M\n"},
+    // push stack 0, add, from lag 2
+    {{{PUSH, STACK, 0}, {ADD, CONSTANT, 0}}, 2, 2, 2, "@SP\nA=M+1\nD=M\nM=D+M\n"},
+};
+
+const int NumTemplates = 61;
@@ -0,0 +1,32 @@
+#ifndef TEMPLATES_H
+#define TEMPLATES_H
+
+#include "token.h"
+
+// The most VM commands any template covers.
+#define MAX_TEMPLATE_COMMANDS 3
+
+// One VM command matched by a template: command, segment and index are as in an Instruction (see instruction.h), and
+// segment is CONSTANT for commands without one.
+struct TemplateCommand {
+    Keyword command;
+    Keyword segment;
+    int index;
+}; typedef struct TemplateCommand TemplateCommand;
+
+// A template is the shortest Hack code for a short sequence of VM commands, found by searching every possible program
+// (see superopt/superopt.c). The code is only valid when the translator's sp_lag (see main.c) is lag_in, and leaves it
+// at lag_out.
+struct Template {
+    TemplateCommand commands[MAX_TEMPLATE_COMMANDS];
+    int no_commands;
+    int lag_in;
+    int lag_out;
+    const char *code;
+}; typedef struct Template Template;
+
+// The table of templates in templates.c, which is generated by superopt/superopt.c.
+extern const Template Templates[];
+extern const int NumTemplates;
+
+#endif
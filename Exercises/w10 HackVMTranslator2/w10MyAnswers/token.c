@@ -4,6 +4,36 @@
 #include <stdbool.h>
 #include "token.h"
 
+const char *KeywordToString[] = {
+        [PUSH] = "push",
+        [POP] = "pop",
+        [ADD] = "add",
+        [SUB] = "sub",
+        [NEG] = "neg",
+        [AND] = "and",
+        [OR] = "or",
+        [NOT] = "not",
+        [EQ] = "eq",
+        [GT] = "gt",
+        [LT] = "lt",
+        [LOCAL] = "local",
+        [CONSTANT] = "constant",
+        [KW_THIS] = "this",
+        [THAT] = "that",
+        [POINTER] = "pointer",
+        [ARGUMENT] = "argument",
+        [STATIC] = "static",
+        [TEMP] = "temp",
+        [LABEL] = "label",
+        [GOTO] = "goto",
+        [IFGOTO] = "if-goto",
+        [FUNCTION] = "function",
+        [CALL] = "call",
+        [RETURN] = "return",
+        [STACK] = "stack",
+        [DROP] = "drop"
+};
+
 Token *malloc_token() {
     Token *var = (Token *)malloc(sizeof(Token));
     return var;
@@ -1,3 +1,6 @@
+#ifndef TOKEN_H
+#define TOKEN_H
+
 #include <stdio.h>
 #include <stdbool.h>
 
@@ -12,8 +15,11 @@ enum Keyword {
     PUSH, POP, ADD, SUB, NEG, AND, OR, NOT, EQ, GT, LT,
     LOCAL, CONSTANT, KW_THIS, THAT, POINTER, ARGUMENT, STATIC, TEMP,
     LABEL, GOTO, IFGOTO,
-    FUNCTION, CALL, RETURN
+    FUNCTION, CALL, RETURN,
+    STACK, DROP // Not VM keywords --- only used internally by the optimiser, see instruction.h.
 }; typedef enum Keyword Keyword;
+#define NUM_KWS 27
+extern const char *KeywordToString[];
 
 /* A union is a special type that uses one spot in memory to store one of several
  * different variables of different types. Here, TokenData can store either a Keyword,
@@ -46,4 +52,6 @@ void write_token(Token *, FILE *);
 bool read_token(Token *, FILE *);
 
 // Maximum token length
-#define MAX_LINE_LENGTH 256
\ No newline at end of file
+#define MAX_LINE_LENGTH 256
+
+#endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+// Runs CompareTest.asm and checks the stack pointer and the 20 values it leaves on the stack.
+
+load CompareTest.asm,
+output-file CompareTest.out,
+compare-to CompareTest.cmp,
+output-list RAM[0]%D2.6.2 RAM[256]%D2.6.2 RAM[257]%D2.6.2 RAM[258]%D2.6.2 RAM[259]%D2.6.2 RAM[260]%D2.6.2 RAM[261]%D2.6.2 RAM[262]%D2.6.2 RAM[263]%D2.6.2 RAM[264]%D2.6.2 RAM[265]%D2.6.2 RAM[266]%D2.6.2 RAM[267]%D2.6.2 RAM[268]%D2.6.2 RAM[269]%D2.6.2 RAM[270]%D2.6.2 RAM[271]%D2.6.2 RAM[272]%D2.6.2 RAM[273]%D2.6.2 RAM[274]%D2.6.2 RAM[275]%D2.6.2;
+
+set RAM[0] 256,  // initializes the stack pointer
+
+repeat 3000 {   // enough cycles to complete the execution
+  ticktock;
+}
+output;
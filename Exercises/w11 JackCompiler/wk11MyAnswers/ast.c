@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+
+// The usual size of an arena block. Bigger requests get a block of their own.
+#define ARENA_BLOCK_SIZE 65536
+// Everything handed out is aligned to this many bytes, which is enough for any node.
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock {
+    struct ArenaBlock *previous;
+    size_t used;
+    size_t space;
+    char *memory;
+}; typedef struct ArenaBlock ArenaBlock;
+
+void write_var_dec_xml(const VarDec *var_dec, NonTerminal nt, int *indentation, FILE *output);
+void write_statements_xml(const Statement *statements, int *indentation, FILE *output);
+void write_expression_xml(const Expression *expression, int *indentation, FILE *output);
+void write_term_xml(const Term *term, int *indentation, FILE *output);
+void write_sub_call_xml(const SubroutineCall *call, int *indentation, FILE *output);
+void write_name_xml(char *name, int *indentation, FILE *output);
+void write_symbol_xml(char symbol, int *indentation, FILE *output);
+
+Arena *malloc_arena() {
+    Arena *arena = (Arena *)malloc(sizeof(Arena));
+    arena->current = NULL;
+    return arena;
+}
+
+void free_arena(Arena *arena) {
+    while (arena->current != NULL) {
+        ArenaBlock *previous = arena->current->previous;
+        free(arena->current->memory);
+        free(arena->current);
+        arena->current = previous;
+    }
+    free(arena);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    ArenaBlock *block = arena->current;
+    if (block == NULL || block->used + size > block->space) {
+        block = (ArenaBlock *)malloc(sizeof(ArenaBlock));
+        block->space = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+        block->memory = (char *)malloc(block->space);
+        block->used = 0;
+        block->previous = arena->current;
+        arena->current = block;
+    }
+    void *result = block->memory + block->used;
+    block->used += size;
+    memset(result, 0, size);
+    return result;
+}
+
+void write_class_xml(const Class *class, FILE *output) {
+    int indentation_level = 0;
+    int *indentation = &indentation_level;
+
+    // Children: class name identifier, <classVarDec>s, <subroutineDec>s.
+    write_non_terminal(NT_CLASS, false, indentation, output);
+    write_name_xml(class->name, indentation, output);
+    for (const VarDec *var_dec = class->var_decs; var_dec != NULL; var_dec = var_dec->next) {
+        write_var_dec_xml(var_dec, NT_CLASS_VAR_DEC, indentation, output);
+    }
+
+    for (const Subroutine *sub = class->subroutines; sub != NULL; sub = sub->next) {
+        // Children: subroutine keyword, return type keyword, subroutine name, <parameterList>, <subroutineBody>.
+        write_non_terminal(NT_SUBROUTINE_DEC, false, indentation, output);
+        Tag kind = {.type = KEYWORD, .value.key_val = sub->kind};
+        write_tag(&kind, indentation, output);
+        write_tag(&(sub->return_type), indentation, output);
+        write_name_xml(sub->name, indentation, output);
+
+        write_non_terminal(NT_PARAMETER_LIST, false, indentation, output);
+        for (const Parameter *parameter = sub->parameters; parameter != NULL; parameter = parameter->next) {
+            write_tag(&(parameter->type), indentation, output);
+            write_name_xml(parameter->name, indentation, output);
+        }
+        write_non_terminal(NT_PARAMETER_LIST, true, indentation, output);
+
+        write_non_terminal(NT_SUBROUTINE_BODY, false, indentation, output);
+        for (const VarDec *var_dec = sub->var_decs; var_dec != NULL; var_dec = var_dec->next) {
+            write_var_dec_xml(var_dec, NT_VAR_DEC, indentation, output);
+        }
+        write_statements_xml(sub->statements, indentation, output);
+        write_non_terminal(NT_SUBROUTINE_BODY, true, indentation, output);
+
+        write_non_terminal(NT_SUBROUTINE_DEC, true, indentation, output);
+    }
+    write_non_terminal(NT_CLASS, true, indentation, output);
+}
+
+// Writes a <classVarDec> (kind keyword, type keyword, identifiers) or <varDec> (type keyword, identifiers).
+void write_var_dec_xml(const VarDec *var_dec, NonTerminal nt, int *indentation, FILE *output) {
+    write_non_terminal(nt, false, indentation, output);
+    if (nt == NT_CLASS_VAR_DEC) {
+        Tag kind = {.type = KEYWORD, .value.key_val = var_dec->kind};
+        write_tag(&kind, indentation, output);
+    }
+    write_tag(&(var_dec->type), indentation, output);
+    for (const Name *name = var_dec->names; name != NULL; name = name->next) {
+        write_name_xml(name->name, indentation, output);
+    }
+    write_non_terminal(nt, true, indentation, output);
+}
+
+void write_statements_xml(const Statement *statements, int *indentation, FILE *output) {
+    write_non_terminal(NT_STATEMENTS, false, indentation, output);
+    for (const Statement *statement = statements; statement != NULL; statement = statement->next) {
+        write_non_terminal(statement->type, false, indentation, output);
+        switch (statement->type) {
+            case NT_LET_STATEMENT:
+                // Children: destination variable, ['[', <expression>, ']'] if present, right-hand side <expression>.
+                write_name_xml(statement->name, indentation, output);
+                if (statement->index != NULL) {
+                    write_symbol_xml('[', indentation, output);
+                    write_expression_xml(statement->index, indentation, output);
+                    write_symbol_xml(']', indentation, output);
+                }
+                write_expression_xml(statement->expression, indentation, output);
+                break;
+            case NT_IF_STATEMENT:
+            case NT_WHILE_STATEMENT:
+                // Children: condition <expression>, <statements>, and for an if, <statements> in the else clause.
+                write_expression_xml(statement->expression, indentation, output);
+                write_statements_xml(statement->body, indentation, output);
+                if (statement->has_else) {
+                    write_statements_xml(statement->else_body, indentation, output);
+                }
+                break;
+            case NT_DO_STATEMENT:
+                write_sub_call_xml(statement->call, indentation, output);
+                break;
+            case NT_RETURN_STATEMENT:
+                if (statement->expression != NULL) {
+                    write_expression_xml(statement->expression, indentation, output);
+                }
+                break;
+            default: printf("Impossible statement type %d\n", statement->type); exit(EXIT_FAILURE);
+        }
+        write_non_terminal(statement->type, true, indentation, output);
+    }
+    write_non_terminal(NT_STATEMENTS, true, indentation, output);
+}
+
+void write_expression_xml(const Expression *expression, int *indentation, FILE *output) {
+    // Children: <term>, {<op>, <term>}.
+    write_non_terminal(NT_EXPRESSION, false, indentation, output);
+    for (const Term *term = expression->terms; term != NULL; term = term->next) {
+        if (term->op != '\0') {
+            write_symbol_xml(term->op, indentation, output);
+        }
+        write_term_xml(term, indentation, output);
+    }
+    write_non_terminal(NT_EXPRESSION, true, indentation, output);
+}
+
+void write_term_xml(const Term *term, int *indentation, FILE *output) {
+    // Children: everything except ()s around an <expression>.
+    write_non_terminal(NT_TERM, false, indentation, output);
+    switch (term->type) {
+        case TM_INTEGER:
+        case TM_STRING:
+        case TM_KEYWORD:
+        case TM_VARIABLE:
+            write_tag(&(term->token), indentation, output);
+            break;
+        case TM_ARRAY:
+            write_tag(&(term->token), indentation, output);
+            write_symbol_xml('[', indentation, output);
+            write_expression_xml(term->expression, indentation, output);
+            write_symbol_xml(']', indentation, output);
+            break;
+        case TM_EXPRESSION:
+            write_expression_xml(term->expression, indentation, output);
+            break;
+        case TM_UNARY:
+            write_tag(&(term->token), indentation, output);
+            write_term_xml(term->operand, indentation, output);
+            break;
+        case TM_CALL:
+            write_sub_call_xml(term->call, indentation, output);
+            break;
+    }
+    write_non_terminal(NT_TERM, true, indentation, output);
+}
+
+void write_sub_call_xml(const SubroutineCall *call, int *indentation, FILE *output) {
+    // Children: identifier, ['.', identifier], <expressionList>
+    write_non_terminal(NT_SUBROUTINE_CALL, false, indentation, output);
+    write_name_xml(call->first_name, indentation, output);
+    if (call->second_name != NULL) {
+        write_symbol_xml('.', indentation, output);
+        write_name_xml(call->second_name, indentation, output);
+    }
+    write_non_terminal(NT_EXPRESSION_LIST, false, indentation, output);
+    for (const Expression *argument = call->arguments; argument != NULL; argument = argument->next) {
+        write_expression_xml(argument, indentation, output);
+    }
+    write_non_terminal(NT_EXPRESSION_LIST, true, indentation, output);
+    write_non_terminal(NT_SUBROUTINE_CALL, true, indentation, output);
+}
+
+void write_name_xml(char *name, int *indentation, FILE *output) {
+    Tag tag = {.type = IDENTIFIER, .value.str_val = name};
+    write_tag(&tag, indentation, output);
+}
+
+void write_symbol_xml(char symbol, int *indentation, FILE *output) {
+    char string[2] = {symbol, '\0'};
+    Tag tag = {.type = SYMBOL, .value.str_val = string};
+    write_tag(&tag, indentation, output);
+}
@@ -0,0 +1,125 @@
+#ifndef AST_H
+#define AST_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "tag.h"
+
+// An Arena hands out memory from large blocks, so that a whole syntax tree can be built one node at a time and then
+// freed all at once. Internally, current is the block memory is handed out from, and each block points to the one
+// before it.
+struct ArenaBlock;
+struct Arena {
+    struct ArenaBlock *current;
+}; typedef struct Arena Arena;
+
+// Creates and returns a new empty arena.
+Arena *malloc_arena();
+// Frees everything allocated from arena, then arena itself.
+void free_arena(Arena *arena);
+// Returns size bytes of zeroed memory from arena, suitably aligned for any node.
+void *arena_alloc(Arena *arena, size_t size);
+
+// The syntax tree for a class, built by the parser and walked by the code generator. Every node lives in an arena, and
+// every name or string points into the string pool of the token list the class was parsed from, so both need to
+// outlive the tree. Lists of nodes (statements, subroutines and so on) are linked through the nodes' next pointers,
+// and an empty list is NULL. Types are kept as the original token, which is either a keyword (int, char, boolean or
+// void) or an identifier naming a class.
+
+struct Expression; typedef struct Expression Expression;
+
+// A subroutine call has the form first_name(arguments) if second_name is NULL, and first_name.second_name(arguments)
+// otherwise. arguments is a list of expressions with no_arguments entries.
+struct SubroutineCall {
+    char *first_name;
+    char *second_name;
+    Expression *arguments;
+    int no_arguments;
+}; typedef struct SubroutineCall SubroutineCall;
+
+enum TermType {
+    TM_INTEGER, TM_STRING, TM_KEYWORD, TM_VARIABLE, TM_ARRAY, TM_EXPRESSION, TM_UNARY, TM_CALL
+}; typedef enum TermType TermType;
+
+// One term of an expression. token holds the literal for TM_INTEGER, TM_STRING and TM_KEYWORD, the variable name for
+// TM_VARIABLE and TM_ARRAY, and the operator symbol for TM_UNARY. expression is the index for TM_ARRAY and the
+// bracketed expression for TM_EXPRESSION, operand is what TM_UNARY applies to, and call is the call for TM_CALL.
+//
+// Terms in an expression are linked by next. op is the binary operator joining the term to the one before it, or '\0'
+// for the first term.
+struct Term {
+    TermType type;
+    Tag token;
+    Expression *expression;
+    struct Term *operand;
+    SubroutineCall *call;
+    char op;
+    struct Term *next;
+}; typedef struct Term Term;
+
+// An expression is a list of terms joined by binary operators, which Jack evaluates from left to right. next links
+// expressions in a list of arguments.
+struct Expression {
+    Term *terms;
+    struct Expression *next;
+}; typedef struct Expression Expression;
+
+// One statement, with type NT_LET_STATEMENT, NT_IF_STATEMENT, NT_WHILE_STATEMENT, NT_DO_STATEMENT or
+// NT_RETURN_STATEMENT. For let, name is the destination variable, index is the array index or NULL, and expression is
+// the value to assign. For if and while, expression is the condition and body the statements to run; an if also has
+// else_body if has_else is set. For do, call is the call. For return, expression is the value or NULL.
+struct Statement {
+    NonTerminal type;
+    char *name;
+    Expression *index;
+    Expression *expression;
+    struct Statement *body;
+    struct Statement *else_body;
+    bool has_else;
+    SubroutineCall *call;
+    struct Statement *next;
+}; typedef struct Statement Statement;
+
+// A list of names sharing a declaration, e.g. the x and y in "field int x, y;".
+struct Name {
+    char *name;
+    struct Name *next;
+}; typedef struct Name Name;
+
+// A class variable or local variable declaration. kind is KW_STATIC, KW_FIELD or KW_VAR.
+struct VarDec {
+    Keyword kind;
+    Tag type;
+    Name *names;
+    struct VarDec *next;
+}; typedef struct VarDec VarDec;
+
+struct Parameter {
+    Tag type;
+    char *name;
+    struct Parameter *next;
+}; typedef struct Parameter Parameter;
+
+// kind is KW_CONSTRUCTOR, KW_FUNCTION or KW_METHOD.
+struct Subroutine {
+    Keyword kind;
+    Tag return_type;
+    char *name;
+    Parameter *parameters;
+    VarDec *var_decs;
+    Statement *statements;
+    struct Subroutine *next;
+}; typedef struct Subroutine Subroutine;
+
+struct Class {
+    char *name;
+    VarDec *var_decs;
+    Subroutine *subroutines;
+}; typedef struct Class Class;
+
+// Writes the syntax tree for class to output as XML, in the same form the compiler used to pass from the parser to the
+// code generator. Useful for debugging the parser.
+void write_class_xml(const Class *class, FILE *output);
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+
+int add_string(const StringPool *pool, int *slot_indices, char ***strings, int *no_strings, int *strings_space,
+               char *string);
+void write_varint(unsigned int value, FILE *output);
+
+void write_bytecode(const VMWriter *writer, FILE *output) {
+    // The string table holds every name in the order it's first used, and names[i] is the index of instruction i's
+    // name in it. Names all come from the writer's string pool, and slot_indices gives the index in the table of the
+    // name in each slot of the pool (or -1 if it isn't in the table yet).
+    int no_strings = 0;
+    int strings_space = 16;
+    char **strings = (char **)malloc(strings_space * sizeof(char *));
+    int *slot_indices = (int *)malloc(writer->strings->pool_space * sizeof(int));
+    for (int i=0; i<writer->strings->pool_space; i++) {
+        slot_indices[i] = -1;
+    }
+    int *names = (int *)malloc((writer->list_length + 1) * sizeof(int));
+    int no_instructions = 0;
+    for (int i=0; i<writer->list_length; i++) {
+        const VMInstruction *current = &(writer->list_array[i]);
+        if (current->command == VM_COMMENT) {
+            continue;
+        }
+        if (current->command >= VM_LABEL && current->command <= VM_CALL) {
+            names[i] = add_string(writer->strings, slot_indices, &strings, &no_strings, &strings_space,
+                                  current->name);
+        }
+        no_instructions++;
+    }
+
+    fputs("VMB1", output);
+    write_varint(no_strings, output);
+    for (int i=0; i<no_strings; i++) {
+        size_t length = strlen(strings[i]);
+        write_varint(length, output);
+        fwrite(strings[i], 1, length, output);
+    }
+    write_varint(no_instructions, output);
+    for (int i=0; i<writer->list_length; i++) {
+        const VMInstruction *current = &(writer->list_array[i]);
+        if (current->command == VM_COMMENT) {
+            continue;
+        }
+        fputc(current->command, output);
+        if (current->command == VM_PUSH || current->command == VM_POP) {
+            fputc(current->segment, output);
+            write_varint(current->index, output);
+        } else if (current->command >= VM_LABEL && current->command <= VM_CALL) {
+            write_varint(names[i], output);
+            if (current->command == VM_FUNCTION || current->command == VM_CALL) {
+                write_varint(current->index, output);
+            }
+        }
+    }
+
+    free(strings);
+    free(slot_indices);
+    free(names);
+}
+
+// Returns the index of string, which is in pool, in *strings, adding it to the end (and growing the array if need be)
+// if it isn't there already. The strings aren't copied. slot_indices is as in write_bytecode.
+int add_string(const StringPool *pool, int *slot_indices, char ***strings, int *no_strings, int *strings_space,
+               char *string) {
+    int slot = get_string_slot(pool, string);
+    if (slot_indices[slot] >= 0) {
+        return slot_indices[slot];
+    }
+    if (*no_strings == *strings_space) {
+        *strings_space *= 2;
+        *strings = (char **)realloc(*strings, *strings_space * sizeof(char *));
+    }
+    (*strings)[*no_strings] = string;
+    slot_indices[slot] = *no_strings;
+    (*no_strings)++;
+    return *no_strings - 1;
+}
+
+// Writes value to output as a varint: seven bits at a time starting from the lowest, with the top bit of each byte set
+// if more bytes follow.
+void write_varint(unsigned int value, FILE *output) {
+    while (value >= 0x80) {
+        fputc((value & 0x7F) | 0x80, output);
+        value >>= 7;
+    }
+    fputc(value, output);
+}
@@ -0,0 +1,7 @@
+#include <stdio.h>
+#include "vmwriter.h"
+
+// Writes the VM code collected by writer to output (which should be opened in binary mode) in the binary .vmb format
+// understood by the week 10 VM translator. See bytecode.h in the VM translator for the format; the opcode and segment
+// numbers used here come straight from the VMKeyword enum, which must match its Keyword enum.
+void write_bytecode(const VMWriter *writer, FILE *output);
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+int find_slot(char **array, int space, const char *string, int length);
+
+StringPool *malloc_string_pool() {
+    const int initial_space = 256;
+
+    StringPool *pool = (StringPool *)malloc(sizeof(StringPool));
+    pool->pool_length = 0;
+    pool->pool_space = initial_space;
+    pool->pool_array = (char **)calloc(initial_space, sizeof(char *));
+    return pool;
+}
+
+void free_string_pool(StringPool *pool) {
+    for (int i=0; i<pool->pool_space; i++) {
+        free(pool->pool_array[i]);
+    }
+    free(pool->pool_array);
+    free(pool);
+}
+
+char *intern_string(StringPool *pool, const char *string, int length) {
+    int slot = find_slot(pool->pool_array, pool->pool_space, string, length);
+    if (pool->pool_array[slot] != NULL) {
+        return pool->pool_array[slot];
+    }
+
+    char *copy = (char *)malloc(length + 1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    pool->pool_array[slot] = copy;
+    pool->pool_length++;
+
+    // If the table is now half full, double its size and put every string in its new slot.
+    if (2 * pool->pool_length >= pool->pool_space) {
+        int new_space = 2 * pool->pool_space;
+        char **new_array = (char **)calloc(new_space, sizeof(char *));
+        for (int i=0; i<pool->pool_space; i++) {
+            if (pool->pool_array[i] != NULL) {
+                char *current = pool->pool_array[i];
+                new_array[find_slot(new_array, new_space, current, strlen(current))] = current;
+            }
+        }
+        free(pool->pool_array);
+        pool->pool_array = new_array;
+        pool->pool_space = new_space;
+    }
+    return copy;
+}
+
+int get_string_slot(const StringPool *pool, const char *string) {
+    return find_slot(pool->pool_array, pool->pool_space, string, strlen(string));
+}
+
+// FNV-1a, which is simple and spreads out short names well.
+unsigned int hash_string(const char *string, int length) {
+    unsigned int hash = 2166136261u;
+    for (int i=0; i<length; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the slot in the hash table array (with space slots) holding the given string, or the empty slot it belongs
+// in if it isn't there.
+int find_slot(char **array, int space, const char *string, int length) {
+    int slot = hash_string(string, length) & (space - 1);
+    while (array[slot] != NULL &&
+           (strncmp(array[slot], string, length) != 0 || array[slot][length] != '\0')) {
+        slot = (slot + 1) & (space - 1);
+    }
+    return slot;
+}
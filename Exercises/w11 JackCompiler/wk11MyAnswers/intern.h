@@ -0,0 +1,25 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+// A StringPool holds a single copy of every distinct string added to it, so two strings from the same pool are equal
+// exactly when their pointers are. The strings live until the pool is freed. Internally pool_array is a hash table with
+// pool_space slots (always a power of two, and never more than half full), with NULL in the empty slots.
+struct StringPool {
+    char **pool_array;
+    int pool_length;
+    int pool_space;
+}; typedef struct StringPool StringPool;
+
+// Creates and returns a new empty string pool.
+StringPool *malloc_string_pool();
+// Frees every string in pool, then pool itself.
+void free_string_pool(StringPool *pool);
+// Returns the pool's copy of the first length characters of string, adding it to the pool if it isn't there yet.
+char *intern_string(StringPool *pool, const char *string, int length);
+// Returns the slot of pool->pool_array holding string, which must be in the pool. Slots only change when a string is
+// added, so until then they can index a table of pool_space entries kept alongside the pool.
+int get_string_slot(const StringPool *pool, const char *string);
+// Returns the hash of the first length characters of string used by the pool.
+unsigned int hash_string(const char *string, int length);
+
+#endif
@@ -4,138 +4,480 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include "tag.h"
+#include "ast.h"
 #include "symboltable.h"
-
+#include "vmwriter.h"
+#include "bytecode.h"
+
+// C commands for folder handling and threads are different between Windows and Linux, as in the VM translator.
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#define MAX_PATH 2500
+#endif
 
 // Lexing functions
-void lex_file(FILE *input, FILE *output);
-void lex_line(const char *line, FILE *output);
-int lex_token(Tag *dest, const char *line);
+void lex_file(FILE *input, TagList *tokens);
+void lex_line(const char *line, TagList *tokens, bool *inside_comment);
+int lex_token(Tag *dest, const char *line, StringPool *strings);
+
+// Holds the list of tokens we're parsing and our position in it, and the arena to build the syntax tree in. The current
+// token is tokens->list_array[position], and lookahead is the token after it. Either is NULL if we've run out of tokens.
+struct ParseData {
+    TagList *tokens;
+    int position;
+    Tag *current;
+    Tag *lookahead;
+    Arena *arena;
+}; typedef struct ParseData ParseData;
 
 // Parsing functions
-void parse_file(FILE *input, FILE *output);
-void parse_class(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_class_var_dec(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_sub_dec(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_parameter_list(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_sub_body(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_var_dec(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_statements(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_let_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_if_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_while_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_do_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_return_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_expression(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_sub_call(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_term(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-void parse_expression_list(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-
-// Holds pointers to all the data we'll need during the compilation process to save us from having to pass seven
-// arguments around in every single function call.
+Class *parse_file(TagList *tokens, Arena *arena);
+void advance_token(ParseData *data);
+Class *parse_class(ParseData *data);
+VarDec *parse_class_var_dec(ParseData *data);
+Subroutine *parse_sub_dec(ParseData *data);
+Parameter *parse_parameter_list(ParseData *data);
+void parse_sub_body(ParseData *data, Subroutine *sub);
+VarDec *parse_var_dec(ParseData *data);
+Statement *parse_statements(ParseData *data);
+Statement *parse_let_statement(ParseData *data);
+Statement *parse_if_statement(ParseData *data);
+Statement *parse_while_statement(ParseData *data);
+Statement *parse_do_statement(ParseData *data);
+Statement *parse_return_statement(ParseData *data);
+Expression *parse_expression(ParseData *data);
+SubroutineCall *parse_sub_call(ParseData *data);
+Term *parse_term(ParseData *data);
+void parse_expression_list(ParseData *data, SubroutineCall *call);
+
+// Holds pointers to all the data we'll need during the compilation process to save us from having to pass it around
+// in every single function call. if_count and while_count are the number of if and while statements compiled so far in
+// the class, which we use to give each one its own labels. The VM code goes to writer.
 struct CompileData {
-    Tag *current;
-    Tag *lookahead;
     SymbolTable *class_table;
     SymbolTable *subroutine_table;
     char *class_name;
-    FILE *input;
-    FILE *output;
+    int if_count;
+    int while_count;
+    VMWriter *writer;
 }; typedef struct CompileData CompileData;
 
-void compile_file(FILE *input, FILE *output);
-void compile_class(CompileData *data);
-void compile_class_var_dec(CompileData *data);
-void compile_sub_dec(CompileData *data);
-void compile_parameter_list(CompileData *data);
-void compile_sub_body(CompileData *data, Keyword sub_kind, char *sub_name);
-void compile_var_dec(CompileData *data);
-void compile_statements(CompileData *data);
-void compile_let_statement(CompileData *data);
-void compile_if_statement(CompileData *data);
-void compile_while_statement(CompileData *data);
-void compile_do_statement(CompileData *data);
-void compile_return_statement(CompileData *data);
-void compile_expression(CompileData *data);
-void compile_sub_call(CompileData *data);
-void compile_term(CompileData *data);
-int compile_expression_list(CompileData *data);
-char *type_to_string(Tag *current);
-void var_to_string(TableEntry *var_entry, char *buffer);
+// While compile_expression works through an expression, the value of the part it's done so far is in one of three
+// states: a constant known at compile time, a single term which hasn't been compiled yet, or already on the stack.
+enum FoldState {
+    FS_KNOWN, FS_PENDING, FS_ON_STACK
+}; typedef enum FoldState FoldState;
+
+void compile_file(const Class *class, VMWriter *writer);
+void compile_class(CompileData *data, const Class *class);
+void compile_class_var_dec(CompileData *data, const VarDec *var_dec);
+void compile_sub_dec(CompileData *data, const Subroutine *sub);
+void compile_parameter_list(CompileData *data, const Parameter *parameters);
+void compile_sub_body(CompileData *data, const Subroutine *sub);
+void compile_var_dec(CompileData *data, const VarDec *var_dec);
+void compile_statements(CompileData *data, const Statement *statements);
+void compile_let_statement(CompileData *data, const Statement *statement);
+void compile_if_statement(CompileData *data, const Statement *statement);
+void compile_while_statement(CompileData *data, const Statement *statement);
+void compile_do_statement(CompileData *data, const Statement *statement);
+void compile_return_statement(CompileData *data, const Statement *statement);
+void compile_expression(CompileData *data, const Expression *expression);
+void compile_sub_call(CompileData *data, const SubroutineCall *call);
+void compile_term(CompileData *data, const Term *term);
+int compile_expression_list(CompileData *data, const Expression *expressions);
+char *type_to_string(const Tag *current);
+VMKeyword var_segment(const TableEntry *var_entry);
+void emit_constant(CompileData *data, int value);
+void emit_operator(CompileData *data, char op);
+bool term_value(const Term *term, int *value);
+bool expression_value(const Expression *expression, int *value);
+bool fold_operator(char op, int left, int right, int *result);
+bool is_identity(char op, int value);
+bool is_absorbing(char op, int value);
+bool is_pure_term(const Term *term);
+bool is_pure_expression(const Expression *expression);
+bool is_same_variable(const Term *first, const Term *second);
+const Term *strip_brackets(const Term *term);
+int to_word(int value);
+
+// Optional settings given on the command line after the input and output names. parse_tree_name is the name of a file
+// to write the syntax tree of the class to as XML, or NULL not to (only for a single file). In folder mode, binary is
+// true if each class should be written as a .vmb file rather than a .vm file, and no_threads is the number of classes
+// to compile at once (0 for one per processor). If debug_flush is true, each VM instruction is written out as soon as
+// it's generated rather than all at once at the end.
+struct Options {
+    char *parse_tree_name;
+    bool binary;
+    int no_threads;
+    bool debug_flush;
+}; typedef struct Options Options;
+
+// Threads and locks are different between Windows and Linux, like folders. Compiling a folder only needs the basics.
+#ifdef _WIN32
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Lock;
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Lock;
+#endif
+
+// Everything the threads compiling a folder share. Each class is compiled entirely by one thread with state of its
+// own, so the only thing they need to agree on is which class to compile next: the classes are input_names[i] for
+// i < no_files, to be written to output_names[i], and next_file is the first one no thread has taken yet. A thread
+// must hold lock while it reads or changes next_file. debug_flush is passed on to compile_jack_file.
+struct FolderJob {
+    char **input_names;
+    char **output_names;
+    int no_files;
+    int next_file;
+    bool debug_flush;
+    Lock lock;
+}; typedef struct FolderJob FolderJob;
+
+void read_options(int argc, char *argv[], Options *options);
+void compile_jack_file(const char *input_name, const char *output_name, const char *parse_tree_name, bool debug_flush);
+void compile_folder(const char *input_path, const char *output_path, const Options *options);
+void run_folder_job(FolderJob *job);
+int count_processors();
+bool is_folder(const char *path);
+bool has_extension(const char *path, const char *extension);
+int list_jack_files(const char *path, char ***list);
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Please supply two arguments: an input .jack file, and an output .vm file.");
+    if (argc < 3) {
+        printf("Please supply two arguments: an input .jack file, and an output .vm or .vmb file. Alternatively, give a "
+               "folder of .jack files and a folder to write a .vm file for each class to. These can be followed by:\n"
+               "    --parse-tree [file] Write the syntax tree of the class to the given file as XML.\n"
+               "    --vmb               In folder mode, write .vmb files rather than .vm files.\n"
+               "    --threads [n]       In folder mode, compile n classes at once (default one per processor).\n"
+               "    --debug-flush       Write out each VM instruction as soon as it's generated, so that the code so far\n"
+               "                        survives a crash (to stdout for .vmb files).\n");
         exit(EXIT_FAILURE);
     }
     char *input_name = argv[1];
     char *output_name = argv[2];
+    Options options;
+    read_options(argc, argv, &options);
+
+    if (is_folder(input_name)) {
+        if (options.parse_tree_name != NULL) {
+            printf("Please only ask for a parse tree when compiling a single file.\n");
+            exit(EXIT_FAILURE);
+        }
+        compile_folder(input_name, output_name, &options);
+    } else {
+        compile_jack_file(input_name, output_name, options.parse_tree_name, options.debug_flush);
+    }
 
+    return EXIT_SUCCESS;
+}
+
+// Reads the options after the input and output names on the command line into options.
+void read_options(int argc, char *argv[], Options *options) {
+    options->parse_tree_name = NULL;
+    options->binary = false;
+    options->no_threads = 0;
+    options->debug_flush = false;
+    for (int i=3; i<argc; i++) {
+        if (strcmp(argv[i], "--parse-tree") == 0 && i+1 < argc) {
+            options->parse_tree_name = argv[i+1];
+            i++;
+        } else if (strcmp(argv[i], "--vmb") == 0) {
+            options->binary = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            options->no_threads = strtol(argv[i+1], NULL, 10);
+            i++;
+        } else if (strcmp(argv[i], "--debug-flush") == 0) {
+            options->debug_flush = true;
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Compiles the class in the .jack file input_name into VM code, and writes it to output_name as a .vm file, or as a
+// .vmb file if that's its extension. If parse_tree_name isn't NULL, the class's syntax tree is also written there as
+// XML. The VM code is collected in memory and written in one go at the end, unless debug_flush is true, in which case
+// each instruction is written (to stdout for a .vmb file) and flushed as it's generated. Everything this needs is
+// allocated here, so it's safe to compile several files at once on different threads.
+void compile_jack_file(const char *input_name, const char *output_name, const char *parse_tree_name, bool debug_flush) {
     FILE *input = fopen(input_name, "r");
     if (input == NULL) {
-        printf("Error opening input file.\n");
-        exit(EXIT_FAILURE);
-    }
-    FILE *lex_output = fopen("lex_out.xml", "w");
-    if (lex_output == NULL) {
-        printf("Error opening lex_out.xml for writing.\n");
+        printf("Error opening input file %s.\n", input_name);
         exit(EXIT_FAILURE);
     }
-    lex_file(input, lex_output);
+    TagList *tokens = malloc_tag_list();
+    lex_file(input, tokens);
     fclose(input);
-    fclose(lex_output);
 
-    FILE *lex_input = fopen("lex_out.xml", "r");
-    if (lex_input == NULL) {
-        printf("Error opening lex_out.xml for reading.\n");
+    Arena *arena = malloc_arena();
+    Class *class = parse_file(tokens, arena);
+
+    if (parse_tree_name != NULL) {
+        FILE *parse_output = fopen(parse_tree_name, "w");
+        if (parse_output == NULL) {
+            printf("Error opening %s for writing.\n", parse_tree_name);
+            exit(EXIT_FAILURE);
+        }
+        write_class_xml(class, parse_output);
+        fclose(parse_output);
+    }
+
+    bool binary = has_extension(output_name, ".vmb");
+    FILE *output = fopen(output_name, binary ? "wb" : "w");
+    if (output == NULL) {
+        printf("Error opening output file %s.\n", output_name);
         exit(EXIT_FAILURE);
     }
-    FILE *parse_output = fopen("parse_out.xml", "w");
-    if (parse_output == NULL) {
-        printf("Error opening parse_out.xml for writing.\n");
+
+    VMWriter *writer = malloc_vm_writer(!debug_flush ? NULL : binary ? stdout : output);
+    compile_file(class, writer);
+    free_arena(arena);
+    free_tag_list(tokens);
+
+    if (binary) {
+        write_bytecode(writer, output);
+    } else if (!debug_flush) { // Otherwise the debug output already wrote everything.
+        write_vm_code(writer, output);
+    }
+    free_vm_writer(writer);
+    fclose(output);
+}
+
+#ifdef _WIN32
+DWORD WINAPI folder_thread(LPVOID job) {
+    run_folder_job((FolderJob *)job);
+    return 0;
+}
+#else
+void *folder_thread(void *job) {
+    run_folder_job((FolderJob *)job);
+    return NULL;
+}
+#endif
+
+// Compiles every .jack file in the folder at input_path, writing the code for each class to a .vm or .vmb file of the
+// same name in the folder at output_path (which must already exist). The classes are shared out between a pool of
+// threads.
+void compile_folder(const char *input_path, const char *output_path, const Options *options) {
+    FolderJob job;
+    job.no_files = list_jack_files(input_path, &(job.input_names));
+    job.next_file = 0;
+    job.debug_flush = options->debug_flush;
+    if (job.no_files == 0) {
+        printf("No .jack files found in specified folder.\n");
         exit(EXIT_FAILURE);
     }
-    parse_file(lex_input, parse_output);
-    fclose(lex_input);
-    fclose(parse_output);
 
-    FILE *parse_input = fopen("parse_out.xml", "r");
-    if (parse_input == NULL) {
-        printf("Error opening parse_out.xml for reading.\n");
+    // Foo.jack becomes Foo.vm (or Foo.vmb) in the output folder.
+    job.output_names = (char **)malloc(job.no_files * sizeof(char *));
+    for (int i=0; i<job.no_files; i++) {
+        const char *name = job.input_names[i] + strlen(job.input_names[i]);
+        while (name > job.input_names[i] && name[-1] != '/' && name[-1] != '\\') {
+            name--;
+        }
+        job.output_names[i] = (char *)malloc(strlen(output_path) + strlen(name) + 2);
+        sprintf(job.output_names[i], "%s/%.*s%s", output_path, (int)strlen(name) - 5, name,
+                options->binary ? ".vmb" : ".vm");
+    }
+
+    int no_threads = (options->no_threads > 0) ? options->no_threads : count_processors();
+    if (no_threads > job.no_files) {
+        no_threads = job.no_files;
+    }
+    Thread *threads = (Thread *)malloc(no_threads * sizeof(Thread));
+#ifdef _WIN32
+    InitializeCriticalSection(&(job.lock));
+    for (int i=0; i<no_threads; i++) {
+        threads[i] = CreateThread(NULL, 0, folder_thread, &job, 0, NULL);
+    }
+    WaitForMultipleObjects(no_threads, threads, TRUE, INFINITE);
+    for (int i=0; i<no_threads; i++) {
+        CloseHandle(threads[i]);
+    }
+    DeleteCriticalSection(&(job.lock));
+#else
+    pthread_mutex_init(&(job.lock), NULL);
+    for (int i=0; i<no_threads; i++) {
+        pthread_create(&(threads[i]), NULL, folder_thread, &job);
+    }
+    for (int i=0; i<no_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&(job.lock));
+#endif
+
+    free(threads);
+    for (int i=0; i<job.no_files; i++) {
+        free(job.input_names[i]);
+        free(job.output_names[i]);
+    }
+    free(job.input_names);
+    free(job.output_names);
+}
+
+// Compiles classes from job until there are none left. Each thread compiling a folder runs this.
+void run_folder_job(FolderJob *job) {
+    while (true) {
+#ifdef _WIN32
+        EnterCriticalSection(&(job->lock));
+        int file = job->next_file++;
+        LeaveCriticalSection(&(job->lock));
+#else
+        pthread_mutex_lock(&(job->lock));
+        int file = job->next_file++;
+        pthread_mutex_unlock(&(job->lock));
+#endif
+        if (file >= job->no_files) {
+            return;
+        }
+        compile_jack_file(job->input_names[file], job->output_names[file], NULL, job->debug_flush);
+    }
+}
+
+// Returns the number of processors available to run threads on.
+int count_processors() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? count : 1;
+#endif
+}
+
+// Note that folder names can have .s in them, so we do need to do this the clever way.
+bool is_folder(const char *path) {
+#ifdef _WIN32
+    // Supplied by windows.h
+    DWORD attributes = GetFileAttributesA(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        printf("Input file/folder not found.");
         exit(EXIT_FAILURE);
     }
-    FILE *output = fopen(output_name, "w");
-    if (output == NULL) {
-        printf("Error opening output file.");
+    return attributes & FILE_ATTRIBUTE_DIRECTORY;
+#else
+    // Supplied by sys/stat.h
+    struct stat buffer;
+    if (stat(path, &buffer) != 0) {
+        printf("Input file/folder not found.");
         exit(EXIT_FAILURE);
+    };
+    return S_ISDIR(buffer.st_mode);
+#endif
+}
+
+// Returns true if path ends in the given extension (ignoring case), e.g. has_extension("Main.JACK", ".jack") is true.
+bool has_extension(const char *path, const char *extension) {
+    int path_length = strlen(path);
+    int extension_length = strlen(extension);
+    if (path_length < extension_length) {
+        return false;
     }
+    for (int i=0; i<extension_length; i++) {
+        if (tolower(path[path_length - extension_length + i]) != tolower(extension[i])) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    // Debugging help
-    setbuf(output, NULL);
+// Sets **list to a list of paths of all .jack files in the folder path, and returns the length of the list. This works
+// just like list_vm_files in the VM translator.
+int list_jack_files(const char *path, char ***list) {
+#ifdef _WIN32
+    // This is all from windows.h.
+    WIN32_FIND_DATA fd_file;
+    HANDLE hFind = NULL;
+
+    char s_path[2048];
+    sprintf(s_path, "%s\\*.jack", path);
+    int length = 0;
+
+    hFind = FindFirstFile(s_path, &fd_file);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        *list = NULL;
+        return 0;
+    }
+    do {
+        if (has_extension(fd_file.cFileName, ".jack")) {
+            length++;
+        }
+    } while(FindNextFile(hFind, &fd_file));
+    FindClose(hFind);
+
+    *list = (char **)malloc(length * sizeof(char *));
+    hFind = FindFirstFile(s_path, &fd_file);
+    int i = 0;
+    do {
+        if (has_extension(fd_file.cFileName, ".jack")) {
+            (*list)[i] = (char *)malloc((MAX_PATH+1)*sizeof(char));
+            sprintf((*list)[i], "%s\\%s", path, fd_file.cFileName);
+            i++;
+        }
+    } while(FindNextFile(hFind, &fd_file));
+    FindClose(hFind);
 
-    compile_file(parse_input, output);
-    fclose(parse_input);
-    fclose(output);
+    return length;
+#else
+    // This is all from dirent.h
+    DIR *dir;
+    struct dirent *entry;
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        printf("Error opening folder");
+        exit(EXIT_FAILURE);
+    }
 
-    return EXIT_SUCCESS;
+    int length = 0;
+    entry = readdir(dir);
+    while (entry != NULL) {
+        if (has_extension(entry->d_name, ".jack")) {
+            length++;
+        }
+        entry = readdir(dir);
+    }
+    closedir(dir);
+
+    *list = (char **)malloc(length * sizeof(char *));
+    int i = 0;
+    dir = opendir(path);
+    entry = readdir(dir);
+    while (entry != NULL) {
+        if (has_extension(entry->d_name, ".jack")) {
+            (*list)[i] = (char *)malloc((MAX_PATH+1)*sizeof(char));
+            sprintf((*list)[i], "%s/%s", path, entry->d_name);
+            i++;
+        }
+        entry = readdir(dir);
+    }
+    closedir(dir);
+
+    return length;
+#endif
 }
 
-// Outputs a tokenised version of input to output.
-void lex_file(FILE *input, FILE *output) {
+// Tokenises input, adding the tokens to the end of tokens.
+void lex_file(FILE *input, TagList *tokens) {
     char line[MAX_LINE_LENGTH];
-    write_non_terminal(NT_TOKENS, false, output);
+    bool inside_comment = false;
     while (fgets(line, MAX_LINE_LENGTH, input) != NULL) {
-        lex_line(line, output);
+        lex_line(line, tokens, &inside_comment);
     }
-    write_non_terminal(NT_TOKENS, true, output);
 }
 
-// Reads the next line from input, tokenises it, and writes the resulting tokens to output.
-void lex_line(const char *line, FILE *output) {
-    // This will be true if we are currently inside a comment of the form /*...*/ (which may have started on a
-    // previous line).
-    static bool inside_comment = false;
-
+// Tokenises the given line of input, adding the resulting tokens to the end of tokens. *inside_comment is true if we
+// are currently inside a comment of the form /*...*/ (which may have started on a previous line), and is updated for
+// the next line.
+void lex_line(const char *line, TagList *tokens, bool *inside_comment) {
     int pos = 0;
     // In each iteration of this loop, everything up to line[pos] has been lexed.
     // NB newlines aren't tokens in Jack, so no need to care about \n versus \r\n.
@@ -147,10 +489,10 @@ void lex_line(const char *line, FILE *output) {
         }
 
         // If we are inside a comment, ignore everything until the end of the comment.
-        if (inside_comment) {
+        if (*inside_comment) {
             if (line[pos] == '*' && line[pos+1] == '/') {
                 pos++;
-                inside_comment = false;
+                *inside_comment = false;
             }
             pos++;
             continue;
@@ -161,22 +503,22 @@ void lex_line(const char *line, FILE *output) {
             return;
         } else if (line[pos] == '/' && line[pos+1] == '*') {
             // Note the comment may end on this line
-            inside_comment = true;
+            *inside_comment = true;
             pos += 2;
             continue;
         }
 
         // Otherwise, we have at least one token, so lex it.
-        Tag *next = malloc_tag();
-        pos += lex_token(next, line + pos);
-        write_tag(next, output);
-        free_tag(&next);
+        Tag next;
+        next.close_tag = false;
+        pos += lex_token(&next, line + pos, tokens->strings);
+        add_tag(tokens, &next);
     }
 }
 
 // Reads the next token from a non-empty, non-label, non-comment line into dest, then returns the number of characters
-// in that token.
-int lex_token(Tag *dest, const char *line) {
+// in that token. Any string in the token is interned in strings.
+int lex_token(Tag *dest, const char *line, StringPool *strings) {
     int length;
 
     if (line[0] >= '0' && line[0] <= '9') {
@@ -193,18 +535,14 @@ int lex_token(Tag *dest, const char *line) {
         dest->type = STRING_LITERAL;
         for (length = 1; line[length] != '\"'; length++);
         length++;
-        dest->value.str_val = (char *) malloc(length-1);
-        strncpy(dest->value.str_val, line+1, length-2);
-        dest->value.str_val[length-2] = '\0'; // Strncpy doesn't null-terminate.
+        dest->value.str_val = intern_string(strings, line+1, length-2);
     } else if (line[0] == '{' || line[0] == '}' || line[0] == '(' || line[0] == ')' || line[0] == '[' ||
                line[0] == ']' || line[0] == '.' || line[0] == ',' || line[0] == ';' || line[0] == '+' ||
                line[0] == '-' || line[0] == '*' || line[0] == '/' || line[0] == '&' || line[0] == '|' ||
                line[0] == '<' || line[0] == '=' || line[0] == '>' || line[0] == '~'){
         dest->type = SYMBOL;
         length = 1;
-        dest->value.str_val = (char *)(malloc(2));
-        dest->value.str_val[0] = line[0];
-        dest->value.str_val[1] = '\0';
+        dest->value.str_val = intern_string(strings, line, 1);
     } else { // We either have an identifier or a keyword.
         // Either way, it keeps going until a character other than a letter, a digit, or an underscore.
         length = 0;
@@ -257,101 +595,99 @@ int lex_token(Tag *dest, const char *line) {
             dest->value.key_val = KW_RETURN;
         } else { // We've now ruled out all the keywords, so it must be an identifier.
             dest->type = IDENTIFIER;
-            dest->value.str_val = (char *)malloc(length+1);
-            strncpy(dest->value.str_val, line, length);
-            dest->value.str_val[length] = '\0'; // Strncpy doesn't null-terminate.
+            dest->value.str_val = intern_string(strings, line, length);
         }
     }
     return length;
 }
 
-// Input should be a tokenised file. Writes a parse tree in XML form to output.
-void parse_file(FILE *input, FILE *output) {
-    Tag **lookahead = malloc(sizeof(Tag *));
-    *lookahead = NULL;
-    Tag **current = malloc(sizeof(Tag *));
-    *current = NULL;
-    advance_tag(current, lookahead, input);
-    advance_tag(current, lookahead, input);
-    // Now *current points to the first tag in the file, and *lookahead points to the second tag.
-    // Note that copy_tag and advance_tag handle malloc'ing and free'ing for us.
-
-    // This tag is in there purely to conform to the XML standard --- see the lab sheet.
-    if ((*current)->type != NON_TERMINAL || (*current)->value.nt_val != NT_TOKENS) {
-        printf("Error: Token list should start with <tokens>.\n");
-        exit(EXIT_FAILURE);
-    }
-    advance_tag(current, lookahead, input);
-
-    // Now we should be at the class declaration, which we parse in full.
-    if ((*current)->type != KEYWORD || (*current)->value.nt_val != KW_CLASS) {
+// Builds the syntax tree for the given list of tokens in arena and returns it.
+Class *parse_file(TagList *tokens, Arena *arena) {
+    ParseData *data = malloc(sizeof(ParseData));
+    data->tokens = tokens;
+    data->arena = arena;
+    data->position = -1;
+    advance_token(data);
+    // Now data->current points to the first tag in the list, and data->lookahead points to the second tag.
+
+    // We should be at the class declaration, which we parse in full.
+    if (data->current == NULL || data->current->type != KEYWORD || data->current->value.key_val != KW_CLASS) {
         printf("Error: All Jack files should consist of a single class.\n");
         exit(EXIT_FAILURE);
     }
-    parse_class(current, lookahead, input, output);
+    Class *class = parse_class(data);
 
-    // Now our current tag should be the </tokens> tag at the end of the file, and lookahead should be null.
-    if ((*lookahead) != NULL) {
+    // Now we should have run out of tokens.
+    if (data->current != NULL) {
         printf("Error: All Jack files should consist of a single class.\n");
         exit(EXIT_FAILURE);
-    } if ((*current)->type != NON_TERMINAL || (*current)->value.nt_val != NT_TOKENS) {
-        printf("Error: Token list should end with </tokens>.\n");
-        exit(EXIT_FAILURE);
     }
-    advance_tag(current, lookahead, input);
-    // Current and lookahead are already freed.
+    free(data);
+    return class;
+}
+
+// Moves on to the next token in the list, setting data->current and data->lookahead to NULL if we run out.
+void advance_token(ParseData *data) {
+    data->position++;
+    int length = data->tokens->list_length;
+    data->current = (data->position < length) ? &(data->tokens->list_array[data->position]) : NULL;
+    data->lookahead = (data->position + 1 < length) ? &(data->tokens->list_array[data->position + 1]) : NULL;
 }
 
 // The general "contract" of a parse_*** function should be: If e.g. parse_if_statement is called, then "current" points
 // to the first token of an <ifStatement> non-terminal, and "lookahead" points to the token after "current". On function
 // return, "current" will point to the token after the last token in that <ifStatement> (i.e. after the ';') and
-// "lookahead" will once again point to the token after "current".
+// "lookahead" will once again point to the token after "current". The function returns the new node, allocated in
+// data->arena.
 // This is what careful error-checking looks like.
-// Children in AST: class name identifier, <classVarDec>, <subroutineDec>.
-void parse_class(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Class *parse_class(ParseData *data) {
     // Syntax is 'class', identifier, '{', {<classVarDec>}, {<subroutineDec>}, '}'
-    write_non_terminal(NT_CLASS, false, output);
-    advance_tag(current, lookahead, input);
+    Class *class = arena_alloc(data->arena, sizeof(Class));
+    VarDec **next_var_dec = &(class->var_decs);
+    Subroutine **next_sub = &(class->subroutines);
+    advance_token(data);
 
-    if ((*current)->type != IDENTIFIER) {
+    if (data->current->type != IDENTIFIER) {
         printf("Error: <class> expected identifier token.\n");
         exit(EXIT_FAILURE);
     }
-    copy_tag(current, lookahead, input, output);
+    class->name = data->current->value.str_val;
+    advance_token(data);
 
-    if ((*current)->type != SYMBOL || strcmp((*current)->value.str_val, "{") != 0) {
+    if (data->current->type != SYMBOL || strcmp(data->current->value.str_val, "{") != 0) {
         printf("Error: <class> expected '{' token.\n");
         exit(EXIT_FAILURE);
     }
-    advance_tag(current, lookahead, input);
+    advance_token(data);
 
     bool var_dec_over = false;
     while (true) {
-        // If we see a } then the class is over, close the tag and return.
-        if ((*current)->type == SYMBOL && strcmp((*current)->value.str_val, "}") == 0) {
-            advance_tag(current, lookahead, input);
-            write_non_terminal(NT_CLASS, true, output);
-            return;
+        // If we see a } then the class is over.
+        if (data->current->type == SYMBOL && strcmp(data->current->value.str_val, "}") == 0) {
+            advance_token(data);
+            return class;
         }
 
         // A 'static' or a 'field' means this is a variable declaration. A 'constructor', 'function' or 'method' means
         // this is a subroutine declaration. Anything else is unexpected.
-        if ((*current)->type == KEYWORD && ((*current)->value.key_val == KW_STATIC || (*current)->value.key_val == KW_FIELD)) {
+        if (data->current->type == KEYWORD && (data->current->value.key_val == KW_STATIC || data->current->value.key_val == KW_FIELD)) {
             if (var_dec_over) {
                 printf("Error: All variables must occur at start of class declaration.\n");
                 exit(EXIT_FAILURE);
             }
-            parse_class_var_dec(current, lookahead, input, output);
-        } else if ((*current)->type == KEYWORD && ((*current)->value.key_val == KW_CONSTRUCTOR ||
-                        (*current)->value.key_val == KW_METHOD || (*current)->value.key_val == KW_FUNCTION)) {
+            *next_var_dec = parse_class_var_dec(data);
+            next_var_dec = &((*next_var_dec)->next);
+        } else if (data->current->type == KEYWORD && (data->current->value.key_val == KW_CONSTRUCTOR ||
+                        data->current->value.key_val == KW_METHOD || data->current->value.key_val == KW_FUNCTION)) {
             var_dec_over = true;
-            parse_sub_dec(current, lookahead, input, output);
+            *next_sub = parse_sub_dec(data);
+            next_sub = &((*next_sub)->next);
         } else {
             printf("Error: Unexpected token in <class>.\n");
             exit(EXIT_FAILURE);
         }
 
-        if (current == NULL) {
+        if (data->current == NULL) {
             printf("Error: <class> expected '}' token.\n");
             exit(EXIT_FAILURE);
         }
@@ -359,229 +695,225 @@ void parse_class(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
 }
 
 // This is what a lack of error-checking looks like. It's much easier!
-// Children in AST: kind keyword (static/field), type keyword, list of identifiers.
-void parse_class_var_dec(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+VarDec *parse_class_var_dec(ParseData *data) {
     // Syntax: ('static' | 'field'), ('int' | 'char' | 'boolean' | identifier), identifier, {',', identifier}*, ';'
-    write_non_terminal(NT_CLASS_VAR_DEC, false, output);
-
-    copy_tag(current, lookahead, input, output);
-    copy_tag(current, lookahead, input, output);
-    copy_tag(current, lookahead, input, output);
+    VarDec *var_dec = arena_alloc(data->arena, sizeof(VarDec));
+    var_dec->kind = data->current->value.key_val;
+    advance_token(data);
+    var_dec->type = *(data->current);
+    advance_token(data);
 
-    while ((*current)->type != SYMBOL || strcmp((*current)->value.str_val, ";") != 0) {
-        advance_tag(current, lookahead, input);
-        copy_tag(current, lookahead, input, output);
+    Name **next_name = &(var_dec->names);
+    while (true) {
+        *next_name = arena_alloc(data->arena, sizeof(Name));
+        (*next_name)->name = data->current->value.str_val;
+        next_name = &((*next_name)->next);
+        advance_token(data);
+        if (data->current->type == SYMBOL && strcmp(data->current->value.str_val, ";") == 0) {
+            break;
+        }
+        advance_token(data);
     }
-    advance_tag(current, lookahead, input);
-
-    write_non_terminal(NT_CLASS_VAR_DEC, true, output);
+    advance_token(data);
+    return var_dec;
 }
 
-// Children in AST: subroutine keyword, return type keyword, subroutine name, <parameterList>, <subroutineBody>.
-void parse_sub_dec(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Subroutine *parse_sub_dec(ParseData *data) {
     // Syntax: ('constructor' | 'method' | 'function'), ('int' | 'char' | 'boolean' | 'void' | identifier), identifier,
     // '(', <parameterList>, ')', <subroutineBody>.
-    write_non_terminal(NT_SUBROUTINE_DEC, false, output);
-
-    copy_tag(current, lookahead, input, output);
-    copy_tag(current, lookahead, input, output);
-    copy_tag(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-
-    parse_parameter_list(current, lookahead, input, output);
-
-    advance_tag(current, lookahead, input);
-    parse_sub_body(current, lookahead, input, output);
-
-    write_non_terminal(NT_SUBROUTINE_DEC, true, output);
+    Subroutine *sub = arena_alloc(data->arena, sizeof(Subroutine));
+    sub->kind = data->current->value.key_val;
+    advance_token(data);
+    sub->return_type = *(data->current);
+    advance_token(data);
+    sub->name = data->current->value.str_val;
+    advance_token(data);
+    advance_token(data);
+
+    sub->parameters = parse_parameter_list(data);
+
+    advance_token(data);
+    parse_sub_body(data, sub);
+    return sub;
 }
 
-// Children in AST: {<type>, identifier}.
-void parse_parameter_list(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
-    write_non_terminal(NT_PARAMETER_LIST, false, output);
-
-    if ((*current)->type != SYMBOL || (*current)->value.str_val[0] != ')') {
-        copy_tag(current, lookahead, input, output);
-        copy_tag(current, lookahead, input, output);
-    }
-    while((*current)->type != SYMBOL || (*current)->value.str_val[0] != ')') {
-        advance_tag(current, lookahead, input);
-        copy_tag(current, lookahead, input, output);
-        copy_tag(current, lookahead, input, output);
+Parameter *parse_parameter_list(ParseData *data) {
+    // Syntax: [<type>, identifier, {',', <type>, identifier}]
+    Parameter *parameters = NULL;
+    Parameter **next_parameter = &parameters;
+    while (data->current->type != SYMBOL || data->current->value.str_val[0] != ')') {
+        if (parameters != NULL) {
+            advance_token(data);
+        }
+        *next_parameter = arena_alloc(data->arena, sizeof(Parameter));
+        (*next_parameter)->type = *(data->current);
+        advance_token(data);
+        (*next_parameter)->name = data->current->value.str_val;
+        advance_token(data);
+        next_parameter = &((*next_parameter)->next);
     }
-
-    write_non_terminal(NT_PARAMETER_LIST, true, output);
+    return parameters;
 }
 
-// Children in AST: <varDec>s, <statements>.
-void parse_sub_body(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+// Fills in the local variables and statements of sub.
+void parse_sub_body(ParseData *data, Subroutine *sub) {
     // Syntax: '{', {varDec}, <statements>, '}'
-    write_non_terminal(NT_SUBROUTINE_BODY, false, output);
-
-    advance_tag(current, lookahead, input);
-    while ((*current)->value.key_val == KW_VAR) {
-        parse_var_dec(current, lookahead, input, output);
+    advance_token(data);
+    VarDec **next_var_dec = &(sub->var_decs);
+    while (data->current->type == KEYWORD && data->current->value.key_val == KW_VAR) {
+        *next_var_dec = parse_var_dec(data);
+        next_var_dec = &((*next_var_dec)->next);
     }
-    parse_statements(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-
-    write_non_terminal(NT_SUBROUTINE_BODY, true, output);
+    sub->statements = parse_statements(data);
+    advance_token(data);
 }
 
-// Children in AST: variable keyword, type keyword, list of variable names.
-void parse_var_dec(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+VarDec *parse_var_dec(ParseData *data) {
     // Syntax: 'var', ('int' | 'char' | 'boolean' | identifier), identifier, {',', identifier}, ';'
-    write_non_terminal(NT_VAR_DEC, false, output);
-    advance_tag(current, lookahead, input);
-    copy_tag(current, lookahead, input, output);
-    copy_tag(current, lookahead, input, output);
-    while(strcmp((*current)->value.str_val, ";") != 0) {
-        advance_tag(current, lookahead, input);
-        copy_tag(current, lookahead, input, output);
-    }
-    advance_tag(current, lookahead, input);
-    write_non_terminal(NT_VAR_DEC, true, output);
+    // The rest is just like a class variable declaration.
+    return parse_class_var_dec(data);
 }
 
-// Children in AST: As in CST.
-void parse_statements(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+// Returns the list of statements, or NULL if there are none.
+Statement *parse_statements(ParseData *data) {
     // Syntax: {<letStatement> | <ifStatement> | <whileStatement> | <doStatement> | <returnStatement>}
-    write_non_terminal(NT_STATEMENTS, false, output);
-
-    while (true) {
-        switch ((*current)->value.key_val) {
-            case KW_LET: parse_let_statement(current, lookahead, input, output); break;
-            case KW_IF: parse_if_statement(current, lookahead, input, output); break;
-            case KW_WHILE: parse_while_statement(current, lookahead, input, output); break;
-            case KW_DO: parse_do_statement(current, lookahead, input, output); break;
-            case KW_RETURN: parse_return_statement(current, lookahead, input, output); break;
-            default: write_non_terminal(NT_STATEMENTS, true, output); return;
+    Statement *statements = NULL;
+    Statement **next_statement = &statements;
+
+    while (data->current->type == KEYWORD) {
+        switch (data->current->value.key_val) {
+            case KW_LET: *next_statement = parse_let_statement(data); break;
+            case KW_IF: *next_statement = parse_if_statement(data); break;
+            case KW_WHILE: *next_statement = parse_while_statement(data); break;
+            case KW_DO: *next_statement = parse_do_statement(data); break;
+            case KW_RETURN: *next_statement = parse_return_statement(data); break;
+            default: return statements;
         }
+        next_statement = &((*next_statement)->next);
     }
+    return statements;
 }
 
-// Children in AST: destination variable, [<expression>] if present, right-hand side <expression>.
-void parse_let_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Statement *parse_let_statement(ParseData *data) {
     // Syntax: 'let', identifier, ['[', <expression>, ']'], '=', <expression>, ';'
-    write_non_terminal(NT_LET_STATEMENT, false, output);
-    advance_tag(current, lookahead, input);
-    copy_tag(current, lookahead, input, output);
-
-    if (strcmp((*current)->value.str_val, "[") == 0) {
-        copy_tag(current, lookahead, input, output);
-        parse_expression(current, lookahead, input, output);
-        copy_tag(current, lookahead, input, output);
+    Statement *statement = arena_alloc(data->arena, sizeof(Statement));
+    statement->type = NT_LET_STATEMENT;
+    advance_token(data);
+    statement->name = data->current->value.str_val;
+    advance_token(data);
+
+    if (strcmp(data->current->value.str_val, "[") == 0) {
+        advance_token(data);
+        statement->index = parse_expression(data);
+        advance_token(data);
     }
 
-    advance_tag(current, lookahead, input);
-    parse_expression(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-
-    write_non_terminal(NT_LET_STATEMENT, true, output);
+    advance_token(data);
+    statement->expression = parse_expression(data);
+    advance_token(data);
+    return statement;
 }
 
-// Children in AST: Condition <expression>, <statements> in if clause, <statements> in else clause (if present)
-void parse_if_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Statement *parse_if_statement(ParseData *data) {
     // Syntax: 'if', '(', <expression>, ')', '{', <statements>, '}', ['else', '{', <statements>, '}']
-    write_non_terminal(NT_IF_STATEMENT, false, output);
-
-    advance_tag(current, lookahead, input);
-    advance_tag(current, lookahead, input);
-    parse_expression(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-    advance_tag(current, lookahead, input);
-    parse_statements(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-
-    if ((*current)->type == KEYWORD && (*current)->value.key_val == KW_ELSE) {
-        advance_tag(current, lookahead, input);
-        advance_tag(current, lookahead, input);
-        parse_statements(current, lookahead, input, output);
-        advance_tag(current, lookahead, input);
+    Statement *statement = arena_alloc(data->arena, sizeof(Statement));
+    statement->type = NT_IF_STATEMENT;
+
+    advance_token(data);
+    advance_token(data);
+    statement->expression = parse_expression(data);
+    advance_token(data);
+    advance_token(data);
+    statement->body = parse_statements(data);
+    advance_token(data);
+
+    if (data->current->type == KEYWORD && data->current->value.key_val == KW_ELSE) {
+        statement->has_else = true;
+        advance_token(data);
+        advance_token(data);
+        statement->else_body = parse_statements(data);
+        advance_token(data);
     }
-
-    write_non_terminal(NT_IF_STATEMENT, true, output);
+    return statement;
 }
 
-// Children in AST: Condition <expression>, <statements> in loop body.
-void parse_while_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Statement *parse_while_statement(ParseData *data) {
     // Syntax: 'while', '(', <expression>, ')', '{', <statements>, '}'
-    write_non_terminal(NT_WHILE_STATEMENT, false, output);
-
-    advance_tag(current, lookahead, input);
-    advance_tag(current, lookahead, input);
-    parse_expression(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-    advance_tag(current, lookahead, input);
-    parse_statements(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-
-    write_non_terminal(NT_WHILE_STATEMENT, true, output);
+    Statement *statement = arena_alloc(data->arena, sizeof(Statement));
+    statement->type = NT_WHILE_STATEMENT;
+
+    advance_token(data);
+    advance_token(data);
+    statement->expression = parse_expression(data);
+    advance_token(data);
+    advance_token(data);
+    statement->body = parse_statements(data);
+    advance_token(data);
+    return statement;
 }
 
-// Children in AST: Just the subroutine call.
-void parse_do_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
-    // Syntax: 'do', <expression>, ';'
-    write_non_terminal(NT_DO_STATEMENT, false, output);
+Statement *parse_do_statement(ParseData *data) {
+    // Syntax: 'do', <subroutineCall>, ';'
+    Statement *statement = arena_alloc(data->arena, sizeof(Statement));
+    statement->type = NT_DO_STATEMENT;
 
-    advance_tag(current, lookahead, input);
-    parse_sub_call(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-
-    write_non_terminal(NT_DO_STATEMENT, true, output);
+    advance_token(data);
+    statement->call = parse_sub_call(data);
+    advance_token(data);
+    return statement;
 }
 
-// Children in AST: <expression> to return (if present).
-void parse_return_statement(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Statement *parse_return_statement(ParseData *data) {
     // Syntax: 'return', [<expression>], ';'
-    write_non_terminal(NT_RETURN_STATEMENT, false, output);
+    Statement *statement = arena_alloc(data->arena, sizeof(Statement));
+    statement->type = NT_RETURN_STATEMENT;
 
-    advance_tag(current, lookahead, input);
-    if ((*current)->type != SYMBOL || strcmp((*current)->value.str_val, ";") != 0) {
-        parse_expression(current, lookahead, input, output);
+    advance_token(data);
+    if (data->current->type != SYMBOL || strcmp(data->current->value.str_val, ";") != 0) {
+        statement->expression = parse_expression(data);
     }
-    advance_tag(current, lookahead, input);
-
-    write_non_terminal(NT_RETURN_STATEMENT, true, output);
+    advance_token(data);
+    return statement;
 }
 
-// Children in AST: As in original, <term>, {<op>, <term>}.
-void parse_expression(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Expression *parse_expression(ParseData *data) {
     // Syntax: <term>, {<op>, <term>}
     // where <op> ::= '+' | '-' | '*' | '/' | '&' | '|' | '<' | '>' | '='
-    write_non_terminal(NT_EXPRESSION, false, output);
-
-    parse_term(current, lookahead, input, output);
-    while ((*current)->type == SYMBOL && ((*current)->value.str_val[0] == '+' || (*current)->value.str_val[0] == '-' ||
-            (*current)->value.str_val[0] == '*' || (*current)->value.str_val[0] == '/' || (*current)->value.str_val[0] == '&' ||
-            (*current)->value.str_val[0] == '|' || (*current)->value.str_val[0] == '<' || (*current)->value.str_val[0] == '>' ||
-            (*current)->value.str_val[0] == '=')) {
-        copy_tag(current, lookahead, input, output);
-        parse_term(current, lookahead, input, output);
+    Expression *expression = arena_alloc(data->arena, sizeof(Expression));
+    expression->terms = parse_term(data);
+
+    Term *last = expression->terms;
+    while (data->current->type == SYMBOL && (data->current->value.str_val[0] == '+' || data->current->value.str_val[0] == '-' ||
+            data->current->value.str_val[0] == '*' || data->current->value.str_val[0] == '/' || data->current->value.str_val[0] == '&' ||
+            data->current->value.str_val[0] == '|' || data->current->value.str_val[0] == '<' || data->current->value.str_val[0] == '>' ||
+            data->current->value.str_val[0] == '=')) {
+        char op = data->current->value.str_val[0];
+        advance_token(data);
+        last->next = parse_term(data);
+        last = last->next;
+        last->op = op;
     }
-
-    write_non_terminal(NT_EXPRESSION, true, output);
+    return expression;
 }
 
-// Children in AST: identifier, ['.', identifier], <expressionList>
-void parse_sub_call(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+SubroutineCall *parse_sub_call(ParseData *data) {
     // Syntax: identifier, ['.', identifier], '(', <expressionList>, ')'
-    write_non_terminal(NT_SUBROUTINE_CALL, false, output);
-
-    copy_tag(current, lookahead, input, output);
-    if ((*current)->type == SYMBOL && (*current)->value.str_val[0] == '.') {
-        copy_tag(current, lookahead, input, output);
-        copy_tag(current, lookahead, input, output);
+    SubroutineCall *call = arena_alloc(data->arena, sizeof(SubroutineCall));
+
+    call->first_name = data->current->value.str_val;
+    advance_token(data);
+    if (data->current->type == SYMBOL && data->current->value.str_val[0] == '.') {
+        advance_token(data);
+        call->second_name = data->current->value.str_val;
+        advance_token(data);
     }
-    advance_tag(current, lookahead, input);
-    parse_expression_list(current, lookahead, input, output);
-    advance_tag(current, lookahead, input);
-
-    write_non_terminal(NT_SUBROUTINE_CALL, true, output);
+    advance_token(data);
+    parse_expression_list(data, call);
+    advance_token(data);
+    return call;
 }
 
-// Children in AST: Everything except ()s around an <expression>.
-void parse_term(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+Term *parse_term(ParseData *data) {
     // Syntax: integerLiteral | stringLiteral | 'true' | 'false' | 'null' | 'this' |
     //         identifier, ['[', <expression>, ']'] |
     //         '(', <expression>, ')' |
@@ -589,659 +921,512 @@ void parse_term(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
     //         <subroutineCall>
     // NOTE: <subroutineCall> starts with an identifier. We need to use lookahead to distinguish between a
     // <subroutineCall> and a terminal identifier.
-    write_non_terminal(NT_TERM, false, output);
+    Term *term = arena_alloc(data->arena, sizeof(Term));
 
-    if ((*current)->type == IDENTIFIER) {
+    if (data->current->type == IDENTIFIER) {
         // Subroutine call case
-        if ((*lookahead)->type == SYMBOL &&
-            ((*lookahead)->value.str_val[0] == '.' || (*lookahead)->value.str_val[0] == '(')) {
-            parse_sub_call(current, lookahead, input, output);
+        if (data->lookahead->type == SYMBOL &&
+            (data->lookahead->value.str_val[0] == '.' || data->lookahead->value.str_val[0] == '(')) {
+            term->type = TM_CALL;
+            term->call = parse_sub_call(data);
         } else {
             // Otherwise we have identifier and maybe '[', <expression>, ']'.
-            copy_tag(current, lookahead, input, output);
-            if ((*current)->type == SYMBOL && (*current)->value.str_val[0] == '[') {
-                copy_tag(current, lookahead, input, output);
-                parse_expression(current, lookahead, input, output);
-                copy_tag(current, lookahead, input, output);
+            term->type = TM_VARIABLE;
+            term->token = *(data->current);
+            advance_token(data);
+            if (data->current->type == SYMBOL && data->current->value.str_val[0] == '[') {
+                term->type = TM_ARRAY;
+                advance_token(data);
+                term->expression = parse_expression(data);
+                advance_token(data);
             }
         }
-    } else if ((*current)->type == INTEGER_LITERAL || (*current)->type == STRING_LITERAL || (*current)->type == KEYWORD) {
+    } else if (data->current->type == INTEGER_LITERAL || data->current->type == STRING_LITERAL || data->current->type == KEYWORD) {
         // Keyword cases are 'true', 'false', 'null' and 'this'.
-        copy_tag(current, lookahead, input, output);
+        term->type = (data->current->type == INTEGER_LITERAL) ? TM_INTEGER :
+                     (data->current->type == STRING_LITERAL) ? TM_STRING : TM_KEYWORD;
+        term->token = *(data->current);
+        advance_token(data);
     } else {
         // We have either '(', <expression>, ')' or ('-' | '~'), <term>
-        if ((*current)->value.str_val[0] == '(') {
-            advance_tag(current, lookahead, input);
-            parse_expression(current, lookahead, input, output);
-            advance_tag(current, lookahead, input);
+        if (data->current->value.str_val[0] == '(') {
+            term->type = TM_EXPRESSION;
+            advance_token(data);
+            term->expression = parse_expression(data);
+            advance_token(data);
         } else {
-            copy_tag(current, lookahead, input, output);
-            parse_term(current, lookahead, input, output);
+            term->type = TM_UNARY;
+            term->token = *(data->current);
+            advance_token(data);
+            term->operand = parse_term(data);
         }
     }
-
-    write_non_terminal(NT_TERM, true, output);
+    return term;
 }
 
-// Children in AST: Just the <expression>s.
-void parse_expression_list(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
+// Fills in the arguments of call.
+void parse_expression_list(ParseData *data, SubroutineCall *call) {
     // Syntax: [<expression>, {',', <expression>}]
-    write_non_terminal(NT_EXPRESSION_LIST, false, output);
-
     // Note: current will be ')' if and only if the <expression_list> is empty.
-    if ((*current)->type != SYMBOL || (*current)->value.str_val[0] != ')') {
-        parse_expression(current, lookahead, input, output);
-        while((*current)->type == SYMBOL && (*current)->value.str_val[0] == ',') {
-            advance_tag(current, lookahead, input);
-            parse_expression(current, lookahead, input, output);
+    if (data->current->type != SYMBOL || data->current->value.str_val[0] != ')') {
+        call->arguments = parse_expression(data);
+        call->no_arguments = 1;
+        Expression *last = call->arguments;
+        while(data->current->type == SYMBOL && data->current->value.str_val[0] == ',') {
+            advance_token(data);
+            last->next = parse_expression(data);
+            last = last->next;
+            call->no_arguments++;
         }
     }
-
-    write_non_terminal(NT_EXPRESSION_LIST, true, output);
 }
 
-void compile_file(FILE *input, FILE *output) {
+void compile_file(const Class *class, VMWriter *writer) {
     CompileData *data = malloc(sizeof(CompileData));
-    data->input = input;
-    data->output = output;
+    data->writer = writer;
     data->class_name = NULL;
 
     data->class_table = NULL;
     data->subroutine_table = NULL;
+    data->if_count = 0;
+    data->while_count = 0;
 
-    data->current = NULL;
-    data->lookahead = NULL;
+    compile_class(data, class);
 
-    advance_tag(&(data->current), &(data->lookahead), input);
-    advance_tag(&(data->current), &(data->lookahead), input);
-
-    compile_class(data);
-
-    // *Lookahead, *current, *class and *subroutine will be NULL again at this point, no need to free them.
+    // The class and subroutine tables will be NULL again at this point, no need to free them.
     free(data);
 }
 
-// Outputs all VM code for the given <class> with no side effects.
-void compile_class(CompileData *data) {
-    // AST format: class name identifier, <classVarDec>s, <subroutineDec>s.
-    // Skip open tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    // Store class name.
-    char *current_class_name = data->current->value.str_val;
-    data->class_name = malloc(strlen(current_class_name)+1);
-    strcpy(data->class_name, current_class_name);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+// Outputs all VM code for the given class with no side effects.
+void compile_class(CompileData *data, const Class *class) {
+    // The class name lives as long as the syntax tree does, so there's no need to copy it.
+    data->class_name = class->name;
 
-    // Create class_table symbol table from <classVarDecs>.
-    data->class_table = malloc_table();
-    while (data->current->value.nt_val == NT_CLASS_VAR_DEC) {
-        compile_class_var_dec(data);
+    // Create class_table symbol table from the class variable declarations.
+    data->class_table = malloc_table(NULL);
+    for (const VarDec *var_dec = class->var_decs; var_dec != NULL; var_dec = var_dec->next) {
+        compile_class_var_dec(data, var_dec);
     }
 
     // Compile all subroutines using class_table symbol table.
-    while (data->current->value.nt_val == NT_SUBROUTINE_DEC) {
-        compile_sub_dec(data);
+    for (const Subroutine *sub = class->subroutines; sub != NULL; sub = sub->next) {
+        compile_sub_dec(data, sub);
     }
 
-    // Cleanup, skip closing tag.
-	free(data->class_name);
+    // Cleanup.
     free_table(data->class_table);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    data->class_table = NULL;
+    data->class_name = NULL;
 }
 
-// Adds the variables from the given <classVarDec> to the class_table symbol table.
-void compile_class_var_dec(CompileData *data) {
-    // AST format: variable keyword, type keyword, list of identifiers.
-    // Skip open tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    // Store variable kind.
-    VariableKind kind = (data->current->value.key_val == KW_FIELD) ? VK_FIELD : VK_STATIC;
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    // Need to copy variable type as otherwise it will be freed on calling advance_tag again.
-    char *type = type_to_string(data->current);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+// Adds the variables from the given class variable declaration to the class_table symbol table.
+void compile_class_var_dec(CompileData *data, const VarDec *var_dec) {
+    VariableKind kind = (var_dec->kind == KW_FIELD) ? VK_FIELD : VK_STATIC;
+    char *type = type_to_string(&(var_dec->type));
 
     // Add variables to symbol table.
-    while(!(data->current->close_tag)) {
-        add_to_table(data->class_table, data->current->value.str_val, type, kind);
-        advance_tag(&(data->current), &(data->lookahead), data->input);
+    for (const Name *name = var_dec->names; name != NULL; name = name->next) {
+        add_to_table(data->class_table, name->name, type, kind);
     }
 
-    // Cleanup, skip closing tag.
+    // Cleanup.
     free(type);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 }
 
-// Outputs all VM code for the current <subroutineDec> with no side effects.
-void compile_sub_dec(CompileData *data) {
-    // AST format: subroutine keyword, return type keyword, name, <parameterList>, <subroutineBody>.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    // Store subroutine keyword for later.
-    Keyword sub_kind = data->current->value.key_val;
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    // Return type is unused (except in type-checking which we don't implement). Skip it.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    // Copy subroutine name for later.
-    char *sub_name = malloc(strlen(data->current->value.str_val)+1);
-    strcpy(sub_name, data->current->value.str_val);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
+// Outputs all VM code for the given subroutine with no side effects.
+void compile_sub_dec(CompileData *data, const Subroutine *sub) {
     // Create subroutine symbol table and add all given arguments to it. Methods are passed this as argument 0 in
-    // addition to those listed in the <parameterList>.
-    data->subroutine_table = malloc_table();
-    if (sub_kind == KW_METHOD) {
+    // addition to those listed in the parameter list. The return type is unused (except in type-checking which we
+    // don't implement).
+    data->subroutine_table = malloc_table(data->class_table);
+    if (sub->kind == KW_METHOD) {
         add_to_table(data->subroutine_table, "this", data->class_name, VK_ARGUMENT);
     }
-    compile_parameter_list(data);
+    compile_parameter_list(data, sub->parameters);
 
     // Compile the subroutine body.
-    compile_sub_body(data, sub_kind, sub_name);
+    compile_sub_body(data, sub);
 
-    // Cleanup, skip closing tag.
+    // Cleanup.
     free_table(data->subroutine_table);
-    free(sub_name);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    data->subroutine_table = NULL;
 }
 
-// Outputs all VM code for the current <subBody>, populating the subroutine's symbol table in the process.
-void compile_sub_body(CompileData *data, Keyword sub_kind, char *sub_name) {
-    // AST format: <varDec>s, <statements>.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
+// Outputs all VM code for the body of the given subroutine, populating its symbol table in the process.
+void compile_sub_body(CompileData *data, const Subroutine *sub) {
     // First we finish populating the symbol table by adding local variables.
-    while(data->current->value.nt_val == NT_VAR_DEC) {
-        compile_var_dec(data);
+    for (const VarDec *var_dec = sub->var_decs; var_dec != NULL; var_dec = var_dec->next) {
+        compile_var_dec(data, var_dec);
     }
 
     // Now at last we have the information we need to start generating VM code!
-    char code[MAX_LINE_LENGTH];
-    sprintf(code, "function %s.%s %d\n", data->class_name, sub_name,
-            data->subroutine_table->num_allocated[VK_VAR]);
-    fputs(code, data->output);
+    emit_function(data->writer, VM_FUNCTION, data->class_name, sub->name, data->subroutine_table->num_allocated[VK_VAR]);
 
     // If we're a method or a constructor, we'll need to initialise the "this" memory segment.
     // If we're a method, it will be the first argument passed in by the subroutine call and hence stored in argument 0.
-    if (sub_kind == KW_METHOD) {
-        sprintf(code, "push argument 0\n"
-                                    "pop pointer 0\n");
-        fputs(code, data->output);
+    if (sub->kind == KW_METHOD) {
+        emit_push(data->writer, VM_ARGUMENT, 0);
+        emit_pop(data->writer, VM_POINTER, 0);
     }
     // If we're a constructor, we will need to allocate space on the heap.
-    else if (sub_kind == KW_CONSTRUCTOR) {
-        sprintf(code, "push constant %d\n"
-                      "call Memory.alloc 1\n"
-                      "pop pointer 0\n", data->class_table->num_allocated[VK_FIELD]);
-        fputs(code, data->output);
+    else if (sub->kind == KW_CONSTRUCTOR) {
+        emit_push(data->writer, VM_CONSTANT, data->class_table->num_allocated[VK_FIELD]);
+        emit_function(data->writer, VM_CALL, "Memory", "alloc", 1);
+        emit_pop(data->writer, VM_POINTER, 0);
     }
 
     // Now we generate code for the actual subroutine body.
-    compile_statements(data);
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    compile_statements(data, sub->statements);
 }
 
-// Add variable(s) from given <varDec> to subroutine symbol table.
-void compile_var_dec(CompileData *data) {
-    // AST format: type keyword, list of identifiers.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    // Copy variable type.
-    char *type = type_to_string(data->current);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+// Add variable(s) from given local variable declaration to subroutine symbol table.
+void compile_var_dec(CompileData *data, const VarDec *var_dec) {
+    char *type = type_to_string(&(var_dec->type));
 
     // Add variables to symbol table.
-    while(!(data->current->close_tag)) {
-        add_to_table(data->subroutine_table, data->current->value.str_val, type, VK_VAR);
-        advance_tag(&(data->current), &(data->lookahead), data->input);
+    for (const Name *name = var_dec->names; name != NULL; name = name->next) {
+        add_to_table(data->subroutine_table, name->name, type, VK_VAR);
     }
 
-    // Cleanup, skip closing tag.
+    // Cleanup.
     free(type);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 }
 
-// Outputs all VM code for the current <statements> with no side effects.
-void compile_statements(CompileData *data) {
-    // AST format: As in CST.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    while(!(data->current->close_tag)) {
-        switch (data->current->value.nt_val) {
-            case NT_LET_STATEMENT: compile_let_statement(data); break;
-            case NT_DO_STATEMENT: compile_do_statement(data); break;
-            case NT_IF_STATEMENT: compile_if_statement(data); break;
-            case NT_WHILE_STATEMENT: compile_while_statement(data); break;
-            case NT_RETURN_STATEMENT: compile_return_statement(data); break;
-            default: printf("Unexpected tag in <statements>.\n"); exit(EXIT_FAILURE);
+// Outputs all VM code for the given list of statements with no side effects.
+void compile_statements(CompileData *data, const Statement *statements) {
+    for (const Statement *statement = statements; statement != NULL; statement = statement->next) {
+        switch (statement->type) {
+            case NT_LET_STATEMENT: compile_let_statement(data, statement); break;
+            case NT_DO_STATEMENT: compile_do_statement(data, statement); break;
+            case NT_IF_STATEMENT: compile_if_statement(data, statement); break;
+            case NT_WHILE_STATEMENT: compile_while_statement(data, statement); break;
+            case NT_RETURN_STATEMENT: compile_return_statement(data, statement); break;
+            default: printf("Unexpected statement type in <statements>.\n"); exit(EXIT_FAILURE);
         }
     }
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 }
 
-// Outputs all VM code for the current <letStatement> with no side effects.
-void compile_let_statement(CompileData *data) {
-    // AST format: destination variable, [<expression>] if present, right-hand side <expression>.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-    bool brackets = false;
-    char code[MAX_LINE_LENGTH];
-
+// Outputs all VM code for the given let statement with no side effects.
+void compile_let_statement(CompileData *data, const Statement *statement) {
     // Comment for debugging.
-    fputs("// Compiling <letStatement>\n", data->output);
+    emit_comment(data->writer, "Compiling <letStatement>");
 
-    // Look up destination variable in symbol tables and advance.
-    TableEntry *entry;
-    int table_pos = get_table_entry(data->subroutine_table, data->current->value.str_val);
-    if (table_pos != -1) {
-        entry = data->subroutine_table->table_array[table_pos];
-    } else {
-        table_pos = get_table_entry(data->class_table, data->current->value.str_val);
-        entry = data->class_table->table_array[table_pos];
+    // Look up destination variable in symbol tables (the subroutine's, then the class's).
+    TableEntry *entry = get_table_entry(data->subroutine_table, statement->name);
+    if (entry == NULL) {
+        printf("Error: Undefined variable %s.\n", statement->name);
+        exit(EXIT_FAILURE);
     }
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 
     // If there are square brackets present, evaluate their contents and leave the address we need on top of the stack.
-    if (data->current->type == SYMBOL) {
-        brackets = true;
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-        compile_expression(data);
-        char buffer[MAX_LINE_LENGTH];
-        var_to_string(entry, buffer);
-        sprintf(code, "push %s\n"
-                      "add\n", buffer);
-        fputs(code, data->output);
-        advance_tag(&(data->current), &(data->lookahead), data->input);
+    if (statement->index != NULL) {
+        compile_expression(data, statement->index);
+        emit_push(data->writer, var_segment(entry), entry->offset);
+        emit_command(data->writer, VM_ADD);
     }
 
     // Now evaluate the value to assign and leave it on the stack.
-    compile_expression(data);
+    compile_expression(data, statement->expression);
 
     // Now actually store the value.
-    if (brackets) { // Here we have the values we need in the wrong order, so we use temp 0 as a holding facility.
-        fputs("pop temp 0\n"
-              "pop pointer 1\n"
-              "push temp 0\n"
-              "pop that 0\n", data->output);
+    if (statement->index != NULL) { // Here we have the values we need in the wrong order, so we use temp 0 as a holding facility.
+        emit_pop(data->writer, VM_TEMP, 0);
+        emit_pop(data->writer, VM_POINTER, 1);
+        emit_push(data->writer, VM_TEMP, 0);
+        emit_pop(data->writer, VM_THAT, 0);
     } else {
-        char buffer[MAX_LINE_LENGTH];
-        var_to_string(entry, buffer);
-        sprintf(code, "pop %s\n", buffer);
-        fputs(code, data->output);
+        emit_pop(data->writer, var_segment(entry), entry->offset);
     }
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 }
 
-// Outputs all VM code for the current <ifStatement> with no side effects.
-void compile_if_statement(CompileData *data) {
-    // AST format: Condition <expression>, <statements> in if clause, <statements> in else clause (if present)
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-    char code[MAX_LINE_LENGTH];
-
+// Outputs all VM code for the given if statement with no side effects.
+void compile_if_statement(CompileData *data, const Statement *statement) {
     // Define auto-incrementing labels.
-    static int label_number = 0;
-    char end_if_label[MAX_LINE_LENGTH];
-    sprintf(end_if_label, "end_if_%d", label_number);
-    char end_else_label[MAX_LINE_LENGTH];
-    sprintf(end_else_label, "end_else_%d", label_number);
-    label_number++;
+    char end_if_label[32];
+    sprintf(end_if_label, "end_if_%d", data->if_count);
+    char end_else_label[32];
+    sprintf(end_else_label, "end_else_%d", data->if_count);
+    data->if_count++;
 
     // Comment for debugging.
-    fputs("// Compiling <ifStatement>\n", data->output);
+    emit_comment(data->writer, "Compiling <ifStatement>");
 
     // Check the if condition and jump past the if statement if it's false.
-    compile_expression(data);
-    sprintf(code, "not\n"
-                                "if-goto %s\n", end_if_label);
-    fputs(code, data->output);
+    compile_expression(data, statement->expression);
+    emit_command(data->writer, VM_NOT);
+    emit_jump(data->writer, VM_IFGOTO, end_if_label);
 
-    // Output code for the <statements>.
-    compile_statements(data);
+    // Output code for the statements in the if clause.
+    compile_statements(data, statement->body);
 
     // If no else clause is present, output the label and we're done.
-    if (data->current->close_tag) {
-        sprintf(code, "label %s\n", end_if_label);
-        fputs(code, data->output);
+    if (!(statement->has_else)) {
+        emit_jump(data->writer, VM_LABEL, end_if_label);
     } else { // Otherwise, output code for the else clause with appropriate label placement.
-        sprintf(code, "goto %s\n"
-                      "label %s\n", end_else_label, end_if_label);
-        fputs(code, data->output);
-        compile_statements(data);
-        sprintf(code, "label %s\n", end_else_label);
-        fputs(code, data->output);
+        emit_jump(data->writer, VM_GOTO, end_else_label);
+        emit_jump(data->writer, VM_LABEL, end_if_label);
+        compile_statements(data, statement->else_body);
+        emit_jump(data->writer, VM_LABEL, end_else_label);
     }
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 }
 
-// Outputs all VM code for the current <whileStatement> with no side effects.
-void compile_while_statement(CompileData *data) {
-    // AST format: Condition <expression>, <statements> in loop body.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-    char code[MAX_LINE_LENGTH];
-
+// Outputs all VM code for the given while statement with no side effects.
+void compile_while_statement(CompileData *data, const Statement *statement) {
     // Define auto-incrementing labels.
-    static int label_number = 0;
-    char start_loop_label[MAX_LINE_LENGTH];
-    sprintf(start_loop_label, "start_while_%d", label_number);
-    char end_loop_label[MAX_LINE_LENGTH];
-    sprintf(end_loop_label, "end_while_%d", label_number);
-    label_number++;
+    char start_loop_label[32];
+    sprintf(start_loop_label, "start_while_%d", data->while_count);
+    char end_loop_label[32];
+    sprintf(end_loop_label, "end_while_%d", data->while_count);
+    data->while_count++;
 
     // Output label for start of loop.
-    sprintf(code, "label %s\n", start_loop_label);
-    fputs(code, data->output);
+    emit_jump(data->writer, VM_LABEL, start_loop_label);
 
     // Output code to check the loop condition, then break out of the loop if it's false.
-    compile_expression(data);
-    sprintf(code, "not\n"
-                         "if-goto %s\n", end_loop_label);
-    fputs(code, data->output);
+    compile_expression(data, statement->expression);
+    emit_command(data->writer, VM_NOT);
+    emit_jump(data->writer, VM_IFGOTO, end_loop_label);
 
     // Output code for the loop body.
-    compile_statements(data);
+    compile_statements(data, statement->body);
 
     // Output code to loop and label to break out of loop.
-    sprintf(code, "goto %s\n"
-                  "label %s\n", start_loop_label, end_loop_label);
-    fputs(code, data->output);
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    emit_jump(data->writer, VM_GOTO, start_loop_label);
+    emit_jump(data->writer, VM_LABEL, end_loop_label);
 }
 
-// Outputs all VM code for the current <doStatement> with no side effects.
-void compile_do_statement(CompileData *data) {
-    // AST format: Just the subroutine call.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
+// Outputs all VM code for the given do statement with no side effects.
+void compile_do_statement(CompileData *data, const Statement *statement) {
     // Comment for debugging.
-    fputs("// Compiling <doStatement>\n", data->output);
-
-    compile_sub_call(data);
-    fputs("pop temp 0\n", data->output); // Discard return value.
+    emit_comment(data->writer, "Compiling <doStatement>");
 
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    compile_sub_call(data, statement->call);
+    emit_pop(data->writer, VM_TEMP, 0); // Discard return value.
 }
 
-// Outputs all VM code for the current <returnStatement> with no side effects.
-void compile_return_statement(CompileData *data) {
-    // AST format: <expression> to return (if present).
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
+// Outputs all VM code for the given return statement with no side effects.
+void compile_return_statement(CompileData *data, const Statement *statement) {
     // Comment for debugging.
-    fputs("// Compiling <returnStatement>\n", data->output);
+    emit_comment(data->writer, "Compiling <returnStatement>");
 
     // Leave return value on the stack (or 0 if there is no return value, just to avoid stack underflow).
-    if (!(data->current->close_tag)) {
-        compile_expression(data);
+    if (statement->expression != NULL) {
+        compile_expression(data, statement->expression);
     } else {
-        fputs("push constant 0\n", data->output);
+        emit_push(data->writer, VM_CONSTANT, 0);
     }
 
     // Actually return.
-    fputs("return\n", data->output);
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    emit_command(data->writer, VM_RETURN);
 }
 
-// Outputs VM code that evaluates the current <expression> and leaves its value on top of the stack.
-void compile_expression(CompileData *data) {
-    // AST format: As in original, <term>, {<op>, <term>}.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    compile_term(data);
-    while(!(data->current->close_tag)) {
-        char current_op = data->current->value.str_val[0];
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-        compile_term(data);
-
-        // We now have the results of both terms on top of the stack, so we just need to translate the operation.
-        switch(current_op) {
-            case '+': fputs("add\n", data->output); break;
-            case '-': fputs("sub\n", data->output); break;
-            case '*': fputs("call Math.multiply 2\n", data->output); break;
-            case '/': fputs("call Math.divide 2\n", data->output); break;
-            case '&': fputs("and\n", data->output); break;
-            case '|': fputs("or\n", data->output); break;
-            case '<': fputs("lt\n", data->output); break;
-            case '>': fputs("gt\n", data->output); break;
-            case '=': fputs("eq\n", data->output); break;
-            default: printf("Unsupported <op> in <expression>.\n"); exit(EXIT_FAILURE);
+// Outputs VM code that evaluates the given expression and leaves its value on top of the stack. Constant parts are
+// worked out here rather than at run time (so 2*8 becomes 16, and Math.multiply is never called), and operations which
+// can't change the result, like x+0 or x*1, are left out. Jack evaluates operators from left to right, so the value
+// so far is always the left operand of the next operator.
+void compile_expression(CompileData *data, const Expression *expression) {
+    const Term *pending = expression->terms;
+    int value;
+    FoldState state = term_value(pending, &value) ? FS_KNOWN : FS_PENDING;
+
+    for (const Term *term = expression->terms->next; term != NULL; term = term->next) {
+        int right;
+        bool right_known = term_value(term, &right);
+        if (state == FS_KNOWN && right_known && fold_operator(term->op, value, right, &value)) {
+            continue;
+        }
+
+        if (right_known && state != FS_KNOWN) {
+            // x+0, x-0, x*1, x/1, x|0 and x&~0 are all just x.
+            if (is_identity(term->op, right)) {
+                continue;
+            }
+            // x*0, x&0 and x|~0 don't depend on x, but if x has side effects we still need to evaluate it.
+            if (is_absorbing(term->op, right)) {
+                if (state == FS_PENDING && !is_pure_term(pending)) {
+                    compile_term(data, pending);
+                    state = FS_ON_STACK;
+                }
+                if (state == FS_ON_STACK) {
+                    emit_pop(data->writer, VM_TEMP, 0);
+                }
+                state = FS_KNOWN;
+                value = right;
+                continue;
+            }
+        } else if (!right_known && state == FS_KNOWN) {
+            // The same again with the constant on the left, where 0-x and 1/x aren't x.
+            if (is_identity(term->op, value) && term->op != '-' && term->op != '/') {
+                state = FS_PENDING;
+                pending = term;
+                continue;
+            }
+            if (is_absorbing(term->op, value)) {
+                if (!is_pure_term(term)) {
+                    compile_term(data, term);
+                    emit_pop(data->writer, VM_TEMP, 0);
+                }
+                continue;
+            }
+        } else if (!right_known && state == FS_PENDING && term->op == '-' && is_same_variable(pending, term)) {
+            // x-x is 0.
+            state = FS_KNOWN;
+            value = 0;
+            continue;
         }
+
+        // Otherwise, there's no way round it: we need both operands on the stack and the operation itself.
+        if (state == FS_KNOWN) {
+            emit_constant(data, value);
+        } else if (state == FS_PENDING) {
+            compile_term(data, pending);
+        }
+        compile_term(data, term);
+        emit_operator(data, term->op);
+        state = FS_ON_STACK;
     }
 
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    if (state == FS_KNOWN) {
+        emit_constant(data, value);
+    } else if (state == FS_PENDING) {
+        compile_term(data, pending);
+    }
 }
 
 // Outputs VM code that calls the given subroutine and leaves the result on the stack.
-void compile_sub_call(CompileData *data) {
-    // AST format: identifier, ['.', identifier], <expressionList>
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-    char code[MAX_LINE_LENGTH];
-    char sub_name[MAX_LINE_LENGTH];
-    char first_identifier[MAX_LINE_LENGTH];
+void compile_sub_call(CompileData *data, const SubroutineCall *call) {
+    char *class_name;
+    char *sub_name;
     bool is_method = false;
 
-    // Take a temporary copy of the current identifier (the one before the dot) and advance.
-    strcpy(first_identifier, data->current->value.str_val);
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
     // Subroutine calls are in the form [class name].[subroutine name], [variable name].[subroutine name] (for methods),
     // or [subroutine name] (for method calls to the current class). The actual name of the subroutine is in the form
-    // [class name].[subroutine name]. We need to a) find the name and store it in sub_name, and b) if this is a method
-    // call, push the owning class instance onto the stack as the first argument (where it will become the value of
-    // "this").
-    if (data->current->type != SYMBOL) {
+    // [class name].[subroutine name]. We need to a) find the two halves of the name and store them in class_name and
+    // sub_name, and b) if this is a method call, push the owning class instance onto the stack as the first argument
+    // (where it will become the value of "this").
+    if (call->second_name == NULL) {
         is_method = true;
-        fputs("push pointer 0\n", data->output);
-        sprintf(sub_name, "%s.%s", data->class_name, first_identifier);
+        emit_push(data->writer, VM_POINTER, 0);
+        class_name = data->class_name;
+        sub_name = call->first_name;
     }
     else {
-        // Advance past the dot.
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-
         // Use the symbol tables to check if the thing before the dot is a known variable name. If it is one,
-        // set entry to its entry.
-        TableEntry *entry;
-        int table_pos = get_table_entry(data->subroutine_table, first_identifier);
-        if (table_pos != -1) {
-            is_method = true;
-            entry = data->subroutine_table->table_array[table_pos];
-        } else {
-            table_pos = get_table_entry(data->class_table, first_identifier);
-            if (table_pos != -1) {
-                is_method = true;
-                entry = data->class_table->table_array[table_pos];
-            }
-        }
+        // entry is its entry.
+        TableEntry *entry = get_table_entry(data->subroutine_table, call->first_name);
+        is_method = (entry != NULL);
 
         // In this case we are calling a method, and we have the "owning" variable's table entry. We must push the
         // variable's value (i.e. its address in RAM) onto the stack.
         if (is_method) {
-            char buffer[MAX_LINE_LENGTH];
-            var_to_string(entry, buffer);
-            sprintf(code, "push %s\n", buffer);
-            fputs(code, data->output);
-            sprintf(sub_name, "%s.%s", entry->type, data->current->value.str_val);
+            emit_push(data->writer, var_segment(entry), entry->offset);
+            class_name = entry->type;
         }
         // Otherwise, we are calling a constructor or a function. We need no special preparation and its name is
         // exactly what it appears to be.
         else {
-            sprintf(sub_name, "%s.%s", first_identifier, data->current->value.str_val);
+            class_name = call->first_name;
         }
-
-        // Either way, advance past the second identifier.
-        advance_tag(&(data->current), &(data->lookahead), data->input);
+        sub_name = call->second_name;
     }
 
     // Output code that leaves all the non-this arguments on the stack.
-    int number_args = compile_expression_list(data);
+    int number_args = compile_expression_list(data, call->arguments);
     if (is_method) {
         number_args++;
     }
 
     // Output the actual function call.
-    sprintf(code, "call %s %d\n", sub_name, number_args);
-    fputs(code, data->output);
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+    emit_function(data->writer, VM_CALL, class_name, sub_name, number_args);
 }
 
-// Outputs VM code that evaluates each expression in the given <expressionList>, leaving the results on the stack, and
-// returns the total number of expressions.
-int compile_expression_list(CompileData *data) {
-    // Children in AST: Just the <expression>s.
-    // AST format: As in original, <term>, {<op>, <term>}.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
+// Outputs VM code that evaluates each expression in the given list, leaving the results on the stack, and returns the
+// total number of expressions.
+int compile_expression_list(CompileData *data, const Expression *expressions) {
     int expression_count = 0;
 
-    while (!(data->current->close_tag)) {
-        compile_expression(data);
+    for (const Expression *expression = expressions; expression != NULL; expression = expression->next) {
+        compile_expression(data, expression);
         expression_count++;
     }
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
     return expression_count;
 }
 
-// Outputs VM code that evaluates the current <term> and leaves its value on top of the stack.
-void compile_term(CompileData *data) {
-    // AST syntax: integerLiteral | stringLiteral | 'true' | 'false' | 'null' | 'this' |
-    //             identifier, ['[', <expression>, ']'] |
-    //             <expression> |
-    //             ('-' | '~'), <term> |
-    //             <subroutineCall>
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-    char code[MAX_LINE_LENGTH];
-
-    if (data->current->type == INTEGER_LITERAL) {
-        sprintf(code, "push constant %d\n", data->current->value.int_val);
-        fputs(code, data->output);
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-    } else if (data->current->type == STRING_LITERAL) {
-        char *literal = data->current->value.str_val;
+// Outputs VM code that evaluates the given term and leaves its value on top of the stack.
+void compile_term(CompileData *data, const Term *term) {
+    int value;
+    if (term_value(term, &value)) {
+        emit_constant(data, value);
+    } else if (term->type == TM_STRING) {
+        char *literal = term->token.value.str_val;
 
         // dare you enter my magical realm
-        sprintf(code, "push constant %d\n"
-                      "call String.new 1\n", strlen(literal));
-        fputs(code, data->output);
+        emit_push(data->writer, VM_CONSTANT, strlen(literal));
+        emit_function(data->writer, VM_CALL, "String", "new", 1);
         for(int i = 0; i < strlen(literal); i++) {
-            sprintf(code, "push constant %d\n"
-                          "call String.appendChar 2\n", literal[i]);
-            fputs(code, data->output);
+            emit_push(data->writer, VM_CONSTANT, literal[i]);
+            emit_function(data->writer, VM_CALL, "String", "appendChar", 2);
         }
 
         // We're done! Yay! The value of a String set to the given literal is now on the stack, with no long-term
         // repercussions whatsoever! *turns and walks away from burning building*
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-    } else if (data->current->type == KEYWORD) {
-        switch(data->current->value.key_val) {
-            case KW_NULL:
-            case KW_FALSE: fputs("push constant 0\n", data->output); break;
-            case KW_TRUE: fputs("push constant 1\n"
-                                "neg\n", data->output); break;
-            case KW_THIS: fputs("push pointer 0\n", data->output); break;
+    } else if (term->type == TM_KEYWORD) {
+        switch(term->token.value.key_val) {
+            case KW_THIS: emit_push(data->writer, VM_POINTER, 0); break; // The others are constants.
             default: printf("Unsupported keyword in <term>.\n"); exit(EXIT_FAILURE);
         }
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-    } else if (data->current->type == IDENTIFIER) {
-        // In this case it's a variable. Pull the symbol table entry and advance the tag.
-        TableEntry *entry;
-        int table_pos = get_table_entry(data->subroutine_table, data->current->value.str_val);
-        if (table_pos == -1) {
-            table_pos = get_table_entry(data->class_table, data->current->value.str_val);
-            entry = data->class_table->table_array[table_pos];
-        } else {
-            entry = data->subroutine_table->table_array[table_pos];
+    } else if (term->type == TM_VARIABLE || term->type == TM_ARRAY) {
+        // In this case it's a variable. Pull the symbol table entry.
+        TableEntry *entry = get_table_entry(data->subroutine_table, term->token.value.str_val);
+        if (entry == NULL) {
+            printf("Error: Undefined variable %s.\n", term->token.value.str_val);
+            exit(EXIT_FAILURE);
         }
-        advance_tag(&(data->current), &(data->lookahead), data->input);
 
         // In all cases, we'll need to push the variable's value onto the stack.
-        char buffer[MAX_LINE_LENGTH];
-        var_to_string(entry, buffer);
-        sprintf(code, "push %s\n", buffer);
-        fputs(code, data->output);
+        emit_push(data->writer, var_segment(entry), entry->offset);
 
         // If we have [<expression>] after the identifier, then we need to read x[i] as *(x+i).
-        if (!(data->current->close_tag)) {
-            // Skip the brackets and put the result of the <expression> onto the stack.
-            advance_tag(&(data->current), &(data->lookahead), data->input);
-            compile_expression(data);
-            advance_tag(&(data->current), &(data->lookahead), data->input);
-            fputs("add\n"
-                  "pop pointer 1\n"
-                  "push that 0\n", data->output);
+        if (term->type == TM_ARRAY) {
+            // Put the result of the <expression> onto the stack.
+            compile_expression(data, term->expression);
+            emit_command(data->writer, VM_ADD);
+            emit_pop(data->writer, VM_POINTER, 1);
+            emit_push(data->writer, VM_THAT, 0);
+        }
+    } else if (term->type == TM_EXPRESSION) {
+        compile_expression(data, term->expression);
+    } else if (term->type == TM_UNARY) {
+        // --x and ~~x are just x.
+        const Term *operand = strip_brackets(term->operand);
+        if (operand->type == TM_UNARY && operand->token.value.str_val[0] == term->token.value.str_val[0]) {
+            compile_term(data, operand->operand);
+            return;
         }
-    } else if (data->current->type == NON_TERMINAL && data->current->value.nt_val == NT_EXPRESSION) {
-        compile_expression(data);
-    } else if (data->current->type == SYMBOL) {
-        char op_value = data->current->value.str_val[0];
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-        compile_term(data);
-        if (op_value == '-') {
-            fputs("neg\n", data->output);
+
+        compile_term(data, term->operand);
+        if (term->token.value.str_val[0] == '-') {
+            emit_command(data->writer, VM_NEG);
         } else { // Must be '~'
-            fputs("not\n", data->output);
+            emit_command(data->writer, VM_NOT);
         }
     } else { // In this case it must be a subroutine call.
-        compile_sub_call(data);
+        compile_sub_call(data, term->call);
     }
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 }
 
 // Add all given arguments to subroutine symbol table.
-void compile_parameter_list(CompileData *data) {
-    // AST syntax: {<type>, identifier}.
-    // Skip opening tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
-
-    while (!(data->current->close_tag)) {
-        char *type = type_to_string(data->current);
-        add_to_table(data->subroutine_table, data->lookahead->value.str_val,
-                     type, VK_ARGUMENT);
+void compile_parameter_list(CompileData *data, const Parameter *parameters) {
+    for (const Parameter *parameter = parameters; parameter != NULL; parameter = parameter->next) {
+        char *type = type_to_string(&(parameter->type));
+        add_to_table(data->subroutine_table, parameter->name, type, VK_ARGUMENT);
         free(type);
-        advance_tag(&(data->current), &(data->lookahead), data->input);
-        advance_tag(&(data->current), &(data->lookahead), data->input);
     }
-
-    // Skip closing tag.
-    advance_tag(&(data->current), &(data->lookahead), data->input);
 }
 
-// Converts the current tag (assumed to be a keyword or identifier) into a string and returns the string. NB the string
-// will need to be freed in order to avoid a memory leak.
-char *type_to_string(Tag *current) {
+// Converts the given type (a keyword or identifier token) into a string and returns the string. NB the string will
+// need to be freed in order to avoid a memory leak.
+char *type_to_string(const Tag *current) {
     char *type;
     if (current->type == IDENTIFIER) {
         type = malloc(strlen(current->value.str_val) + 1);
@@ -1258,12 +1443,167 @@ char *type_to_string(Tag *current) {
     return type;
 }
 
-void var_to_string(TableEntry *var_entry, char *buffer) {
+// Returns the memory segment the given variable lives in. Its index in that segment is its offset.
+VMKeyword var_segment(const TableEntry *var_entry) {
     switch(var_entry->kind) {
-        case VK_FIELD: sprintf(buffer, "this %d", var_entry->offset); break;
-        case VK_VAR: sprintf(buffer, "local %d", var_entry->offset); break;
-        case VK_STATIC: sprintf(buffer, "static %d", var_entry->offset); break;
-        case VK_ARGUMENT: sprintf(buffer, "argument %d", var_entry->offset); break;
+        case VK_FIELD: return VM_THIS;
+        case VK_VAR: return VM_LOCAL;
+        case VK_STATIC: return VM_STATIC;
+        case VK_ARGUMENT: return VM_ARGUMENT;
         default: printf("Impossible enum value."); exit(EXIT_FAILURE);
     }
-}
\ No newline at end of file
+}
+
+// Outputs VM code that pushes the given 16-bit value. Only 0 to 32767 can be pushed directly.
+void emit_constant(CompileData *data, int value) {
+    if (value >= 0) {
+        emit_push(data->writer, VM_CONSTANT, value);
+    } else if (value > -32768) {
+        emit_push(data->writer, VM_CONSTANT, -value);
+        emit_command(data->writer, VM_NEG);
+    } else {
+        emit_push(data->writer, VM_CONSTANT, 32767);
+        emit_command(data->writer, VM_NOT);
+    }
+}
+
+// Outputs VM code for the given binary operator, which replaces the top two values on the stack with its result.
+void emit_operator(CompileData *data, char op) {
+    switch(op) {
+        case '+': emit_command(data->writer, VM_ADD); break;
+        case '-': emit_command(data->writer, VM_SUB); break;
+        case '*': emit_function(data->writer, VM_CALL, "Math", "multiply", 2); break;
+        case '/': emit_function(data->writer, VM_CALL, "Math", "divide", 2); break;
+        case '&': emit_command(data->writer, VM_AND); break;
+        case '|': emit_command(data->writer, VM_OR); break;
+        case '<': emit_command(data->writer, VM_LT); break;
+        case '>': emit_command(data->writer, VM_GT); break;
+        case '=': emit_command(data->writer, VM_EQ); break;
+        default: printf("Unsupported <op> in <expression>.\n"); exit(EXIT_FAILURE);
+    }
+}
+
+// Returns true if the given term always has the same value, and stores that value in *value if so. Only literals (and
+// expressions made from them) count; a term with a variable or call in it never does.
+bool term_value(const Term *term, int *value) {
+    switch (term->type) {
+        case TM_INTEGER:
+            *value = to_word(term->token.value.int_val);
+            return true;
+        case TM_KEYWORD:
+            if (term->token.value.key_val == KW_THIS) {
+                return false;
+            }
+            *value = (term->token.value.key_val == KW_TRUE) ? -1 : 0;
+            return true;
+        case TM_EXPRESSION:
+            return expression_value(term->expression, value);
+        case TM_UNARY:
+            if (!term_value(term->operand, value)) {
+                return false;
+            }
+            *value = to_word((term->token.value.str_val[0] == '-') ? -*value : ~*value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns true if every term of the given expression always has the same value, and stores the expression's value in
+// *value if so.
+bool expression_value(const Expression *expression, int *value) {
+    if (!term_value(expression->terms, value)) {
+        return false;
+    }
+    for (const Term *term = expression->terms->next; term != NULL; term = term->next) {
+        int right;
+        if (!term_value(term, &right) || !fold_operator(term->op, *value, right, value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Works out "left op right" the way the Hack computer and the OS would, and stores the result in *result. Returns
+// false without changing *result if we'd rather leave it until run time: division by zero is an error there, and
+// Math.divide can't take the absolute value of -32768.
+bool fold_operator(char op, int left, int right, int *result) {
+    switch (op) {
+        case '+': *result = to_word(left + right); break;
+        case '-': *result = to_word(left - right); break;
+        case '*': *result = to_word(left * right); break;
+        case '/':
+            if (right == 0 || left == -32768 || right == -32768) {
+                return false;
+            }
+            *result = to_word(left / right);
+            break;
+        case '&': *result = left & right; break;
+        case '|': *result = left | right; break;
+        case '<': *result = (left < right) ? -1 : 0; break;
+        case '>': *result = (left > right) ? -1 : 0; break;
+        case '=': *result = (left == right) ? -1 : 0; break;
+        default: printf("Unsupported <op> in <expression>.\n"); exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+// Returns true if "x op value" is always x.
+bool is_identity(char op, int value) {
+    return ((op == '+' || op == '-' || op == '|') && value == 0) || ((op == '*' || op == '/') && value == 1) ||
+           (op == '&' && value == -1);
+}
+
+// Returns true if "x op value" and "value op x" are always value.
+bool is_absorbing(char op, int value) {
+    return ((op == '*' || op == '&') && value == 0) || (op == '|' && value == -1);
+}
+
+// Returns true if evaluating the given term can't have side effects, so it's safe not to evaluate it at all. Calls
+// can do anything, and string literals allocate memory.
+bool is_pure_term(const Term *term) {
+    switch (term->type) {
+        case TM_INTEGER:
+        case TM_KEYWORD:
+        case TM_VARIABLE:
+            return true;
+        case TM_ARRAY:
+        case TM_EXPRESSION:
+            return is_pure_expression(term->expression);
+        case TM_UNARY:
+            return is_pure_term(term->operand);
+        default:
+            return false;
+    }
+}
+
+bool is_pure_expression(const Expression *expression) {
+    for (const Term *term = expression->terms; term != NULL; term = term->next) {
+        if (!is_pure_term(term)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if both terms are the same plain variable, possibly in brackets. Names from the same class come from
+// the same string pool, so they can be compared by pointer.
+bool is_same_variable(const Term *first, const Term *second) {
+    first = strip_brackets(first);
+    second = strip_brackets(second);
+    return first->type == TM_VARIABLE && second->type == TM_VARIABLE &&
+           first->token.value.str_val == second->token.value.str_val;
+}
+
+// Returns the term inside any number of brackets around the given term, e.g. x for ((x)).
+const Term *strip_brackets(const Term *term) {
+    while (term->type == TM_EXPRESSION && term->expression->terms->next == NULL) {
+        term = term->expression->terms;
+    }
+    return term;
+}
+
+// Returns value wrapped round to a 16-bit two's complement word, as the Hack computer would store it.
+int to_word(int value) {
+    return ((value & 0xFFFF) ^ 0x8000) - 0x8000;
+}
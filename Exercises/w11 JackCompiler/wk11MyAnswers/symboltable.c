@@ -1,9 +1,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include "symboltable.h"
+#include "intern.h"
 
-SymbolTable *malloc_table() {
+void add_to_hash(TableEntry **hash_array, int hash_space, TableEntry *entry);
+
+SymbolTable *malloc_table(const SymbolTable *parent) {
     const int initial_space = 1;
+    const int initial_hash_space = 16;
 
     SymbolTable *table = (SymbolTable*)malloc(sizeof(SymbolTable));
     table->table_length = 0;
@@ -12,6 +16,9 @@ SymbolTable *malloc_table() {
     for(int i = 0; i < NUM_KINDS; i++) {
         table->num_allocated[i] = 0;
     }
+    table->hash_space = initial_hash_space;
+    table->hash_array = (TableEntry**)calloc(initial_hash_space, sizeof(TableEntry *));
+    table->parent = parent;
     return table;
 }
 
@@ -22,6 +29,7 @@ void free_table(SymbolTable *table) {
         free(table->table_array[i]);
     }
     free(table->table_array);
+    free(table->hash_array);
     free(table);
 }
 
@@ -47,18 +55,42 @@ void add_to_table(SymbolTable *table, const char *name, const char *type, Variab
         table->table_array = new_array;
         table->table_space *= 2;
     }
+
+    // Now add the entry to the hash table. If it's now half full, double its size and put every entry back in.
+    // (A repeated name goes after the first one, which is the one we'll keep finding.)
+    add_to_hash(table->hash_array, table->hash_space, new);
+    if (2 * table->table_length >= table->hash_space) {
+        free(table->hash_array);
+        table->hash_space *= 2;
+        table->hash_array = (TableEntry**)calloc(table->hash_space, sizeof(TableEntry *));
+        for (int i=0; i<table->table_length; i++) {
+            add_to_hash(table->hash_array, table->hash_space, table->table_array[i]);
+        }
+    }
 }
 
-int get_table_entry(const SymbolTable *table, const char *search_name) {
-    // NOTE: The *right* way to do this is to use a hash map, which will runs in (amortised) O(1) time rather than
-    // O(table->table_size) time. But this unit is already introducing a lot, and non-C languages include built-in hash
-    // tables anyway (e.g. Java's HashMap and Python's dictionary), so let's keep it simple.
-    for (int i=0; i<table->table_length; i++) {
-        if (strcmp(table->table_array[i]->name, search_name) == 0) {
-            return i;
+// Puts entry in the first free slot for its name in hash_array, which has hash_space slots.
+void add_to_hash(TableEntry **hash_array, int hash_space, TableEntry *entry) {
+    int slot = hash_string(entry->name, strlen(entry->name)) & (hash_space - 1);
+    while (hash_array[slot] != NULL) {
+        slot = (slot + 1) & (hash_space - 1);
+    }
+    hash_array[slot] = entry;
+}
+
+TableEntry *get_table_entry(const SymbolTable *table, const char *search_name) {
+    int length = strlen(search_name);
+    unsigned int hash = hash_string(search_name, length);
+    for (; table != NULL; table = table->parent) {
+        int slot = hash & (table->hash_space - 1);
+        while (table->hash_array[slot] != NULL) {
+            if (strcmp(table->hash_array[slot]->name, search_name) == 0) {
+                return table->hash_array[slot];
+            }
+            slot = (slot + 1) & (table->hash_space - 1);
         }
     }
-    return -1;
+    return NULL;
 }
 
 bool is_primitive(TableEntry *entry) {
@@ -22,15 +22,23 @@ struct TableEntry {
 // number of entries to the table, and you can search for an entry by its name. num_allocated[kind]
 // contains the number of variables of the given kind stored in the table. The table_space
 // variable is only used internally in adding new items to the table.
+//
+// Tables are nested the way scopes are: parent is the table for the enclosing scope (e.g. the class table for a
+// subroutine's table), or NULL. Searching a table also searches its parents. To find entries quickly, hash_array is a
+// hash table of the entries by name with hash_space slots (a power of two, never more than half full), with NULL in
+// the empty slots.
 struct SymbolTable {
     TableEntry **table_array; // Remember a double pointer is the same as an array of pointers.
     int table_length;
     int table_space;
     int num_allocated[NUM_KINDS];
+    TableEntry **hash_array;
+    int hash_space;
+    const struct SymbolTable *parent;
 }; typedef struct SymbolTable SymbolTable;
 
-// Creates and returns a new empty symbol table.
-SymbolTable *malloc_table();
+// Creates and returns a new empty symbol table for a scope inside the one parent is for (NULL for the outermost scope).
+SymbolTable *malloc_table(const SymbolTable *parent);
 // Returns true if the given table entry is for a primitive type (int, char, or boolean).
 bool is_primitive(TableEntry *entry);
 // Frees every entry in table, then table itself.
@@ -38,7 +46,7 @@ void free_table(SymbolTable *table);
 // Adds a new entry to table with the given name, type and kind. Automatically assigns the first unallocated offset
 // among variables of that kind. Note that name and type will be assigned by value, not reference.
 void add_to_table(SymbolTable *table, const char *name, const char *type, VariableKind kind);
-// If table contains an entry with name search_name, returns i such that table->table_array[i] is
-// that entry. If table doesn't contain such an entry, returns -1.
-int get_table_entry(const SymbolTable *table, const char *search_name);
+// Returns the entry with name search_name in table, or if there isn't one, in the nearest of its parents which has one.
+// Returns NULL if there's no such entry anywhere.
+TableEntry *get_table_entry(const SymbolTable *table, const char *search_name);
 
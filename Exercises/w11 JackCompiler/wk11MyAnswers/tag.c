@@ -59,48 +59,58 @@ const char *KeywordToString[] = {
         [KW_RETURN] = "return"
 };
 
-Tag *malloc_tag() {
-    Tag *var = (Tag *)malloc(sizeof(Tag));
-    return var;
+TagList *malloc_tag_list() {
+    const int initial_space = 1024;
+
+    TagList *list = (TagList *)malloc(sizeof(TagList));
+    list->list_length = 0;
+    list->list_space = initial_space;
+    list->list_array = (Tag *)malloc(initial_space * sizeof(Tag));
+    list->strings = malloc_string_pool();
+    return list;
 }
 
-void free_tag(Tag **var) {
-    // We need to avoid freeing var if it's not actually storing a string.
-    if ((**var).type == IDENTIFIER || (**var).type == STRING_LITERAL || (**var).type == SYMBOL) {
-        free((**var).value.str_val);
+void free_tag_list(TagList *list) {
+    free_string_pool(list->strings);
+    free(list->list_array);
+    free(list);
+}
+
+void add_tag(TagList *list, const Tag *tag) {
+    if (list->list_length == list->list_space) {
+        list->list_space *= 2;
+        list->list_array = (Tag *)realloc(list->list_array, list->list_space * sizeof(Tag));
     }
-    free(*var);
+    list->list_array[list->list_length] = *tag;
+    list->list_length++;
 }
 
 // We write non-terminals in the form e.g. <class>\n or </class>\n.
 // We write terminals in the form e.g. <keyword> class </keyword>\n or <integerConstant> 423 </integerConstant>\n.
-// We keep track of opening and closing tags and indent accordingly.
-void write_tag(Tag *var, FILE *output) {
-    static int indentation_level = 0;
-
+// We keep track of opening and closing tags in *indentation_level and indent accordingly.
+void write_tag(const Tag *var, int *indentation_level, FILE *output) {
     if (var->type == NON_TERMINAL && var->close_tag) {
-        indentation_level--;
+        (*indentation_level)--;
     }
 
-    if (indentation_level > MAX_LINE_LENGTH/4) {
+    if (*indentation_level > MAX_LINE_LENGTH/4) {
         printf("Maximum indentation level exceeded, something has gone very wrong!");
     }
     char initial_spaces[MAX_LINE_LENGTH];
-    for (int i=0; i < indentation_level; i++) {
+    for (int i=0; i < *indentation_level; i++) {
         initial_spaces[2*i] = ' ';
         initial_spaces[2*i+1] = ' ';
     }
-    initial_spaces[2*indentation_level] = '\0';
+    initial_spaces[2 * *indentation_level] = '\0';
 
     char tag_str[MAX_LINE_LENGTH];
-    strcat(tag_str, initial_spaces);
 
     if (var->type == NON_TERMINAL) {
         sprintf(tag_str, "%s<%s%s>\n", initial_spaces, (var->close_tag ? "/" : ""),
                 NonTerminalToString[var->value.nt_val]);
         fputs(tag_str, output);
         if (!(var->close_tag)) {
-            indentation_level++;
+            (*indentation_level)++;
         }
         return;
     }
@@ -137,118 +147,10 @@ void write_tag(Tag *var, FILE *output) {
     fputs(tag_str, output);
 }
 
-// If the tag is completed immediately after its contents, e.g. <keyword> class </keyword>, then we read it in as
-// an entire token and set value accordingly. Otherwise, e.g. <whileStatement> or </letStatement>, we read it in as
-// a single tag of type NON_TERMINAL. We set value.nt_val to be the type of the non-terminal, and we set close_tag to true
-// if it's an end tag (i.e. contains a /). Note that in either case we read exactly one line of the input file.
-bool read_tag(Tag **var, FILE *input) {
-    char line[MAX_LINE_LENGTH];
-    if (fgets(line, MAX_LINE_LENGTH, input) == NULL) {
-        return false;
-    }
-
-    int pos = 0;
-    while(line[pos++] != '<');
-    if (line[pos] == '/') {
-        (*var)->close_tag = true;
-        pos++;
-    } else {
-        (*var)->close_tag = false;
-    }
-
-    bool non_terminal = true;
-    for (int i = 0; i < NUM_JTTS; i++) {
-        if (strncmp(line+pos, TagTypeToString[i], strlen(TagTypeToString[i])) == 0) {
-            (*var)->type = i;
-            non_terminal = false;
-            pos += strlen(TagTypeToString[i]) + 2;
-        }
-    }
-
-    if (non_terminal) {
-        int contents_length = 0;
-        while(line[pos + ++contents_length] != '>');
-
-        (*var)->type = NON_TERMINAL;
-        for (int i = 0; i < NUM_NTS; i++) {
-            int nonterm_length = strlen(NonTerminalToString[i]);
-            if (strncmp(line+pos, NonTerminalToString[i], nonterm_length) == 0 && nonterm_length == contents_length) {
-                (*var)->value.nt_val = i;
-                return true;
-            }
-        }
-        printf("Malformed tag \"%s\".\n", line);
-        exit(EXIT_FAILURE);
-    }
-
-    int contents_length = 0;
-    while(line[pos + ++contents_length] != '<'); // Check for < rather than ' ' because of string literals
-    contents_length--;
-
-    switch((*var)->type) {
-        case KEYWORD:
-            for (int i = 0; i < NUM_KWS; i++) {
-                int keyword_length = strlen(KeywordToString[i]);
-                if (strncmp(line+pos, KeywordToString[i], keyword_length) == 0 &&
-                    keyword_length == contents_length) {
-                    (*var)->value.key_val = i;
-                    return true;
-                }
-            }
-            printf("Malformed tag \"%s\".\n", line);
-            exit(EXIT_FAILURE);
-        case INTEGER_LITERAL:
-            (*var)->value.int_val = strtol(line+pos, NULL, 10);
-            return true;
-        case STRING_LITERAL:
-        case IDENTIFIER:
-            (*var)->value.str_val = malloc((contents_length + 1) * sizeof(char));
-            strncpy((*var)->value.str_val, line+pos, contents_length);
-            (*var)->value.str_val[contents_length] = '\0';
-            return true;
-        case SYMBOL:
-            (*var)->value.str_val = malloc((contents_length + 1) * sizeof(char));
-            // >, <, " and & are all escaped in XML files
-            if (strncmp(line+pos, "&gt;", 4) == 0) {
-                (*var)->value.str_val[0] = '>';
-            } else if (strncmp(line+pos, "&lt;", 4) == 0) {
-                (*var)->value.str_val[0] = '<';
-            } else if (strncmp(line+pos, "&quot;", 6) == 0) {
-                (*var)->value.str_val[0] = '\"';
-            } else if (strncmp(line+pos, "&amp;", 5) == 0) {
-                (*var)->value.str_val[0] = '&';
-            } else {
-                (*var)->value.str_val[0] = line[pos];
-            }
-            (*var)->value.str_val[1] = '\0';
-            return true;
-        default:
-            printf("Impossible tag enum value %d", (*var)->type);
-            exit(EXIT_FAILURE);
-    }
-}
-
-void copy_tag(Tag **current, Tag **lookahead, FILE *input, FILE *output) {
-    write_tag(*current, output);
-    advance_tag(current, lookahead, input);
-}
-
-void advance_tag(Tag **current, Tag **lookahead, FILE *input) {
-    if (*current != NULL) {
-        free_tag(current);
-    }
-    *current = *lookahead;
-    *lookahead = malloc_tag();
-    if (!(read_tag(lookahead, input))) {
-        free(*lookahead);
-        *lookahead = NULL;
-    }
-}
-
-void write_non_terminal(NonTerminal nt, bool end, FILE *output) {
+void write_non_terminal(NonTerminal nt, bool end, int *indentation_level, FILE *output) {
     Tag temp;
     temp.type = NON_TERMINAL;
     temp.value.nt_val = nt;
     temp.close_tag = end;
-    write_tag(&temp, output);
+    write_tag(&temp, indentation_level, output);
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
+#ifndef TAG_H
+#define TAG_H
+
 #include <stdio.h>
 #include <stdbool.h>
+#include "intern.h"
 
 enum JackTagType {
     KEYWORD,
@@ -52,22 +56,30 @@ struct Tag {
     bool close_tag;
 }; typedef struct Tag Tag;
 
-// Returns a pointer to a newly-allocated Tag object.
-Tag *malloc_tag();
-// Frees a Tag pointer and everything associated with it.
-void free_tag(Tag **var);
-// Writes a token to [output] in the form "type,value".
-void write_tag(Tag *var, FILE *output);
-// Returns false if there are no more tokens in input, otherwise stores the next token in var and returns true.
-bool read_tag(Tag **var, FILE *input);
-// Copies the current tag into the provided output file. Updates the lookahead tag to be the next unread tag in the
-// input, and updates the current tag to be the old lookahead tag. Sets lookahead to NULL if there is no next tag.
-void copy_tag(Tag **current, Tag **lookahead, FILE *input, FILE *output);
-// Behaves like copy_tag, but does not copy the current tag into the output file.
-void advance_tag(Tag **current, Tag **lookahead, FILE *input);
+// A TagList is a growable array of Tags stored in list_array, with the number of tags stored in list_length. The
+// list_space variable is only used internally and tracks the memory allocated to list_array. Every string in the list's
+// tags is interned in strings, which belongs to the list.
+struct TagList {
+    Tag *list_array;
+    int list_length;
+    int list_space;
+    StringPool *strings;
+}; typedef struct TagList TagList;
+
+// Creates and returns a new empty tag list with its own string pool.
+TagList *malloc_tag_list();
+// Frees list, its string pool and all its tags.
+void free_tag_list(TagList *list);
+// Adds a copy of tag to the end of list. Any string in tag should already be interned in list->strings.
+void add_tag(TagList *list, const Tag *tag);
+// Writes a token to [output] as a line of XML. *indentation_level is the number of non-terminals we're currently
+// inside, which should start at 0; it's updated as non-terminal tags are opened and closed.
+void write_tag(const Tag *var, int *indentation_level, FILE *output);
 // Writes a new non-terminal tag with the given value into the given output file, making it an end tag if the
-// corresponding boolean argument is true.
-void write_non_terminal(NonTerminal nt, bool end, FILE *output);
+// corresponding boolean argument is true. indentation_level is as for write_tag.
+void write_non_terminal(NonTerminal nt, bool end, int *indentation_level, FILE *output);
 
 // Maximum token length
-#define MAX_LINE_LENGTH 256
\ No newline at end of file
+#define MAX_LINE_LENGTH 256
+
+#endif
\ No newline at end of file
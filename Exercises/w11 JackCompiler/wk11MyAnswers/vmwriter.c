@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "vmwriter.h"
+
+const char *VMKeywordToString[] = {"push", "pop", "add", "sub", "neg", "and", "or", "not", "eq", "gt", "lt",
+                                   "local", "constant", "this", "that", "pointer", "argument", "static", "temp",
+                                   "label", "goto", "if-goto", "function", "call", "return"};
+
+// A growable array of characters, used to build up VM code before writing it out in one go. on_heap is false while
+// text is still a caller's fixed-size array, which is copied to the heap if it fills up.
+struct TextBuffer {
+    char *text;
+    size_t length;
+    size_t space;
+    bool on_heap;
+}; typedef struct TextBuffer TextBuffer;
+
+void add_instruction(VMWriter *writer, VMKeyword command, VMKeyword segment, int index, char *name);
+void format_instruction(TextBuffer *buffer, const VMInstruction *instruction);
+void append_text(TextBuffer *buffer, const char *text, size_t length);
+void append_int(TextBuffer *buffer, int value);
+
+VMWriter *malloc_vm_writer(FILE *debug_output) {
+    VMWriter *writer = (VMWriter *)malloc(sizeof(VMWriter));
+    writer->list_length = 0;
+    writer->list_space = 1024;
+    writer->list_array = (VMInstruction *)malloc(writer->list_space * sizeof(VMInstruction));
+    writer->strings = malloc_string_pool();
+    writer->debug_output = debug_output;
+    return writer;
+}
+
+void free_vm_writer(VMWriter *writer) {
+    free(writer->list_array);
+    free_string_pool(writer->strings);
+    free(writer);
+}
+
+void emit_push(VMWriter *writer, VMKeyword segment, int index) {
+    add_instruction(writer, VM_PUSH, segment, index, NULL);
+}
+
+void emit_pop(VMWriter *writer, VMKeyword segment, int index) {
+    add_instruction(writer, VM_POP, segment, index, NULL);
+}
+
+void emit_command(VMWriter *writer, VMKeyword command) {
+    add_instruction(writer, command, 0, 0, NULL);
+}
+
+void emit_jump(VMWriter *writer, VMKeyword command, const char *label) {
+    add_instruction(writer, command, 0, 0, intern_string(writer->strings, label, strlen(label)));
+}
+
+void emit_function(VMWriter *writer, VMKeyword command, const char *class_name, const char *sub_name, int index) {
+    // The two halves of the name are joined in a buffer of our own, since a name can be as long as the line it's on.
+    size_t class_length = strlen(class_name);
+    size_t sub_length = strlen(sub_name);
+    char *name = (char *)malloc(class_length + sub_length + 2);
+    memcpy(name, class_name, class_length);
+    name[class_length] = '.';
+    memcpy(name + class_length + 1, sub_name, sub_length);
+    add_instruction(writer, command, 0, index, intern_string(writer->strings, name, class_length + sub_length + 1));
+    free(name);
+}
+
+void emit_comment(VMWriter *writer, const char *comment) {
+    add_instruction(writer, VM_COMMENT, 0, 0, intern_string(writer->strings, comment, strlen(comment)));
+}
+
+void write_vm_code(const VMWriter *writer, FILE *output) {
+    // Most lines are around 16 characters, so this is usually the only allocation.
+    TextBuffer buffer = {.length = 0, .space = 16 * (size_t)writer->list_length + 64, .on_heap = true};
+    buffer.text = (char *)malloc(buffer.space);
+    for (int i=0; i<writer->list_length; i++) {
+        format_instruction(&buffer, &(writer->list_array[i]));
+    }
+    fwrite(buffer.text, 1, buffer.length, output);
+    free(buffer.text);
+}
+
+// Adds an instruction with the given fields to the end of writer, and echoes it to the debug output if there is one.
+// name must already be in the writer's string pool (or NULL).
+void add_instruction(VMWriter *writer, VMKeyword command, VMKeyword segment, int index, char *name) {
+    if (writer->list_length == writer->list_space) {
+        writer->list_space *= 2;
+        writer->list_array = (VMInstruction *)realloc(writer->list_array, writer->list_space * sizeof(VMInstruction));
+    }
+    VMInstruction *new = &(writer->list_array[writer->list_length]);
+    new->command = command;
+    new->segment = segment;
+    new->index = index;
+    new->name = name;
+    writer->list_length++;
+
+    if (writer->debug_output != NULL) {
+        char line[64];
+        TextBuffer buffer = {.text = line, .length = 0, .space = sizeof(line), .on_heap = false};
+        format_instruction(&buffer, new);
+        fwrite(buffer.text, 1, buffer.length, writer->debug_output);
+        fflush(writer->debug_output);
+        if (buffer.on_heap) {
+            free(buffer.text);
+        }
+    }
+}
+
+// Appends instruction to buffer as a line of VM code.
+void format_instruction(TextBuffer *buffer, const VMInstruction *instruction) {
+    if (instruction->command == VM_COMMENT) {
+        append_text(buffer, "// ", 3);
+        append_text(buffer, instruction->name, strlen(instruction->name));
+        append_text(buffer, "\n", 1);
+        return;
+    }
+
+    const char *command = VMKeywordToString[instruction->command];
+    append_text(buffer, command, strlen(command));
+    if (instruction->command == VM_PUSH || instruction->command == VM_POP) {
+        const char *segment = VMKeywordToString[instruction->segment];
+        append_text(buffer, " ", 1);
+        append_text(buffer, segment, strlen(segment));
+        append_text(buffer, " ", 1);
+        append_int(buffer, instruction->index);
+    } else if (instruction->name != NULL) {
+        append_text(buffer, " ", 1);
+        append_text(buffer, instruction->name, strlen(instruction->name));
+        if (instruction->command == VM_FUNCTION || instruction->command == VM_CALL) {
+            append_text(buffer, " ", 1);
+            append_int(buffer, instruction->index);
+        }
+    }
+    append_text(buffer, "\n", 1);
+}
+
+// Appends the first length characters of text to buffer, growing it if need be.
+void append_text(TextBuffer *buffer, const char *text, size_t length) {
+    if (buffer->length + length > buffer->space) {
+        size_t new_space = buffer->space * 2;
+        while (buffer->length + length > new_space) {
+            new_space *= 2;
+        }
+        if (buffer->on_heap) {
+            buffer->text = (char *)realloc(buffer->text, new_space);
+        } else {
+            char *new_text = (char *)malloc(new_space);
+            memcpy(new_text, buffer->text, buffer->length);
+            buffer->text = new_text;
+            buffer->on_heap = true;
+        }
+        buffer->space = new_space;
+    }
+    memcpy(buffer->text + buffer->length, text, length);
+    buffer->length += length;
+}
+
+// Appends value to buffer in decimal.
+void append_int(TextBuffer *buffer, int value) {
+    char digits[12];
+    int position = sizeof(digits);
+    unsigned int magnitude = (value < 0) ? -(unsigned int)value : (unsigned int)value;
+    do {
+        digits[--position] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        digits[--position] = '-';
+    }
+    append_text(buffer, digits + position, sizeof(digits) - position);
+}
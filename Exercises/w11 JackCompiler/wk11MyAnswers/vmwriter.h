@@ -0,0 +1,60 @@
+#ifndef VMWRITER_H
+#define VMWRITER_H
+
+#include <stdio.h>
+#include "intern.h"
+
+// VM commands and segments, in the order of the VM translator's Keyword enum so that each one's number is its number
+// in a .vmb file. VM_COMMENT isn't a VM command; it marks a comment line, which only appears in .vm files.
+enum VMKeyword {
+    VM_PUSH, VM_POP, VM_ADD, VM_SUB, VM_NEG, VM_AND, VM_OR, VM_NOT, VM_EQ, VM_GT, VM_LT,
+    VM_LOCAL, VM_CONSTANT, VM_THIS, VM_THAT, VM_POINTER, VM_ARGUMENT, VM_STATIC, VM_TEMP,
+    VM_LABEL, VM_GOTO, VM_IFGOTO, VM_FUNCTION, VM_CALL, VM_RETURN,
+    VM_COMMENT
+}; typedef enum VMKeyword VMKeyword;
+#define NUM_VM_KEYWORDS 25
+extern const char *VMKeywordToString[];
+
+// One VM instruction. For push and pop, segment and index are the memory segment and offset. For function and call,
+// name is the function name and index the number of locals or arguments. For label, goto and if-goto, name is the
+// label, and for a comment it's the text after the //. Every name is in the writer's string pool.
+struct VMInstruction {
+    VMKeyword command;
+    VMKeyword segment;
+    int index;
+    char *name;
+}; typedef struct VMInstruction VMInstruction;
+
+// A VMWriter collects the VM code for a class as it's compiled, so that it can be written out all at once at the end
+// as either a .vm or a .vmb file. The instructions are a growable array stored in list_array, with the number stored
+// in list_length; list_space is only used internally. If debug_output isn't NULL, each instruction is also written
+// there as a line of VM code the moment it's added, and flushed, which is handy when the compiler crashes part way.
+struct VMWriter {
+    VMInstruction *list_array;
+    int list_length;
+    int list_space;
+    StringPool *strings;
+    FILE *debug_output;
+}; typedef struct VMWriter VMWriter;
+
+// Creates and returns a new empty writer, which echoes instructions to debug_output unless it's NULL.
+VMWriter *malloc_vm_writer(FILE *debug_output);
+// Frees every instruction in writer, then writer itself.
+void free_vm_writer(VMWriter *writer);
+
+// Adds "push segment index" or "pop segment index".
+void emit_push(VMWriter *writer, VMKeyword segment, int index);
+void emit_pop(VMWriter *writer, VMKeyword segment, int index);
+// Adds a command with no arguments: an arithmetic or logical command, or return.
+void emit_command(VMWriter *writer, VMKeyword command);
+// Adds a label, goto or if-goto command for the given label.
+void emit_jump(VMWriter *writer, VMKeyword command, const char *label);
+// Adds "function class_name.sub_name index" or "call class_name.sub_name index".
+void emit_function(VMWriter *writer, VMKeyword command, const char *class_name, const char *sub_name, int index);
+// Adds a comment line, which is ignored by everything but people reading the .vm file.
+void emit_comment(VMWriter *writer, const char *comment);
+
+// Writes everything in writer to output as VM code, one instruction per line.
+void write_vm_code(const VMWriter *writer, FILE *output);
+
+#endif